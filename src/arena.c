@@ -0,0 +1,28 @@
+/**
+  ******************************************************************************
+  * @file    arena.c
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Static memory arena for acquisition and signal processing buffers
+  *
+  * Large buffers are statically allocated here instead of on the stack, so
+  * memory use is known at link time. DMA buffers go to the start of SRAM1
+  * (.sram1bss), DSP state and window tables to the 64KB CCM RAM.
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "arena.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+ARENA_SRAM TARENA_SRAM gArenaSram;
+ARENA_CCM TARENA_CCM gArenaCcm;
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
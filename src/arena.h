@@ -0,0 +1,73 @@
+/**
+  ******************************************************************************
+  * @file    arena.h
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Static memory arena for acquisition and signal processing buffers
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f4xx.h"
+#include "sample.h"
+#include "siggen.h"
+#include "measure.h"
+#include "fft.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define ARENA_SRAM_SIZE			(128*1024)	/* SRAM1 + SRAM2 */
+#define ARENA_SRAM_RESERVED		(24*1024)	/* USB, stack and other .bss */
+#define ARENA_CCM_SIZE			(64*1024)
+
+/* Exported macro ------------------------------------------------------------*/
+/* Uninitialized data at the start of SRAM1 (.sram1bss, not loaded, not
+ * zeroed), placed by the linker script ahead of .data and .bss */
+#define ARENA_SRAM				__attribute__ ((section(".sram1bss"), aligned(4)))
+
+/* Uninitialized data in CCM RAM (.ccmbss, not loaded, not zeroed).
+ * CCM RAM is only reachable by the CPU: never place DMA buffers here. */
+#define ARENA_CCM				__attribute__ ((section(".ccmbss")))
+
+/* Compile time check */
+#define ARENA_ASSERT(cond, name)	typedef char arena_assert_##name[(cond) ? 1 : -1]
+
+/* Exported types ------------------------------------------------------------*/
+/* SRAM1: DMA accessible buffers, and tables the CCM budget leaves out */
+typedef struct
+{
+	uint32_t tu32Adc[SAMPLE_BURST_WORDS];							/* Dual ADC DMA words, stream ring, burst */
+	uint16_t tu16Ch1[SAMPLE_MAX_BLOCK_SIZE];						/* Channel 1 samples */
+	uint16_t tu16Ch2[SAMPLE_MAX_BLOCK_SIZE];						/* Channel 2 samples */
+	uint16_t tu16Dac[SIGGEN_NUM_TABLES][SIGGEN_MAX_TABLE];		/* DAC double buffered tables */
+	uint16_t tu16DacArr[SIGGEN_NUM_TABLES];						/* TIM6 ARR of each DAC table */
+	float tfFftSin[FFT_MAX_SIZE/4+1];							/* FFT quarter wave sine table */
+} TARENA_SRAM;
+
+/* CCM RAM: DSP state and tables */
+typedef struct
+{
+	float tfWindow[SAMPLE_MAX_BLOCK_SIZE];						/* Window coefficients */
+	TSWEEP_POINT tSweep[SWEEP_MAX_POINTS];						/* Last sweep results */
+	complex float tBurstZ[MEASURE_BURST_MAX_BLOCKS];			/* Last burst results */
+	float tfFft[FFT_MAX_SIZE];									/* FFT work buffer, power spectrum */
+} TARENA_CCM;
+
+ARENA_ASSERT(SAMPLE_BURST_WORDS >= (SAMPLE_MAX_BLOCK_SIZE+SAMPLE_DUMMY_READS), burst_holds_block);
+ARENA_ASSERT(sizeof(TARENA_SRAM) <= (ARENA_SRAM_SIZE-ARENA_SRAM_RESERVED), sram_budget);
+ARENA_ASSERT(sizeof(TARENA_CCM) <= ARENA_CCM_SIZE, ccm_budget);
+
+/* Exported variables --------------------------------------------------------*/
+extern TARENA_SRAM gArenaSram;
+extern TARENA_CCM gArenaCcm;
+
+#endif	 /* __ARENA_H__ */
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
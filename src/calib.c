@@ -0,0 +1,250 @@
+/**
+  ******************************************************************************
+  * @file    calib.c
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Inter-channel gain and phase self-calibration
+  *
+  * With the DUT removed no current flows through the reference resistor, so
+  * both ADC inputs sit on the same node and vm/vr should be exactly 1. The
+  * measured ratio c(f) holds the channel gain mismatch and the sampling
+  * skew (plus the open fixture), growing in phase with frequency. The
+  * measurement path multiplies vm by 1/c(f), interpolated between the (log
+  * spaced) calibration points linearly in frequency, which is exact for a
+  * pure skew. It costs one complex multiply per block.
+  * Outside the calibrated range the gain/skew model g.exp(-j2.pi.f.tau)
+  * fitted to the points is used. The sample time changes the mismatch, so
+  * each acquisition mode (SAMPLE_MODE_xxx) keeps its own calibration.
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <math.h>
+
+#include "stm32f4xx.h"
+#include "complex.h"
+#include "sample.h"
+#include "measure.h"
+#include "calib.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+	TCALIB_POINT tPoints[CALIB_MAX_POINTS];
+	uint8_t u8Count;
+	double fGain;				/* Fitted model */
+	double fSkew;
+} TCALIB_SET;
+
+/* Private define ------------------------------------------------------------*/
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+static TCALIB_SET gtCal[SAMPLE_NUM_MODES];	/* One per acquisition mode */
+
+/* Private function prototypes -----------------------------------------------*/
+static void FitModel (TCALIB_SET *pCal);
+static double Arg (complex double c);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief Runs the calibration. DUT must be removed (open).
+  * The current calibration is dropped first, so the raw ratio is measured.
+  *
+  * @param fStart	Start frequency (Hz)
+  * @param fStop	Stop frequency (Hz)
+  * @param u8Points	Log spaced points, up to CALIB_MAX_POINTS
+  * @retval Number of points calibrated
+  */
+uint8_t Calib_Run (double fStart, double fStop, uint8_t u8Points)
+{
+	TCALIB_SET *pCal = &gtCal[Sample_GetMode()];
+	complex double vr, vm, c;
+	double fSaved = Measure_GetGenFreq();
+	int ii, jj;
+
+	if (u8Points > CALIB_MAX_POINTS)
+		u8Points = CALIB_MAX_POINTS;
+	if (u8Points < 2)
+		u8Points = 2;
+	if ((fStart <= 0) || (fStop <= fStart))
+		return 0;
+
+	Calib_Clear();
+
+	for (ii = 0; ii < u8Points; ii++)
+	{
+		double fFreq = fStart*pow(fStop/fStart, (double)ii/(double)(u8Points-1));
+
+		pCal->tPoints[ii].fFreq = (float)Measure_SetFreq(fFreq);
+		c = 0;
+		for (jj = 0; jj < MEASURE_NUM_AVG; jj++)
+		{
+			Measure_Vectors(&vr, &vm);
+			if (vr != 0)
+				c += vm / vr;
+		}
+		pCal->tPoints[ii].c = (complex float)(c / (double)MEASURE_NUM_AVG);
+	}
+	pCal->u8Count = u8Points;
+	FitModel(pCal);
+
+	Measure_SetFreq(fSaved);
+	return pCal->u8Count;
+}
+
+/**
+  * @brief Drops the calibration of the acquisition mode: no correction applied
+  *
+  * @param None
+  * @retval None
+  */
+void Calib_Clear (void)
+{
+	TCALIB_SET *pCal = &gtCal[Sample_GetMode()];
+
+	pCal->u8Count = 0;
+	pCal->fGain = 1.0;
+	pCal->fSkew = 0.0;
+	Measure_SetFreq(Measure_GetGenFreq());
+}
+
+/**
+  * @brief Returns the number of calibration points
+  *
+  * @param None
+  * @retval Points, 0 if not calibrated
+  */
+uint8_t Calib_GetCount (void)
+{
+	TCALIB_SET *pCal = &gtCal[Sample_GetMode()];
+
+	return pCal->u8Count;
+}
+
+/**
+  * @brief Returns the calibration points
+  *
+  * @param None
+  * @retval Points (Calib_GetCount)
+  */
+const TCALIB_POINT *Calib_GetPoints (void)
+{
+	TCALIB_SET *pCal = &gtCal[Sample_GetMode()];
+
+	return pCal->tPoints;
+}
+
+/**
+  * @brief Returns the fitted gain/skew model
+  *
+  * @param pfGain	Returns the gain ratio ch2/ch1
+  * @param pfSkew	Returns the ch2 delay referred to ch1 (s)
+  * @retval None
+  */
+void Calib_GetModel (double *pfGain, double *pfSkew)
+{
+	TCALIB_SET *pCal = &gtCal[Sample_GetMode()];
+
+	if (pfGain)
+		*pfGain = (pCal->u8Count > 0) ? pCal->fGain : 1.0;
+	if (pfSkew)
+		*pfSkew = (pCal->u8Count > 0) ? pCal->fSkew : 0.0;
+}
+
+/**
+  * @brief Correction factor for vm at a frequency: 1/c(f)
+  *
+  * @param fFreq	Frequency (Hz)
+  * @retval Correction, 1 if not calibrated
+  */
+complex double Calib_GetCorrection (double fFreq)
+{
+	TCALIB_SET *pCal = &gtCal[Sample_GetMode()];
+	complex double c;
+	TVECTOR_POLAR p;
+	int ii;
+
+	if (pCal->u8Count == 0)
+		return 1.0;
+
+	if ((fFreq < pCal->tPoints[0].fFreq) || (fFreq > pCal->tPoints[pCal->u8Count-1].fFreq))
+	{
+		/* Model */
+		p.fMag = pCal->fGain;
+		p.fPhase = -2.0*M_PI*fFreq*pCal->fSkew;
+		Polar2Rect(p, &c);
+	}
+	else
+	{
+		/* Linear interpolation of magnitude and phase */
+		complex double c0, c1;
+		double fT;
+
+		for (ii = 1; ii < (pCal->u8Count-1); ii++)
+		{
+			if (fFreq <= pCal->tPoints[ii].fFreq)
+				break;
+		}
+		c0 = (complex double)pCal->tPoints[ii-1].c;
+		c1 = (complex double)pCal->tPoints[ii].c;
+		fT = (fFreq - pCal->tPoints[ii-1].fFreq)/(double)(pCal->tPoints[ii].fFreq - pCal->tPoints[ii-1].fFreq);
+
+		p.fMag = CAbs(c0) + fT*(CAbs(c1) - CAbs(c0));
+		p.fPhase = Arg(c0) + fT*Arg(c1/c0);
+		Polar2Rect(p, &c);
+	}
+
+	if (c == 0)
+		return 1.0;
+	return 1.0/c;
+}
+
+/**
+  * @brief Fits gain and skew to the calibration points: mean magnitude,
+  * and least squares phase slope through the origin (unwrapped phase).
+  *
+  * @param pCal		Calibration set
+  * @retval None
+  */
+static void FitModel (TCALIB_SET *pCal)
+{
+	double fSumMag = 0;
+	double fSumFP = 0;
+	double fSumFF = 0;
+	double fPhase = 0;
+	int ii;
+
+	for (ii = 0; ii < pCal->u8Count; ii++)
+	{
+		complex double c = (complex double)pCal->tPoints[ii].c;
+
+		if (ii == 0)
+			fPhase = Arg(c);
+		else
+			fPhase += Arg(c/(complex double)pCal->tPoints[ii-1].c);
+
+		fSumMag += CAbs(c);
+		fSumFP += pCal->tPoints[ii].fFreq*fPhase;
+		fSumFF += (double)pCal->tPoints[ii].fFreq*pCal->tPoints[ii].fFreq;
+	}
+	pCal->fGain = fSumMag/pCal->u8Count;
+	pCal->fSkew = (fSumFF > 0) ? -fSumFP/(2.0*M_PI*fSumFF) : 0.0;
+}
+
+/**
+  * @brief Argument of a complex number
+  *
+  * @param c		Complex number
+  * @retval Angle (rad)
+  */
+static double Arg (complex double c)
+{
+	return atan2(__imag__ c, __real__ c);
+}
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
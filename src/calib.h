@@ -0,0 +1,43 @@
+/**
+  ******************************************************************************
+  * @file    calib.h
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Inter-channel gain and phase self-calibration
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __CALIB_H__
+#define __CALIB_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f4xx.h"
+#include "complex.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define CALIB_MAX_POINTS		32
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+	float fFreq;				/* Frequency (Hz) */
+	complex float c;			/* Channel ratio vm/vr with both inputs on the same node */
+} TCALIB_POINT;
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+extern uint8_t Calib_Run (double fStart, double fStop, uint8_t u8Points);
+extern void Calib_Clear (void);
+extern uint8_t Calib_GetCount (void);
+extern const TCALIB_POINT *Calib_GetPoints (void);
+extern void Calib_GetModel (double *pfGain, double *pfSkew);
+extern complex double Calib_GetCorrection (double fFreq);
+
+#endif	 /* __CALIB_H__ */
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
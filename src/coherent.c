@@ -0,0 +1,334 @@
+/**
+  ******************************************************************************
+  * @file    coherent.c
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Coherent block size solver
+  *
+  * ADC and DAC timing both derive from the 84MHz APB clock: one ADC sample
+  * takes SAMPLE_CLOCK_DIV ticks (acquisition mode dependent), one DAC
+  * sample takes the TIM6 divider D.
+  * A frequency is coherent when the block of N samples holds exactly k
+  * cycles, f = k.fs/N, and the DAC table of L samples holding C cycles
+  * plays exactly that frequency: D.L.k = SAMPLE_CLOCK_DIV.N.C. The solver
+  * finds the shortest block within the frequency tolerance for which such
+  * a table exists, so the Goertzel bin sees no leakage at all.
+  * Above the Nyquist frequency (undersampling) the same holds for the
+  * alias bin k mod N, which must land inside the first Nyquist zone clear
+  * of DC and fs/2. The DAC images at m.fdac +/- f fold too: plans where
+  * one lands on the measured bin are rejected.
+  * Solved plans are kept in a fully associative cache of
+  * COHERENT_CACHE_SIZE entries, at least a full sweep, least recently
+  * used replaced: a repeated sweep runs the solver only for the points
+  * it did not visit before. The linear search of the keys costs a few
+  * microseconds, against milliseconds for the solver.
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <math.h>
+#include <string.h>
+
+#include "stm32f4xx.h"
+#include "sample.h"
+#include "siggen.h"
+#include "coherent.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+	float fFreq;				/* Key: requested frequency, 0 if empty */
+	float fTol;					/* Key: tolerance */
+	uint16_t u16MinBlock;		/* Key: block limits */
+	uint16_t u16MaxBlock;
+	uint32_t u32Used;			/* Lookup count at the last use (LRU) */
+	uint32_t u32Divider;		/* Plan, fActual recomputed from N and k */
+	uint16_t u16BlockSize;
+	uint16_t u16Bin;
+	uint16_t u16TableLen;
+	uint16_t u16Cycles;
+	int8_t i8Status;
+} TCACHE_ENTRY;
+
+/* Private define ------------------------------------------------------------*/
+#define IMAGE_ORDERS		2			/* DAC images checked: m.fdac +/- f, m = 1..IMAGE_ORDERS */
+#define IMAGE_GUARD_BINS	2.0			/* Minimum distance of a folded image to the bin */
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+static TCACHE_ENTRY gtCache[COHERENT_CACHE_SIZE];
+static uint32_t gu32Hits = 0;
+static uint32_t gu32Misses = 0;
+static uint32_t gu32Evictions = 0;
+
+/* Private function prototypes -----------------------------------------------*/
+static int DacPlan (uint16_t u16BlockSize, uint16_t u16Bin, TCOHERENT_PLAN *pPlan);
+static uint32_t Gcd (uint32_t u32A, uint32_t u32B);
+static double FoldBin (double fBin, uint16_t u16BlockSize);
+static int ImagesClear (uint16_t u16BlockSize, uint16_t u16Bin, uint32_t u32Divider);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief Solves the coherent plan for a frequency
+  *
+  * @param fFreq		Requested frequency (Hz)
+  * @param fTol			Relative frequency tolerance
+  * @param u16MinBlock	Minimum block size (noise)
+  * @param u16MaxBlock	Maximum block size (time budget)
+  * @param pPlan		Returns the plan
+  * @retval COHERENT_xxx status
+  */
+int Coherent_Solve (double fFreq, double fTol, uint16_t u16MinBlock, uint16_t u16MaxBlock,
+		TCOHERENT_PLAN *pPlan)
+{
+	double fRate = Sample_GetRate();
+	uint32_t u32N;
+
+	pPlan->i8Status = COHERENT_NOT_FOUND;
+	if ((fFreq < SIGGEN_MIN_FREQ) || (fFreq > SIGGEN_MAX_FREQ))
+		return pPlan->i8Status;
+	if (u16MaxBlock > Sample_GetMaxBlockSize())
+		u16MaxBlock = Sample_GetMaxBlockSize();
+
+	for (u32N = u16MinBlock; u32N <= u16MaxBlock; u32N++)
+	{
+		uint32_t u32K = (uint32_t)((fFreq*u32N)/fRate + 0.5);
+		uint32_t u32Alias = u32K % u32N;
+		double fActual;
+
+		if ((2*u32Alias) > u32N)
+			u32Alias = u32N - u32Alias;
+		if ((u32Alias < 1) || ((2*u32Alias) >= u32N) || (u32K > 0xFFFF))
+			continue;
+		fActual = ((double)u32K*fRate)/u32N;
+		if (fabs(fActual - fFreq) > (fTol*fFreq))
+			continue;
+		if (DacPlan((uint16_t)u32N, (uint16_t)u32K, pPlan))
+		{
+			pPlan->fActual = fActual;
+			pPlan->i8Status = COHERENT_OK;
+			break;
+		}
+	}
+	return pPlan->i8Status;
+}
+
+/**
+  * @brief Cached solver: same as Coherent_Solve, failures are cached too.
+  * A miss takes an empty entry, or else the least recently used one.
+  *
+  * @param fFreq		Requested frequency (Hz)
+  * @param fTol			Relative frequency tolerance
+  * @param u16MinBlock	Minimum block size (noise)
+  * @param u16MaxBlock	Maximum block size (time budget)
+  * @param pPlan		Returns the plan
+  * @retval COHERENT_xxx status
+  */
+int Coherent_Lookup (double fFreq, double fTol, uint16_t u16MinBlock, uint16_t u16MaxBlock,
+		TCOHERENT_PLAN *pPlan)
+{
+	TCACHE_ENTRY *pEntry = NULL;
+	TCACHE_ENTRY *pOldest = &gtCache[0];
+	float fKey = (float)fFreq;
+	float fTolKey = (float)fTol;
+	uint32_t u32Now = gu32Hits + gu32Misses + 1;
+	uint16_t ii;
+
+	for (ii = 0; ii < COHERENT_CACHE_SIZE; ii++)
+	{
+		TCACHE_ENTRY *pCur = &gtCache[ii];
+
+		if ((pCur->fFreq == fKey) && (pCur->fTol == fTolKey)
+				&& (pCur->u16MinBlock == u16MinBlock) && (pCur->u16MaxBlock == u16MaxBlock))
+		{
+			pEntry = pCur;
+			break;
+		}
+		if (pCur->u32Used < pOldest->u32Used)
+			pOldest = pCur;
+	}
+
+	if (pEntry)
+	{
+		gu32Hits++;
+		pPlan->i8Status = pEntry->i8Status;
+		pPlan->u16BlockSize = pEntry->u16BlockSize;
+		pPlan->u16Bin = pEntry->u16Bin;
+		pPlan->u32Divider = pEntry->u32Divider;
+		pPlan->u16TableLen = pEntry->u16TableLen;
+		pPlan->u16Cycles = pEntry->u16Cycles;
+		if (pPlan->i8Status == COHERENT_OK)
+			pPlan->fActual = ((double)pPlan->u16Bin*Sample_GetRate())/pPlan->u16BlockSize;
+	}
+	else
+	{
+		gu32Misses++;
+		pEntry = pOldest;
+		if (pEntry->u32Used != 0)
+			gu32Evictions++;
+		Coherent_Solve(fFreq, fTol, u16MinBlock, u16MaxBlock, pPlan);
+		pEntry->fFreq = fKey;
+		pEntry->fTol = fTolKey;
+		pEntry->u16MinBlock = u16MinBlock;
+		pEntry->u16MaxBlock = u16MaxBlock;
+		pEntry->i8Status = pPlan->i8Status;
+		pEntry->u16BlockSize = pPlan->u16BlockSize;
+		pEntry->u16Bin = pPlan->u16Bin;
+		pEntry->u32Divider = pPlan->u32Divider;
+		pEntry->u16TableLen = pPlan->u16TableLen;
+		pEntry->u16Cycles = pPlan->u16Cycles;
+	}
+	pEntry->u32Used = u32Now;
+	return pPlan->i8Status;
+}
+
+/**
+  * @brief Empties the plan cache
+  *
+  * @param None
+  * @retval None
+  */
+void Coherent_ClearCache (void)
+{
+	memset(gtCache, 0, sizeof(gtCache));
+	gu32Hits = 0;
+	gu32Misses = 0;
+	gu32Evictions = 0;
+}
+
+/**
+  * @brief Returns the plan cache statistics
+  *
+  * @param pu32Hits		Returns the lookups served from the cache
+  * @param pu32Misses	Returns the lookups that ran the solver
+  * @param pu32Evictions	Returns the plans dropped to make room
+  * @retval None
+  */
+void Coherent_GetCacheStats (uint32_t *pu32Hits, uint32_t *pu32Misses, uint32_t *pu32Evictions)
+{
+	if (pu32Hits)
+		*pu32Hits = gu32Hits;
+	if (pu32Misses)
+		*pu32Misses = gu32Misses;
+	if (pu32Evictions)
+		*pu32Evictions = gu32Evictions;
+}
+
+/**
+  * @brief Finds the DAC table for k cycles in a block of N samples:
+  * D.L = P.m and C = Q.m, with P/Q = SAMPLE_CLOCK_DIV.N/k reduced. The
+  * fewest table cycles and then the longest table are preferred. Dividers
+  * whose images fold onto the bin are skipped.
+  *
+  * @param u16BlockSize	Block size N
+  * @param u16Bin		Cycles per block k
+  * @param pPlan		Returns divider, table length and cycles
+  * @retval 1 if found
+  */
+static int DacPlan (uint16_t u16BlockSize, uint16_t u16Bin, TCOHERENT_PLAN *pPlan)
+{
+	uint32_t u32P = Sample_GetClockDiv()*u16BlockSize;
+	uint32_t u32G = Gcd(u32P, u16Bin);
+	uint32_t u32Q = u16Bin/u32G;
+	uint32_t u32M;
+
+	u32P /= u32G;
+	for (u32M = 1; (u32Q*u32M*SIGGEN_MIN_SPC) <= SIGGEN_MAX_TABLE; u32M++)
+	{
+		uint32_t u32T = u32P*u32M;
+		uint32_t u32C = u32Q*u32M;
+		uint32_t u32MinLen = u32C*SIGGEN_MIN_SPC;
+		uint32_t u32L;
+
+		if (u32MinLen < SIGGEN_MIN_TABLE)
+			u32MinLen = SIGGEN_MIN_TABLE;
+		for (u32L = SIGGEN_MAX_TABLE; u32L >= u32MinLen; u32L--)
+		{
+			uint32_t u32D;
+
+			if ((u32T % u32L) != 0)
+				continue;
+			u32D = u32T/u32L;
+			if (u32D > SIGGEN_MAX_DIV)
+				break;
+			if (u32D < SIGGEN_MIN_DIV)
+				continue;
+			if (!ImagesClear(u16BlockSize, u16Bin, u32D))
+				continue;
+
+			pPlan->u16BlockSize = u16BlockSize;
+			pPlan->u16Bin = u16Bin;
+			pPlan->u32Divider = u32D;
+			pPlan->u16TableLen = (uint16_t)u32L;
+			pPlan->u16Cycles = (uint16_t)u32C;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+  * @brief Greatest common divisor
+  *
+  * @param u32A		First operand
+  * @param u32B		Second operand
+  * @retval gcd(u32A, u32B)
+  */
+static uint32_t Gcd (uint32_t u32A, uint32_t u32B)
+{
+	while (u32B != 0)
+	{
+		uint32_t u32R = u32A % u32B;
+
+		u32A = u32B;
+		u32B = u32R;
+	}
+	return u32A;
+}
+
+/**
+  * @brief Folds a bin to the first Nyquist zone
+  *
+  * @param fBin			Bin, any zone
+  * @param u16BlockSize	Block size N
+  * @retval Folded bin, 0 to N/2
+  */
+static double FoldBin (double fBin, uint16_t u16BlockSize)
+{
+	fBin = fmod(fBin, (double)u16BlockSize);
+	if (fBin < 0)
+		fBin += u16BlockSize;
+	if ((2.0*fBin) > u16BlockSize)
+		fBin = u16BlockSize - fBin;
+	return fBin;
+}
+
+/**
+  * @brief Checks that the DAC images m.fdac +/- f do not fold onto the
+  * measured bin. The DAC rate in bins is N.SAMPLE_CLOCK_DIV/D.
+  *
+  * @param u16BlockSize	Block size N
+  * @param u16Bin		Cycles per block k
+  * @param u32Divider	DAC timer divider D
+  * @retval 1 if clear
+  */
+static int ImagesClear (uint16_t u16BlockSize, uint16_t u16Bin, uint32_t u32Divider)
+{
+	double fDac = ((double)Sample_GetClockDiv()*u16BlockSize)/u32Divider;
+	double fBin = FoldBin(u16Bin, u16BlockSize);
+	int iM;
+
+	for (iM = 1; iM <= IMAGE_ORDERS; iM++)
+	{
+		if ((fabs(FoldBin(iM*fDac - u16Bin, u16BlockSize) - fBin) < IMAGE_GUARD_BINS)
+				|| (fabs(FoldBin(iM*fDac + u16Bin, u16BlockSize) - fBin) < IMAGE_GUARD_BINS))
+			return 0;
+	}
+	return 1;
+}
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
@@ -0,0 +1,51 @@
+/**
+  ******************************************************************************
+  * @file    coherent.h
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Coherent block size solver
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __COHERENT_H__
+#define __COHERENT_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f4xx.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define COHERENT_CACHE_SIZE		256		/* Solved plans kept (fully associative, LRU), a full sweep */
+
+/* Solver status */
+#define COHERENT_OK				0
+#define COHERENT_NOT_FOUND		1		/* No plan within tolerance and block limits */
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+	int8_t i8Status;			/* COHERENT_xxx */
+	double fActual;				/* Exact frequency: u16Bin cycles per block (Hz) */
+	uint16_t u16BlockSize;		/* ADC samples per block */
+	uint16_t u16Bin;			/* Cycles per block */
+	uint32_t u32Divider;		/* DAC timer divider */
+	uint16_t u16TableLen;		/* DAC table length */
+	uint16_t u16Cycles;			/* Cycles in the DAC table */
+} TCOHERENT_PLAN;
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+extern int Coherent_Solve (double fFreq, double fTol, uint16_t u16MinBlock, uint16_t u16MaxBlock,
+		TCOHERENT_PLAN *pPlan);
+extern int Coherent_Lookup (double fFreq, double fTol, uint16_t u16MinBlock, uint16_t u16MaxBlock,
+		TCOHERENT_PLAN *pPlan);
+extern void Coherent_ClearCache (void);
+extern void Coherent_GetCacheStats (uint32_t *pu32Hits, uint32_t *pu32Misses, uint32_t *pu32Evictions);
+
+#endif	 /* __COHERENT_H__ */
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
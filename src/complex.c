@@ -39,6 +39,28 @@ double CAbs(complex double xOp)
 	return sqrt((__real__ xOp * __real__ xOp)+(__imag__ xOp * __imag__ xOp));
 }
 
+/**
+  * @brief Calculates the squared modulus (power) of a complex number
+  *
+  * @param  xOp:  Operand
+  * @retval result
+  */
+double CNorm(complex double xOp)
+{
+	return (__real__ xOp * __real__ xOp)+(__imag__ xOp * __imag__ xOp);
+}
+
+/**
+  * @brief Calculates the modulus of a single precision complex number
+  *
+  * @param  xOp:  Operand
+  * @retval result
+  */
+float CAbsf(complex float xOp)
+{
+	return sqrtf((__real__ xOp * __real__ xOp)+(__imag__ xOp * __imag__ xOp));
+}
+
 /**
   * @brief
   *
@@ -39,6 +39,8 @@ typedef struct
 extern void Polar2Rect(TVECTOR_POLAR vpPolar, complex double *pxRect);
 extern void Rect2Polar(complex double xRect, TVECTOR_POLAR *pvPolar);
 extern double CAbs(complex double xOp);
+extern double CNorm(complex double xOp);
+extern float CAbsf(complex float xOp);
 extern complex double CSqrt(complex double cxX);
 extern complex double CPow(complex double cxOp, double dfPow);
 extern complex double CLog(complex double cxOp);
@@ -0,0 +1,365 @@
+/**
+  ******************************************************************************
+  * @file    decimate.c
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Streaming CIC decimation and single bin detection
+  *
+  * Low frequencies need many cycles per block, and a block of raw samples
+  * soon outgrows the arena. Here the ADC streams into a small DMA ring
+  * (Sample_StreamStart) and each half is consumed while the other fills:
+  * a CIC decimator of order DECIMATE_CIC_ORDER (integrators at the raw
+  * rate, combs at the decimated rate) followed by a 3 tap droop
+  * compensation FIR, h = [-1/8, 5/4, -1/8], feeds a Hann windowed single
+  * bin DFT. The window and the detector phasor are rotated recursively,
+  * so the integration length is only bounded by time, and the detector
+  * stays accurate over millions of samples where a Goertzel resonator
+  * loses precision. The per output work is single precision (the M4 FPU
+  * has no double): float phasors and block sums, resynchronized every
+  * RESYNC_LEN outputs from double precision anchors, which also take
+  * the block sums. Only the integrators run at the raw rate; memory is
+  * the ring plus a few words per channel.
+  * Both channels go through identical filters, so their gain and delay
+  * cancel in vm/vr.
+  * Unwindowed sums over DECIMATE_SEGMENTS consecutive segments run along
+  * (Decimate_GetSegments): their spread gives the SNR and uncertainty of
+  * the measurement.
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <math.h>
+#include <string.h>
+
+#include "stm32f4xx.h"
+#include "sample.h"
+#include "arena.h"
+#include "complex.h"
+#include "decimate.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+	float fRe;
+	float fIm;
+} TPHASOR;
+
+typedef struct
+{
+	uint32_t tu32Int[DECIMATE_CIC_ORDER];	/* Integrators, modulo 2^32 */
+	uint32_t tu32Comb[DECIMATE_CIC_ORDER];	/* Comb delays */
+	float tfFir[2];							/* Compensation FIR delay line */
+	TPHASOR tBlock;							/* Detector sum, current resync block */
+	TPHASOR tRaw;							/* Unwindowed sum, current resync block */
+	complex double cX;						/* Detector accumulator */
+	complex double tSeg[DECIMATE_SEGMENTS];	/* Unwindowed segment sums */
+} TDECIMATE_CHANNEL;
+
+/* Private define ------------------------------------------------------------*/
+#define FIR_C				0.125f		/* Compensation FIR: [-c, 1+2c, -c] */
+#define SETTLE_OUTPUTS		(DECIMATE_CIC_ORDER+2)	/* Filter start up, discarded */
+#define RESYNC_LEN			256			/* Float phasors resynchronized every RESYNC_LEN outputs */
+#define RENORM_MASK			0x0FFF		/* Anchors renormalized every 4096 resyncs */
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+static TDECIMATE_STATS gtStats;
+static complex double gtSegVr[DECIMATE_SEGMENTS];
+static complex double gtSegVm[DECIMATE_SEGMENTS];
+static uint8_t gu8Segments = 0;
+
+/* Private function prototypes -----------------------------------------------*/
+static void Integrate (TDECIMATE_CHANNEL *pCh, uint32_t u32Sample);
+static float Comb (TDECIMATE_CHANNEL *pCh, float fGain);
+static void Rotate (TPHASOR *pPhasor, const TPHASOR *pStep);
+static void Anchor (complex double cAnchor, TPHASOR *pPhasor);
+static void Accumulate (TDECIMATE_CHANNEL *pCh, float fX, float fW, const TPHASOR *pRot);
+static void Flush (TDECIMATE_CHANNEL *pCh, uint8_t u8Seg);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief Measures both channels at a frequency on the decimated stream.
+  * The generator must already run at fFreq.
+  *
+  * @param u16Factor	Decimation factor, DECIMATE_MIN_FACTOR to DECIMATE_MAX_FACTOR
+  * @param fFreq		Frequency (Hz), below half the decimated rate
+  * @param u32Samples	Decimated samples integrated
+  * @param pvr			Returns the channel 1 vector
+  * @param pvm			Returns the channel 2 vector
+  * @retval DECIMATE_xxx status
+  */
+int Decimate_Measure (uint16_t u16Factor, double fFreq, uint32_t u32Samples,
+		complex double *pvr, complex double *pvm)
+{
+	TDECIMATE_CHANNEL tCh[2];
+	uint32_t u32Total = u32Samples + SETTLE_OUTPUTS;
+	uint32_t u32Out = 0;
+	uint32_t u32Resync = 0;
+	uint32_t u32Blocks = (u32Samples + RESYNC_LEN - 1)/RESYNC_LEN;
+	uint8_t u8Segs = (u32Blocks < DECIMATE_SEGMENTS) ? (uint8_t)u32Blocks : DECIMATE_SEGMENTS;
+	uint16_t u16Phase = 0;
+	uint16_t u16First = SAMPLE_DUMMY_READS;
+	uint64_t u64Busy = 0;
+	uint64_t u64Elapsed = 0;
+	uint32_t u32Last;
+	float fGain;
+	double fRate, fOmega;
+	complex double cRot = 1.0;
+	complex double cWin = 1.0;
+	complex double cRotBlock, cWinBlock;
+	TPHASOR tRot = {1.0f, 0.0f};
+	TPHASOR tWin = {1.0f, 0.0f};
+	TPHASOR tStep, tWinStep;
+	int iStatus = DECIMATE_OK;
+	int ii;
+
+	memset(&gtStats, 0, sizeof(gtStats));
+	gu8Segments = 0;
+	if ((u16Factor < DECIMATE_MIN_FACTOR) || (u16Factor > DECIMATE_MAX_FACTOR) || (u32Samples < 2))
+		return DECIMATE_BAD_PARAM;
+	fRate = (double)Sample_GetAdcRate()/u16Factor;
+	if ((fFreq <= 0) || ((2.0*fFreq) >= fRate))
+		return DECIMATE_BAD_PARAM;
+
+	memset(tCh, 0, sizeof(tCh));
+	fGain = 1.0f/((float)u16Factor*u16Factor*u16Factor);
+	fOmega = (2.0*M_PI*fFreq)/fRate;
+	tStep.fRe = (float)cos(fOmega);
+	tStep.fIm = (float)-sin(fOmega);
+	tWinStep.fRe = (float)cos((2.0*M_PI)/u32Samples);
+	tWinStep.fIm = (float)sin((2.0*M_PI)/u32Samples);
+	__real__ cRotBlock = cos(fOmega*RESYNC_LEN);
+	__imag__ cRotBlock = -sin(fOmega*RESYNC_LEN);
+	__real__ cWinBlock = cos((2.0*M_PI*RESYNC_LEN)/u32Samples);
+	__imag__ cWinBlock = sin((2.0*M_PI*RESYNC_LEN)/u32Samples);
+
+	Sample_StreamStart(gArenaSram.tu32Adc, DECIMATE_RING_SIZE);
+	u32Last = DWT->CYCCNT;
+	while (u32Out < u32Total)
+	{
+		uint32_t *pu32Half = Sample_StreamWait();
+		uint32_t u32Now = DWT->CYCCNT;
+		uint16_t jj;
+
+		u64Elapsed += u32Now - u32Last;
+		u32Last = u32Now;
+		if (pu32Half == NULL)
+		{
+			iStatus = DECIMATE_OVERRUN;
+			break;
+		}
+
+		for (jj = u16First; (jj < DECIMATE_RING_SIZE/2) && (u32Out < u32Total); jj++)
+		{
+			uint32_t u32Word = pu32Half[jj];
+			float fCh1, fCh2, fW;
+			int kk;
+
+			Integrate(&tCh[0], u32Word & 0xFFFF);
+			Integrate(&tCh[1], u32Word >> 16);
+			if (++u16Phase < u16Factor)
+				continue;
+			u16Phase = 0;
+
+			fCh1 = Comb(&tCh[0], fGain);
+			fCh2 = Comb(&tCh[1], fGain);
+			if (u32Out++ < SETTLE_OUTPUTS)
+				continue;
+
+			fW = 0.5f - 0.5f*tWin.fRe;
+			Accumulate(&tCh[0], fCh1, fW, &tRot);
+			Accumulate(&tCh[1], fCh2, fW, &tRot);
+			Rotate(&tRot, &tStep);
+			Rotate(&tWin, &tWinStep);
+			if (((u32Out - SETTLE_OUTPUTS) % RESYNC_LEN) != 0)
+				continue;
+
+			/* Block sums into double, float phasors back on the anchors */
+			for (kk = 0; kk < 2; kk++)
+				Flush(&tCh[kk], (uint8_t)((u32Resync*u8Segs)/u32Blocks));
+			cRot *= cRotBlock;
+			cWin *= cWinBlock;
+			if ((++u32Resync & RENORM_MASK) == 0)
+			{
+				cRot /= CAbs(cRot);
+				cWin /= CAbs(cWin);
+			}
+			Anchor(cRot, &tRot);
+			Anchor(cWin, &tWin);
+		}
+		u16First = 0;
+		u64Busy += DWT->CYCCNT - u32Last;
+	}
+	Sample_StreamStop();
+	if (u32Resync < u32Blocks)
+	{
+		for (ii = 0; ii < 2; ii++)
+			Flush(&tCh[ii], (uint8_t)((u32Resync*u8Segs)/u32Blocks));
+	}
+	if (iStatus == DECIMATE_OK)
+	{
+		memcpy(gtSegVr, tCh[0].tSeg, sizeof(gtSegVr));
+		memcpy(gtSegVm, tCh[1].tSeg, sizeof(gtSegVm));
+		gu8Segments = u8Segs;
+	}
+
+	gtStats.fRate = fRate;
+	gtStats.u32Samples = (u32Out > SETTLE_OUTPUTS) ? u32Out - SETTLE_OUTPUTS : 0;
+	gtStats.u32TimeMs = (uint32_t)(u64Elapsed/(SystemCoreClock/1000));
+	gtStats.u32LoadPct = (u64Elapsed > 0) ? (uint32_t)((100*u64Busy)/u64Elapsed) : 0;
+
+	if (pvr)
+		*pvr = tCh[0].cX;
+	if (pvm)
+		*pvm = tCh[1].cX;
+	return iStatus;
+}
+
+/**
+  * @brief Returns the statistics of the last Decimate_Measure
+  *
+  * @param pStats	Returns the statistics
+  * @retval None
+  */
+void Decimate_GetStats (TDECIMATE_STATS *pStats)
+{
+	*pStats = gtStats;
+}
+
+/**
+  * @brief Returns the segment sums of the last Decimate_Measure: vectors
+  * of each channel over consecutive parts of the integration, without
+  * the window, same scale for both channels
+  *
+  * @param tVr	Returns the channel 1 segments, DECIMATE_SEGMENTS entries
+  * @param tVm	Returns the channel 2 segments
+  * @retval Segments, 0 if the last measurement failed
+  */
+uint8_t Decimate_GetSegments (complex double tVr[], complex double tVm[])
+{
+	memcpy(tVr, gtSegVr, gu8Segments*sizeof(complex double));
+	memcpy(tVm, gtSegVm, gu8Segments*sizeof(complex double));
+	return gu8Segments;
+}
+
+/**
+  * @brief CIC integrators, raw rate. Wrap around is harmless: the comb
+  * output is exact as long as it fits in 32 bits.
+  *
+  * @param pCh			Channel state
+  * @param u32Sample	ADC sample
+  * @retval None
+  */
+static void Integrate (TDECIMATE_CHANNEL *pCh, uint32_t u32Sample)
+{
+	uint32_t u32Acc = u32Sample - SAMPLE_MID_SCALE;
+	int ii;
+
+	for (ii = 0; ii < DECIMATE_CIC_ORDER; ii++)
+	{
+		pCh->tu32Int[ii] += u32Acc;
+		u32Acc = pCh->tu32Int[ii];
+	}
+}
+
+/**
+  * @brief CIC combs and compensation FIR, decimated rate
+  *
+  * @param pCh		Channel state
+  * @param fGain	CIC gain normalization, 1/R^order
+  * @retval Decimated sample (ADC counts from mid scale)
+  */
+static float Comb (TDECIMATE_CHANNEL *pCh, float fGain)
+{
+	uint32_t u32Y = pCh->tu32Int[DECIMATE_CIC_ORDER-1];
+	float fX, fY;
+	int ii;
+
+	for (ii = 0; ii < DECIMATE_CIC_ORDER; ii++)
+	{
+		uint32_t u32T = u32Y;
+
+		u32Y -= pCh->tu32Comb[ii];
+		pCh->tu32Comb[ii] = u32T;
+	}
+	fX = (float)(int32_t)u32Y * fGain;
+
+	fY = (1.0f + 2.0f*FIR_C)*pCh->tfFir[0] - FIR_C*(fX + pCh->tfFir[1]);
+	pCh->tfFir[1] = pCh->tfFir[0];
+	pCh->tfFir[0] = fX;
+	return fY;
+}
+
+/**
+  * @brief Rotates a phasor one step, single precision
+  *
+  * @param pPhasor	Phasor
+  * @param pStep	Rotation step
+  * @retval None
+  */
+static void Rotate (TPHASOR *pPhasor, const TPHASOR *pStep)
+{
+	float fRe = pPhasor->fRe*pStep->fRe - pPhasor->fIm*pStep->fIm;
+
+	pPhasor->fIm = pPhasor->fRe*pStep->fIm + pPhasor->fIm*pStep->fRe;
+	pPhasor->fRe = fRe;
+}
+
+/**
+  * @brief Reloads a float phasor from its double precision anchor
+  *
+  * @param cAnchor	Anchor
+  * @param pPhasor	Returns the phasor
+  * @retval None
+  */
+static void Anchor (complex double cAnchor, TPHASOR *pPhasor)
+{
+	pPhasor->fRe = (float)__real__ cAnchor;
+	pPhasor->fIm = (float)__imag__ cAnchor;
+}
+
+/**
+  * @brief Adds a decimated sample to the block sums of a channel:
+  * windowed for the detector, unwindowed for the segments
+  *
+  * @param pCh		Channel state
+  * @param fX		Decimated sample
+  * @param fW		Window
+  * @param pRot		Detector phasor
+  * @retval None
+  */
+static void Accumulate (TDECIMATE_CHANNEL *pCh, float fX, float fW, const TPHASOR *pRot)
+{
+	pCh->tRaw.fRe += fX*pRot->fRe;
+	pCh->tRaw.fIm += fX*pRot->fIm;
+	fX *= fW;
+	pCh->tBlock.fRe += fX*pRot->fRe;
+	pCh->tBlock.fIm += fX*pRot->fIm;
+}
+
+/**
+  * @brief Moves the block sums of a channel into the double precision
+  * detector accumulator and segment
+  *
+  * @param pCh		Channel state
+  * @param u8Seg	Segment of the block
+  * @retval None
+  */
+static void Flush (TDECIMATE_CHANNEL *pCh, uint8_t u8Seg)
+{
+	__real__ pCh->cX += pCh->tBlock.fRe;
+	__imag__ pCh->cX += pCh->tBlock.fIm;
+	__real__ pCh->tSeg[u8Seg] += pCh->tRaw.fRe;
+	__imag__ pCh->tSeg[u8Seg] += pCh->tRaw.fIm;
+	pCh->tBlock.fRe = 0;
+	pCh->tBlock.fIm = 0;
+	pCh->tRaw.fRe = 0;
+	pCh->tRaw.fIm = 0;
+}
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
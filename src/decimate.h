@@ -0,0 +1,52 @@
+/**
+  ******************************************************************************
+  * @file    decimate.h
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Streaming CIC decimation and single bin detection
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __DECIMATE_H__
+#define __DECIMATE_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f4xx.h"
+#include "complex.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define DECIMATE_CIC_ORDER		3
+#define DECIMATE_MIN_FACTOR		2
+#define DECIMATE_MAX_FACTOR		64		/* CIC register growth: 12+3.log2(R) bits in 32 */
+#define DECIMATE_RING_SIZE		512		/* DMA ring (dual ADC words), two halves */
+#define DECIMATE_SEGMENTS		8		/* Segment sums kept for the quality estimate */
+
+/* Status */
+#define DECIMATE_OK				0
+#define DECIMATE_OVERRUN		1		/* A half ring was overwritten before being processed */
+#define DECIMATE_BAD_PARAM		2		/* Factor out of range or frequency above the decimated Nyquist */
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+	double fRate;				/* Decimated sampling rate (sps) */
+	uint32_t u32Samples;		/* Decimated samples integrated */
+	uint32_t u32TimeMs;			/* Acquisition time */
+	uint32_t u32LoadPct;		/* CPU time processing the stream (%) */
+} TDECIMATE_STATS;
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+extern int Decimate_Measure (uint16_t u16Factor, double fFreq, uint32_t u32Samples,
+		complex double *pvr, complex double *pvm);
+extern void Decimate_GetStats (TDECIMATE_STATS *pStats);
+extern uint8_t Decimate_GetSegments (complex double tVr[], complex double tVm[]);
+
+#endif	 /* __DECIMATE_H__ */
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
@@ -0,0 +1,426 @@
+/**
+  ******************************************************************************
+  * @file    fft.c
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Real FFT spectrum analysis
+  *
+  * A single Goertzel bin cannot see interference, spurs or harmonics. This
+  * module takes the spectrum of a sampled block: the N real samples are
+  * packed as N/2 complex points (even samples real, odd imaginary), a
+  * radix-4 decimation in frequency FFT runs on them (plus one radix-2
+  * stage when log2(N/2) is odd) and a final split pass gives the N/2 bins
+  * of the real signal. Each radix-4 butterfly leaves its two middle
+  * outputs swapped, which makes it two merged radix-2 stages, so the
+  * output is in plain bit reversed order (RBIT) whatever the stage mix.
+  * The twiddles come from a quarter wave sine table, rebuilt only when the
+  * size changes. The work buffer lives in CCM RAM, the table in SRAM1.
+  * The block is windowed on the fly with the selected window at the FFT
+  * length (Windowing_Eval, cosine terms from the twiddle table), so the
+  * window table of the measurement block is left alone. Levels are
+  * referred to a full scale sine (dBFS) through the coherent gain of that
+  * window; tone powers are summed over the bins inside its main lobe
+  * (Windowing_GetMainLobe, the guard of the Goertzel harmonics) and
+  * divided by its ENBW.
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <math.h>
+#include <stdlib.h>
+
+#include "stm32f4xx.h"
+#include "sample.h"
+#include "windowing_fn.h"
+#include "arena.h"
+#include "fft.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+#define PEAK_SEARCH_BINS	2			/* Fundamental searched around the expected bin */
+#define MIN_POWER			1e-20f		/* Floor of the dB conversions */
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+static uint16_t gu16Size = 0;			/* Planned size */
+static uint8_t gu8Log2;					/* log2 of the complex points, N/2 */
+
+/* Private function prototypes -----------------------------------------------*/
+static void Plan (uint16_t u16Size);
+static void Twiddle (uint32_t u32Index, float *pfCos, float *pfSin);
+static void ComplexFft (float tfData[], uint16_t u16Points);
+static void RealSplit (float tfData[], uint16_t u16Points);
+static float LobePower (const float tfPower[], int iBin, int iLobe, uint16_t u16Bins, float fEnbw);
+static int FoldBin (int iBin, uint16_t u16Size);
+static float Db (float fPower);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief Spectrum of a block and its figures of merit. The samples are
+  * not modified. The power spectrum (Fft_GetSpectrum) is left in the
+  * work buffer until the next call.
+  *
+  * @param txSampleData	Samples
+  * @param u16Size		Block size: power of two, FFT_MIN_SIZE to FFT_MAX_SIZE
+  * @param fBin			Expected fundamental bin (Goertzel_GetBin)
+  * @param pResult		Returns fundamental, noise floor, SFDR and THD
+  * @retval FFT_xxx status
+  */
+int Fft_Analyze (const uint16_t txSampleData[], uint16_t u16Size, double fBin, TFFT_RESULT *pResult)
+{
+	float *pfData = gArenaCcm.tfFft;
+	float fMid = (float)(SAMPLE_MID_SCALE << Sample_GetOversampling());
+	float fScale, fCg, fEnbw, fBest = -1.0f, fFund, fSpur = 0, fHarm = 0, fNoise = 0;
+	float fSum = 0, fSum2 = 0;
+	uint16_t u16Bins = u16Size/2;
+	uint32_t u32Noise = 0;
+	int iLobe, iFund, iExp, iBin, iH, ii;
+
+	if ((u16Size < FFT_MIN_SIZE) || (u16Size > FFT_MAX_SIZE) || ((u16Size & (u16Size-1)) != 0))
+		return FFT_BAD_SIZE;
+	Plan(u16Size);
+
+	/* Window at the FFT length, with its coherent gain and ENBW */
+	for (ii = 0; ii < u16Size; ii++)
+	{
+		float tfCos[4];
+		float fW, fSin;
+		int kk;
+
+		for (kk = 0; kk < 4; kk++)
+			Twiddle(((uint32_t)(kk+1)*ii) % u16Size, &tfCos[kk], &fSin);
+		fW = Windowing_Eval((uint16_t)ii, u16Size, tfCos);
+		fSum += fW;
+		fSum2 += fW*fW;
+		pfData[ii] = fW*((float)txSampleData[ii] - fMid);
+	}
+	fCg = fSum/u16Size;
+	fEnbw = (u16Size*fSum2)/(fSum*fSum);
+	ComplexFft(pfData, u16Bins);
+	RealSplit(pfData, u16Bins);
+
+	/* Bins strictly inside the main lobe, the ones the Goertzel harmonic
+	 * guard excludes; amplitude scale: 2|X|/(N.CG), full scale 1 */
+	iLobe = (int)ceilf(Windowing_GetMainLobe()) - 1;
+	fScale = 2.0f/(u16Size*fCg*fMid);
+
+	/* Fundamental peak, phasor kept before the power conversion */
+	iExp = (int)(fBin + 0.5);
+	iFund = iExp;
+	for (iBin = iExp - PEAK_SEARCH_BINS; iBin <= (iExp + PEAK_SEARCH_BINS); iBin++)
+	{
+		float fMag2;
+
+		if ((iBin < 1) || (iBin >= u16Bins))
+			continue;
+		fMag2 = pfData[2*iBin]*pfData[2*iBin] + pfData[2*iBin+1]*pfData[2*iBin+1];
+		if (fMag2 > fBest)
+		{
+			fBest = fMag2;
+			iFund = iBin;
+		}
+	}
+	if (iFund < 1)
+		iFund = 1;
+	if (iFund >= u16Bins)
+		iFund = u16Bins - 1;
+	__real__ pResult->cFund = 2.0*pfData[2*iFund]/(u16Size*fCg);
+	__imag__ pResult->cFund = 2.0*pfData[2*iFund+1]/(u16Size*fCg);
+
+	/* Power spectrum in place (bin k overwrites the real part of bin k/2) */
+	for (ii = 0; ii < u16Bins; ii++)
+	{
+		float fRe = pfData[2*ii]*fScale;
+		float fIm = (ii == 0) ? 0 : pfData[2*ii+1]*fScale;
+
+		pfData[ii] = fRe*fRe + fIm*fIm;
+	}
+
+	/* Harmonics, folded to the first Nyquist zone */
+	fFund = LobePower(pfData, iFund, iLobe, u16Bins, fEnbw);
+	for (iH = 2; iH <= FFT_MAX_HARMONIC; iH++)
+	{
+		iBin = FoldBin(iH*iFund, u16Size);
+		if ((iBin > iLobe) && (abs(iBin - iFund) > iLobe))
+			fHarm += LobePower(pfData, iBin, iLobe, u16Bins, fEnbw);
+	}
+
+	/* Spur and noise floor: outside the DC and fundamental lobes; the
+	 * noise floor also skips the harmonic lobes */
+	pResult->u16SpurBin = 0;
+	for (iBin = iLobe + 1; iBin < u16Bins; iBin++)
+	{
+		if (abs(iBin - iFund) <= iLobe)
+			continue;
+		if (pfData[iBin] > fSpur)
+		{
+			fSpur = pfData[iBin];
+			pResult->u16SpurBin = (uint16_t)iBin;
+		}
+		for (iH = 2; iH <= FFT_MAX_HARMONIC; iH++)
+		{
+			if (abs(iBin - FoldBin(iH*iFund, u16Size)) <= iLobe)
+				break;
+		}
+		if (iH > FFT_MAX_HARMONIC)
+		{
+			fNoise += pfData[iBin];
+			u32Noise++;
+		}
+	}
+
+	pResult->u16FundBin = (uint16_t)iFund;
+	pResult->fFundDb = Db(fFund);
+	pResult->fNoiseDb = Db((u32Noise > 0) ? fNoise/u32Noise : 0);
+	pResult->fSfdrDb = Db(pfData[iFund]) - Db(fSpur);
+	pResult->fThdDb = Db(fHarm) - Db(fFund);
+	return FFT_OK;
+}
+
+/**
+  * @brief Returns the power spectrum of the last Fft_Analyze: N/2 bins,
+  * referred to a full scale sine (1.0 = 0dBFS)
+  *
+  * @param None
+  * @retval Power per bin
+  */
+const float *Fft_GetSpectrum (void)
+{
+	return gArenaCcm.tfFft;
+}
+
+/**
+  * @brief Builds the quarter wave sine table, sin(2.pi.k/N) k = 0..N/4,
+  * for a new size
+  *
+  * @param u16Size	Real points N
+  * @retval None
+  */
+static void Plan (uint16_t u16Size)
+{
+	uint16_t ii;
+
+	if (u16Size == gu16Size)
+		return;
+	for (ii = 0; ii <= u16Size/4; ii++)
+		gArenaSram.tfFftSin[ii] = (float)sin((2.0*M_PI*ii)/u16Size);
+	gArenaSram.tfFftSin[u16Size/4] = 1.0f;
+
+	gu8Log2 = 0;
+	while ((1u << (gu8Log2+1)) <= (uint32_t)(u16Size/2))
+		gu8Log2++;
+	gu16Size = u16Size;
+}
+
+/**
+  * @brief Twiddle exp(-j.2.pi.k/N) from the quarter wave table
+  *
+  * @param u32Index	k, 0 to N-1
+  * @param pfCos	Returns cos(2.pi.k/N)
+  * @param pfSin	Returns sin(2.pi.k/N)
+  * @retval None
+  */
+static void Twiddle (uint32_t u32Index, float *pfCos, float *pfSin)
+{
+	const float *pfTab = gArenaSram.tfFftSin;
+	uint32_t u32Q = gu16Size/4;
+	uint32_t u32R = u32Index % u32Q;
+
+	switch (u32Index / u32Q)
+	{
+	case 0:
+		*pfCos = pfTab[u32Q - u32R];
+		*pfSin = pfTab[u32R];
+		break;
+	case 1:
+		*pfCos = -pfTab[u32R];
+		*pfSin = pfTab[u32Q - u32R];
+		break;
+	case 2:
+		*pfCos = -pfTab[u32Q - u32R];
+		*pfSin = -pfTab[u32R];
+		break;
+	default:
+		*pfCos = pfTab[u32R];
+		*pfSin = -pfTab[u32Q - u32R];
+		break;
+	}
+}
+
+/**
+  * @brief In place complex FFT, decimation in frequency: radix-4 stages
+  * (middle outputs swapped), a radix-2 stage if log2(M) is odd, then the
+  * bit reversal.
+  *
+  * @param tfData		M complex points, interleaved re/im
+  * @param u16Points	M, power of two
+  * @retval None
+  */
+static void ComplexFft (float tfData[], uint16_t u16Points)
+{
+	uint32_t u32Q, u32G, u32J, u32Stride;
+	uint32_t ii;
+
+	for (u32Q = u16Points/4; u32Q >= 1; u32Q /= 4)
+	{
+		/* Twiddle W_4q^m = exp(-j.2.pi.m.(N/4q)/N) */
+		u32Stride = gu16Size/(4*u32Q);
+		for (u32J = 0; u32J < u32Q; u32J++)
+		{
+			float fC1, fS1, fC2, fS2, fC3, fS3;
+
+			Twiddle(u32J*u32Stride, &fC1, &fS1);
+			Twiddle(2*u32J*u32Stride, &fC2, &fS2);
+			Twiddle(3*u32J*u32Stride, &fC3, &fS3);
+			for (u32G = u32J; u32G < u16Points; u32G += 4*u32Q)
+			{
+				float *p0 = &tfData[2*u32G];
+				float *p1 = &tfData[2*(u32G + u32Q)];
+				float *p2 = &tfData[2*(u32G + 2*u32Q)];
+				float *p3 = &tfData[2*(u32G + 3*u32Q)];
+				float fAr = p0[0] + p2[0], fAi = p0[1] + p2[1];
+				float fBr = p0[0] - p2[0], fBi = p0[1] - p2[1];
+				float fCr = p1[0] + p3[0], fCi = p1[1] + p3[1];
+				float fDr = p1[0] - p3[0], fDi = p1[1] - p3[1];
+				float fTr, fTi;
+
+				/* y0 = a+c; y1 = (a-c).W^2j; y2 = (b-jd).W^j; y3 = (b+jd).W^3j */
+				p0[0] = fAr + fCr;
+				p0[1] = fAi + fCi;
+				fTr = fAr - fCr;
+				fTi = fAi - fCi;
+				p1[0] = fTr*fC2 + fTi*fS2;
+				p1[1] = fTi*fC2 - fTr*fS2;
+				fTr = fBr + fDi;
+				fTi = fBi - fDr;
+				p2[0] = fTr*fC1 + fTi*fS1;
+				p2[1] = fTi*fC1 - fTr*fS1;
+				fTr = fBr - fDi;
+				fTi = fBi + fDr;
+				p3[0] = fTr*fC3 + fTi*fS3;
+				p3[1] = fTi*fC3 - fTr*fS3;
+			}
+		}
+	}
+
+	/* log2(M) odd: last radix-2 stage, no twiddles */
+	if (gu8Log2 & 1)
+	{
+		for (ii = 0; ii < u16Points; ii += 2)
+		{
+			float fR = tfData[2*ii] - tfData[2*ii+2];
+			float fI = tfData[2*ii+1] - tfData[2*ii+3];
+
+			tfData[2*ii] += tfData[2*ii+2];
+			tfData[2*ii+1] += tfData[2*ii+3];
+			tfData[2*ii+2] = fR;
+			tfData[2*ii+3] = fI;
+		}
+	}
+
+	for (ii = 0; ii < u16Points; ii++)
+	{
+		uint32_t u32Rev = __RBIT(ii) >> (32 - gu8Log2);
+
+		if (u32Rev > ii)
+		{
+			float fR = tfData[2*ii], fI = tfData[2*ii+1];
+
+			tfData[2*ii] = tfData[2*u32Rev];
+			tfData[2*ii+1] = tfData[2*u32Rev+1];
+			tfData[2*u32Rev] = fR;
+			tfData[2*u32Rev+1] = fI;
+		}
+	}
+}
+
+/**
+  * @brief Bins of the real signal from the FFT of its even/odd packing:
+  * X[k] = E + W^k.O and X[M-k] = conj(E - W^k.O), E = (Z[k]+Z*[M-k])/2,
+  * O = (Z[k]-Z*[M-k])/2j. X[0] is left in the real part of bin 0, the
+  * Nyquist bin X[M] in its imaginary part.
+  *
+  * @param tfData		M complex points, interleaved re/im
+  * @param u16Points	M
+  * @retval None
+  */
+static void RealSplit (float tfData[], uint16_t u16Points)
+{
+	float fR0 = tfData[0], fI0 = tfData[1];
+	uint32_t u32K;
+
+	tfData[0] = fR0 + fI0;
+	tfData[1] = fR0 - fI0;
+	for (u32K = 1; u32K <= u16Points/2; u32K++)
+	{
+		float *pA = &tfData[2*u32K];
+		float *pB = &tfData[2*(u16Points - u32K)];
+		float fEr = 0.5f*(pA[0] + pB[0]), fEi = 0.5f*(pA[1] - pB[1]);
+		float fOr = 0.5f*(pA[1] + pB[1]), fOi = -0.5f*(pA[0] - pB[0]);
+		float fC, fS, fWr, fWi;
+
+		/* W^k.O, W = cos - j.sin */
+		Twiddle(u32K, &fC, &fS);
+		fWr = fOr*fC + fOi*fS;
+		fWi = fOi*fC - fOr*fS;
+		pA[0] = fEr + fWr;
+		pA[1] = fEi + fWi;
+		pB[0] = fEr - fWr;
+		pB[1] = -(fEi - fWi);
+	}
+}
+
+/**
+  * @brief Tone power: main lobe sum divided by the ENBW
+  *
+  * @param tfPower	Power spectrum
+  * @param iBin		Tone bin
+  * @param iLobe	Main lobe half width (bins)
+  * @param u16Bins	Bins in the spectrum
+  * @retval Power (full scale sine = 1)
+  */
+static float LobePower (const float tfPower[], int iBin, int iLobe, uint16_t u16Bins, float fEnbw)
+{
+	float fSum = 0;
+	int ii;
+
+	for (ii = iBin - iLobe; ii <= (iBin + iLobe); ii++)
+	{
+		if ((ii >= 1) && (ii < u16Bins))
+			fSum += tfPower[ii];
+	}
+	return fSum/fEnbw;
+}
+
+/**
+  * @brief Folds a bin to the first Nyquist zone
+  *
+  * @param iBin		Bin, any zone
+  * @param u16Size	Real points N
+  * @retval Bin, 0 to N/2
+  */
+static int FoldBin (int iBin, uint16_t u16Size)
+{
+	iBin %= u16Size;
+	if ((2*iBin) > u16Size)
+		iBin = u16Size - iBin;
+	return iBin;
+}
+
+/**
+  * @brief Power to dB
+  *
+  * @param fPower	Power
+  * @retval dB
+  */
+static float Db (float fPower)
+{
+	return 10.0f*log10f((fPower > MIN_POWER) ? fPower : MIN_POWER);
+}
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * @file    fft.h
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Real FFT spectrum analysis
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __FFT_H__
+#define __FFT_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f4xx.h"
+#include "complex.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define FFT_MIN_SIZE			16
+#define FFT_MAX_SIZE			2048	/* Real points, power of two (CCM budget) */
+#define FFT_MAX_HARMONIC		5		/* THD: harmonics 2 to FFT_MAX_HARMONIC */
+
+/* Status */
+#define FFT_OK					0
+#define FFT_BAD_SIZE			1		/* Block size not a power of two in range */
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+	complex double cFund;		/* Fundamental phasor, LSB peak */
+	uint16_t u16FundBin;		/* Fundamental (peak) bin */
+	uint16_t u16SpurBin;		/* Largest spur bin */
+	float fFundDb;				/* Fundamental level (dBFS) */
+	float fNoiseDb;				/* Mean bin level outside DC, tones and harmonics (dBFS) */
+	float fSfdrDb;				/* Fundamental to largest spur (dBc) */
+	float fThdDb;				/* Harmonics 2 to FFT_MAX_HARMONIC (dBc) */
+} TFFT_RESULT;
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+extern int Fft_Analyze (const uint16_t txSampleData[], uint16_t u16Size, double fBin, TFFT_RESULT *pResult);
+extern const float *Fft_GetSpectrum (void);
+
+#endif	 /* __FFT_H__ */
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
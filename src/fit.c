@@ -0,0 +1,460 @@
+/**
+  ******************************************************************************
+  * @file    fit.c
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Equivalent circuit fitting over sweep data
+  *
+  * Levenberg-Marquardt least squares fit of a circuit model to the complex
+  * impedance of a sweep. Parameters are fitted as logarithms so they stay
+  * positive and similarly scaled; residuals are relative to |Z|. The model
+  * derivatives are analytic, so each iteration costs one pass over the
+  * points plus a FIT_MAX_PARAMS square solve, all in float.
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "stm32f4xx.h"
+#include "complex.h"
+#include "fit.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+	const char *pszName;
+	uint8_t u8NumParams;
+	const char *tpszParam[FIT_MAX_PARAMS];
+} TFIT_MODEL;
+
+/* Private define ------------------------------------------------------------*/
+#define LM_LAMBDA_INIT		1e-3f
+#define LM_LAMBDA_MAX		1e10f
+#define LM_TOLERANCE		1e-7f		/* Relative cost improvement to stop */
+#define MIN_Z				1e-6f
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+static const TFIT_MODEL gtModels[FIT_MODEL_COUNT] =
+{
+	{ "SERIES_RLC",		3, { "R", "L", "C", "" } },
+	{ "PARALLEL_RLC",	3, { "R", "L", "C", "" } },
+	{ "CRYSTAL_BVD",	4, { "Rm", "Lm", "Cm", "C0" } },
+	{ "CAPACITOR",		3, { "C", "ESR", "ESL", "" } }
+};
+
+/* Private function prototypes -----------------------------------------------*/
+static complex float Eval (uint8_t u8Model, const float tfP[], float fW, complex float tdZ[]);
+static void InitialGuess (const TSWEEP_POINT tPoints[], uint16_t u16Count, uint8_t u8Model, float tfP[]);
+static float Cost (const TSWEEP_POINT tPoints[], uint16_t u16Count, uint8_t u8Model, const float tfX[]);
+static int Solve (float tfA[FIT_MAX_PARAMS][FIT_MAX_PARAMS], float tfB[], int n);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief Fits a circuit model to sweep data
+  *
+  * @param tPoints	Sweep points
+  * @param u16Count	Number of points
+  * @param u8Model	FIT_xxx model
+  * @param pResult	Returns the fitted model, zeroed with FIT_ERROR status
+  *					when there are fewer points than parameters
+  * @retval FIT_xxx status
+  */
+int Fit_Run (const TSWEEP_POINT tPoints[], uint16_t u16Count, uint8_t u8Model, TFIT_RESULT *pResult)
+{
+	float tfX[FIT_MAX_PARAMS];
+	float tfXNew[FIT_MAX_PARAMS];
+	float fCost, fCostNew;
+	float fLambda = LM_LAMBDA_INIT;
+	uint8_t u8Num;
+	int iIter;
+	int ii, jj;
+	uint16_t kk;
+
+	if (!pResult)
+		return FIT_ERROR;
+	memset(pResult, 0, sizeof(*pResult));
+	pResult->i8Status = FIT_ERROR;
+	if (u8Model >= FIT_MODEL_COUNT)
+		return FIT_ERROR;
+	u8Num = gtModels[u8Model].u8NumParams;
+	pResult->u8Model = u8Model;
+	pResult->u8NumParams = u8Num;
+	pResult->u8Iter = 0;
+	if (u16Count < u8Num)
+		return FIT_ERROR;
+
+	/* Log parameters */
+	InitialGuess(tPoints, u16Count, u8Model, tfX);
+	for (ii = 0; ii < u8Num; ii++)
+		tfX[ii] = logf(tfX[ii]);
+	fCost = Cost(tPoints, u16Count, u8Model, tfX);
+
+	pResult->i8Status = FIT_NOT_CONVERGED;
+	for (iIter = 0; iIter < FIT_MAX_ITER; iIter++)
+	{
+		float tfJtJ[FIT_MAX_PARAMS][FIT_MAX_PARAMS] = {{0}};
+		float tfJtr[FIT_MAX_PARAMS] = {0};
+		float tfP[FIT_MAX_PARAMS];
+		int iAccepted = 0;
+
+		for (ii = 0; ii < u8Num; ii++)
+			tfP[ii] = expf(tfX[ii]);
+
+		/* Normal equations. J rows are the real and imaginary parts of the
+		 * weighted model derivatives: J'J(i,j) = Re(di.conj(dj)) */
+		for (kk = 0; kk < u16Count; kk++)
+		{
+			complex float tdZ[FIT_MAX_PARAMS];
+			complex float zMeas = tPoints[kk].z;
+			float fWgt = 1.0f/fmaxf(CAbsf(zMeas), MIN_Z);
+			complex float r;
+
+			r = (Eval(u8Model, tfP, 2.0f*(float)M_PI*tPoints[kk].fFreq, tdZ) - zMeas)*fWgt;
+			for (ii = 0; ii < u8Num; ii++)
+			{
+				tdZ[ii] *= fWgt;
+				tfJtr[ii] += __real__ tdZ[ii]*__real__ r + __imag__ tdZ[ii]*__imag__ r;
+				for (jj = 0; jj <= ii; jj++)
+					tfJtJ[ii][jj] += __real__ tdZ[ii]*__real__ tdZ[jj] + __imag__ tdZ[ii]*__imag__ tdZ[jj];
+			}
+		}
+		for (ii = 0; ii < u8Num; ii++)
+			for (jj = ii+1; jj < u8Num; jj++)
+				tfJtJ[ii][jj] = tfJtJ[jj][ii];
+
+		/* Damping loop */
+		while (fLambda < LM_LAMBDA_MAX)
+		{
+			float tfA[FIT_MAX_PARAMS][FIT_MAX_PARAMS];
+			float tfDelta[FIT_MAX_PARAMS];
+
+			for (ii = 0; ii < u8Num; ii++)
+			{
+				for (jj = 0; jj < u8Num; jj++)
+					tfA[ii][jj] = tfJtJ[ii][jj];
+				tfA[ii][ii] += fLambda*tfJtJ[ii][ii] + 1e-12f;
+				tfDelta[ii] = -tfJtr[ii];
+			}
+			if (Solve(tfA, tfDelta, u8Num) == 0)
+			{
+				for (ii = 0; ii < u8Num; ii++)
+					tfXNew[ii] = tfX[ii] + tfDelta[ii];
+				fCostNew = Cost(tPoints, u16Count, u8Model, tfXNew);
+				if (fCostNew < fCost)
+				{
+					iAccepted = 1;
+					fLambda *= 0.1f;
+					break;
+				}
+			}
+			fLambda *= 10.0f;
+		}
+		pResult->u8Iter = (uint8_t)(iIter+1);
+		if (!iAccepted)
+		{
+			/* No descent direction left: at the minimum */
+			pResult->i8Status = FIT_OK;
+			break;
+		}
+		for (ii = 0; ii < u8Num; ii++)
+			tfX[ii] = tfXNew[ii];
+		if ((fCost - fCostNew) < (LM_TOLERANCE*fCost))
+		{
+			fCost = fCostNew;
+			pResult->i8Status = FIT_OK;
+			break;
+		}
+		fCost = fCostNew;
+	}
+
+	for (ii = 0; ii < FIT_MAX_PARAMS; ii++)
+		pResult->tfParam[ii] = (ii < u8Num) ? expf(tfX[ii]) : 0;
+	pResult->fRmsError = sqrtf(fCost/(float)u16Count);
+
+	return pResult->i8Status;
+}
+
+/**
+  * @brief Evaluates a fitted model
+  *
+  * @param pResult	Fitted model
+  * @param fFreq	Frequency (Hz)
+  * @retval Model impedance
+  */
+complex float Fit_Eval (const TFIT_RESULT *pResult, float fFreq)
+{
+	complex float tdZ[FIT_MAX_PARAMS];
+
+	return Eval(pResult->u8Model, pResult->tfParam, 2.0f*(float)M_PI*fFreq, tdZ);
+}
+
+/**
+  * @brief Returns the model name
+  *
+  * @param u8Model	FIT_xxx model
+  * @retval name
+  */
+const char *Fit_GetModelName (uint8_t u8Model)
+{
+	if (u8Model >= FIT_MODEL_COUNT)
+		return "?";
+	return gtModels[u8Model].pszName;
+}
+
+/**
+  * @brief Formats a fit result as text
+  *
+  * @param pszText	Output buffer (120 chars)
+  * @param pResult	Fitted model
+  * @retval Number of chars written
+  */
+int Fit_Format (char *pszText, const TFIT_RESULT *pResult)
+{
+	const TFIT_MODEL *pModel = &gtModels[pResult->u8Model];
+	int iLen;
+	int ii;
+
+	iLen = sprintf(pszText, "%s", pModel->pszName);
+	if (pResult->i8Status == FIT_ERROR)
+		return iLen + sprintf(&pszText[iLen], ", St:%d\n\r", pResult->i8Status);
+	for (ii = 0; ii < pResult->u8NumParams; ii++)
+		iLen += sprintf(&pszText[iLen], ", %s:%.4e", pModel->tpszParam[ii], pResult->tfParam[ii]);
+	iLen += sprintf(&pszText[iLen], ", Err:%.2e, It:%u, St:%d\n\r", pResult->fRmsError,
+			pResult->u8Iter, pResult->i8Status);
+	return iLen;
+}
+
+/**
+  * @brief Model impedance and its derivatives versus the log parameters
+  * (dZ/dln(p) = p.dZ/dp)
+  *
+  * @param u8Model	FIT_xxx model
+  * @param tfP		Parameters
+  * @param fW		Angular frequency
+  * @param tdZ		Returns the derivatives
+  * @retval Impedance
+  */
+static complex float Eval (uint8_t u8Model, const float tfP[], float fW, complex float tdZ[])
+{
+	complex float z, zm, y;
+
+	switch (u8Model)
+	{
+	case FIT_SERIES_RLC:
+		/* Z = R + jwL - j/wC */
+		tdZ[0] = tfP[0];
+		tdZ[1] = I*fW*tfP[1];
+		tdZ[2] = I/(fW*tfP[2]);
+		z = tdZ[0] + tdZ[1] - tdZ[2];
+		break;
+
+	case FIT_CAPACITOR:
+		/* Z = ESR + jwESL - j/wC */
+		tdZ[0] = I/(fW*tfP[0]);
+		tdZ[1] = tfP[1];
+		tdZ[2] = I*fW*tfP[2];
+		z = tdZ[1] + tdZ[2] - tdZ[0];
+		break;
+
+	case FIT_PARALLEL_RLC:
+		/* Y = 1/R - j/wL + jwC, dZ = -Z^2.dY */
+		y = 1.0f/tfP[0] - I/(fW*tfP[1]) + I*fW*tfP[2];
+		z = 1.0f/y;
+		tdZ[0] = z*z/tfP[0];
+		tdZ[1] = -z*z*I/(fW*tfP[1]);
+		tdZ[2] = -z*z*I*fW*tfP[2];
+		break;
+
+	case FIT_CRYSTAL_BVD:
+	default:
+		/* Y = 1/Zm + jwC0, dZ/dZm = (Z/Zm)^2 */
+		zm = tfP[0] + I*fW*tfP[1] - I/(fW*tfP[2]);
+		y = 1.0f/zm + I*fW*tfP[3];
+		z = 1.0f/y;
+		tdZ[0] = (z/zm)*(z/zm);
+		tdZ[1] = tdZ[0]*I*fW*tfP[1];
+		tdZ[2] = tdZ[0]*I/(fW*tfP[2]);
+		tdZ[0] *= tfP[0];
+		tdZ[3] = -z*z*I*fW*tfP[3];
+		break;
+	}
+	return z;
+}
+
+/**
+  * @brief Sum of squared relative residuals
+  *
+  * @param tPoints	Sweep points
+  * @param u16Count	Number of points
+  * @param u8Model	FIT_xxx model
+  * @param tfX		Log parameters
+  * @retval cost
+  */
+static float Cost (const TSWEEP_POINT tPoints[], uint16_t u16Count, uint8_t u8Model, const float tfX[])
+{
+	complex float tdZ[FIT_MAX_PARAMS];
+	float tfP[FIT_MAX_PARAMS];
+	float fCost = 0;
+	uint16_t kk;
+	int ii;
+
+	for (ii = 0; ii < gtModels[u8Model].u8NumParams; ii++)
+		tfP[ii] = expf(tfX[ii]);
+	for (kk = 0; kk < u16Count; kk++)
+	{
+		complex float zMeas = tPoints[kk].z;
+		complex float r = Eval(u8Model, tfP, 2.0f*(float)M_PI*tPoints[kk].fFreq, tdZ) - zMeas;
+		float fMag = fmaxf(CAbsf(zMeas), MIN_Z);
+
+		fCost += (__real__ r*__real__ r + __imag__ r*__imag__ r)/(fMag*fMag);
+	}
+	return fCost;
+}
+
+/**
+  * @brief Initial parameters from the sweep extremes: |Z| minimum (series
+  * resonance), |Z| maximum (parallel resonance) and reactance at the lowest
+  * and highest frequencies.
+  *
+  * @param tPoints	Sweep points
+  * @param u16Count	Number of points
+  * @param u8Model	FIT_xxx model
+  * @param tfP		Returns the parameters
+  * @retval None
+  */
+static void InitialGuess (const TSWEEP_POINT tPoints[], uint16_t u16Count, uint8_t u8Model, float tfP[])
+{
+	uint16_t u16Min = 0, u16Max = 0, u16Lo = 0, u16Hi = 0;
+	float fWLo, fWHi, fXLo, fXHi;
+	float fR, fL, fC, fC0;
+	complex float yLo, yHi, yMax;
+	uint16_t kk;
+
+	for (kk = 1; kk < u16Count; kk++)
+	{
+		if (CAbsf(tPoints[kk].z) < CAbsf(tPoints[u16Min].z))
+			u16Min = kk;
+		if (CAbsf(tPoints[kk].z) > CAbsf(tPoints[u16Max].z))
+			u16Max = kk;
+		if (tPoints[kk].fFreq < tPoints[u16Lo].fFreq)
+			u16Lo = kk;
+		if (tPoints[kk].fFreq > tPoints[u16Hi].fFreq)
+			u16Hi = kk;
+	}
+	fWLo = 2.0f*(float)M_PI*tPoints[u16Lo].fFreq;
+	fWHi = 2.0f*(float)M_PI*tPoints[u16Hi].fFreq;
+	fXLo = __imag__ tPoints[u16Lo].z;
+	fXHi = __imag__ tPoints[u16Hi].z;
+
+	switch (u8Model)
+	{
+	case FIT_PARALLEL_RLC:
+		yLo = 1.0f/tPoints[u16Lo].z;
+		yHi = 1.0f/tPoints[u16Hi].z;
+		yMax = 1.0f/tPoints[u16Max].z;
+		fR = (__real__ yMax > 1e-9f) ? 1.0f/__real__ yMax : 1e6f;
+		fC = (__imag__ yHi > 0) ? __imag__ yHi/fWHi : 1e-15f;
+		fL = (__imag__ yLo < 0) ? -1.0f/(fWLo*__imag__ yLo) : 1e3f;
+		tfP[0] = fR;
+		tfP[1] = fL;
+		tfP[2] = fC;
+		break;
+
+	case FIT_CRYSTAL_BVD:
+	{
+		float fWs = 2.0f*(float)M_PI*tPoints[u16Min].fFreq;
+		float fRatio = tPoints[u16Max].fFreq/tPoints[u16Min].fFreq;
+
+		fC0 = (fXHi < 0) ? -1.0f/(fWHi*fXHi) : 1e-12f;
+		fC = (fRatio > 1.0f) ? fC0*(fRatio*fRatio - 1.0f) : fC0*1e-3f;
+		tfP[0] = fmaxf(__real__ tPoints[u16Min].z, 1e-3f);
+		tfP[1] = 1.0f/(fWs*fWs*fC);
+		tfP[2] = fC;
+		tfP[3] = fC0;
+		break;
+	}
+
+	case FIT_SERIES_RLC:
+	case FIT_CAPACITOR:
+	default:
+		fR = fmaxf(__real__ tPoints[u16Min].z, 1e-3f);
+		fC = (fXLo < 0) ? -1.0f/(fWLo*fXLo) : 1.0f;
+		fL = (fXHi > 0) ? fXHi/fWHi : 1e-12f;
+		if (u8Model == FIT_CAPACITOR)
+		{
+			tfP[0] = fC;
+			tfP[1] = fR;
+			tfP[2] = fL;
+		}
+		else
+		{
+			tfP[0] = fR;
+			tfP[1] = fL;
+			tfP[2] = fC;
+		}
+		break;
+	}
+}
+
+/**
+  * @brief Solves A.x = b by Gaussian elimination with partial pivoting
+  *
+  * @param tfA	Matrix, destroyed
+  * @param tfB	Right side, returns the solution
+  * @param n	Size
+  * @retval 0 if OK, -1 if singular
+  */
+static int Solve (float tfA[FIT_MAX_PARAMS][FIT_MAX_PARAMS], float tfB[], int n)
+{
+	int ii, jj, kk;
+
+	for (kk = 0; kk < n; kk++)
+	{
+		int iPivot = kk;
+		float fTmp;
+
+		for (ii = kk+1; ii < n; ii++)
+			if (fabsf(tfA[ii][kk]) > fabsf(tfA[iPivot][kk]))
+				iPivot = ii;
+		if (fabsf(tfA[iPivot][kk]) < 1e-30f)
+			return -1;
+		if (iPivot != kk)
+		{
+			for (jj = 0; jj < n; jj++)
+			{
+				fTmp = tfA[kk][jj];
+				tfA[kk][jj] = tfA[iPivot][jj];
+				tfA[iPivot][jj] = fTmp;
+			}
+			fTmp = tfB[kk];
+			tfB[kk] = tfB[iPivot];
+			tfB[iPivot] = fTmp;
+		}
+		for (ii = kk+1; ii < n; ii++)
+		{
+			float fF = tfA[ii][kk]/tfA[kk][kk];
+
+			for (jj = kk; jj < n; jj++)
+				tfA[ii][jj] -= fF*tfA[kk][jj];
+			tfB[ii] -= fF*tfB[kk];
+		}
+	}
+	for (ii = n-1; ii >= 0; ii--)
+	{
+		for (jj = ii+1; jj < n; jj++)
+			tfB[ii] -= tfA[ii][jj]*tfB[jj];
+		tfB[ii] /= tfA[ii][ii];
+	}
+	return 0;
+}
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
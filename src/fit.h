@@ -0,0 +1,59 @@
+/**
+  ******************************************************************************
+  * @file    fit.h
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Equivalent circuit fitting over sweep data
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __FIT_H__
+#define __FIT_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f4xx.h"
+#include "complex.h"
+#include "measure.h"
+
+/* Exported constants --------------------------------------------------------*/
+/* Models */
+#define FIT_SERIES_RLC			0	/* R + jwL + 1/jwC: R, L, C */
+#define FIT_PARALLEL_RLC		1	/* R || L || C: R, L, C */
+#define FIT_CRYSTAL_BVD			2	/* (Rm + Lm + Cm) || C0: Rm, Lm, Cm, C0 */
+#define FIT_CAPACITOR			3	/* C + ESR + ESL in series: C, ESR, ESL */
+#define FIT_MODEL_COUNT			4
+
+#define FIT_MAX_PARAMS			4
+#define FIT_MAX_ITER			50
+
+/* Fit status */
+#define FIT_OK					0
+#define FIT_NOT_CONVERGED		1
+#define FIT_ERROR				-1
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+	uint8_t u8Model;
+	uint8_t u8NumParams;
+	int8_t i8Status;						/* FIT_xxx */
+	uint8_t u8Iter;							/* Iterations used */
+	float tfParam[FIT_MAX_PARAMS];			/* Ohm, H, F */
+	float fRmsError;						/* RMS relative error of Z */
+} TFIT_RESULT;
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+extern int Fit_Run (const TSWEEP_POINT tPoints[], uint16_t u16Count, uint8_t u8Model, TFIT_RESULT *pResult);
+extern complex float Fit_Eval (const TFIT_RESULT *pResult, float fFreq);
+extern const char *Fit_GetModelName (uint8_t u8Model);
+extern int Fit_Format (char *pszText, const TFIT_RESULT *pResult);
+
+#endif	 /* __FIT_H__ */
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
@@ -17,52 +17,188 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include <math.h>
+#include <stdlib.h>
 #include "stm32f4xx.h"
 #include "stm32f4_discovery.h"
+#include "sample.h"
+#include "windowing_fn.h"
 #include "goertzel.h"
 
 /* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+	double fCoeff;
+	double fSine;
+	double fCosine;
+	double fBin;				/* Folded bin, fractional in generalized mode */
+	double fCorrCos;			/* Generalized mode phase correction */
+	double fCorrSin;
+	complex double cMidScale;	/* DTFT of the mid scale offset at the bin */
+	uint8_t u8Inverted;			/* Alias in an even Nyquist zone: spectrum inverted */
+	uint8_t u8Order;			/* Harmonic order, 1 for the fundamental */
+} TRESONATOR;
+
 /* Private define ------------------------------------------------------------*/
+#define NOISE_GUARD_BINS	2		/* Excluded bins around the signal (window main lobe) */
+#define NOISE_HARMONICS		5		/* Excluded harmonics (aliased) in noise estimation */
+#define FREQ_EST_MIN_BINS	2.0		/* Cycles per half block for the frequency estimate */
+
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
-static double gfCoeff;
 static double gfQ1;
 static double gfQ2;
-static double gfSine;
-static double gfCosine;
 static uint16_t gu16BlockSize;
+static uint8_t gu8Generalized = 0;
+static uint32_t gu32Cycles;			/* Signal cycles per block before folding */
+static TRESONATOR gtRes[1+GOERTZEL_MAX_HARMONICS];	/* Fundamental, then the usable harmonics */
+static uint8_t gu8Resonators = 1;
+static uint8_t gu8Harmonics = 0;		/* Harmonics requested above the fundamental */
+static complex double gtHarm[GOERTZEL_MAX_HARMONICS];	/* Last Goertzel_CalcHarmonics vectors */
 
 /* Private function prototypes -----------------------------------------------*/
+static void Resonator (TRESONATOR *pRes, double fN, double fFreq, double fSampleRate);
+static complex double Output (const TRESONATOR *pRes, double fQ1, double fQ2);
+static double BinPower (uint16_t txSampleData[], uint16_t u16Bin);
+static int IsSignalBin (uint16_t u16Bin);
+static double Alias (double fFreq, double fSampleRate, uint8_t *pu8Inverted);
 
 /* Private functions ---------------------------------------------------------*/
 
 /**
-  * @brief Initializes Goertzel algorithm coefficients
+  * @brief Initializes Goertzel algorithm coefficients.
+  * The bin is rounded to the nearest integer, unless generalized mode is
+  * enabled: then the fractional bin is kept so the detector sits exactly
+  * on the excitation frequency (no scalloping loss).
+  * Frequencies above the Nyquist frequency (undersampling) are detected
+  * at their alias; in the even Nyquist zones the alias is the mirror
+  * image, so the output is conjugated to keep the phase of the signal.
   *
-  * @param  None
+  * @param  u16BlockSize: samples per block
+  * @param  fFreq: frequency to detect (Hz)
+  * @param  fSampleRate: sampling rate (sps)
   * @retval None
   */
-void Goertzel_Init (uint16_t u16BlockSize, uint32_t u32Freq, uint32_t u32SampleRate)
+void Goertzel_Init (uint16_t u16BlockSize, double fFreq, double fSampleRate)
 {
-	int	iK;
-	double fN;
-	double fOmega;
+	double fN, fGuard;
+	uint8_t u8Order;
 
   	gu16BlockSize = u16BlockSize;
   	fN = (double) u16BlockSize;
-  	iK = (int) (0.5 + ((fN * (double)u32Freq) / (double)u32SampleRate));
-  	fOmega = (double)((2.0 * M_PI * iK) / fN);
-  	gfSine = (double)sin(fOmega);
-  	gfCosine = (double)cos(fOmega);
-  	gfCoeff = (double)(2.0 * gfCosine);
+  	gu32Cycles = (uint32_t)(0.5 + (fN * fFreq) / fSampleRate);
+  	gtRes[0].u8Order = 1;
+  	Resonator(&gtRes[0], fN, fFreq, fSampleRate);
+
+  	/* Harmonics folding onto DC or into the fundamental main lobe (of the
+  	 * window in use) are not measurable: they are left out of the pass */
+  	fGuard = Windowing_GetMainLobe();
+  	gu8Resonators = 1;
+  	for (u8Order = 2; u8Order <= gu8Harmonics+1; u8Order++)
+  	{
+  		TRESONATOR *pRes = &gtRes[gu8Resonators];
+
+  		pRes->u8Order = u8Order;
+  		Resonator(pRes, fN, u8Order*fFreq, fSampleRate);
+  		if ((pRes->fBin >= fGuard) && (fabs(pRes->fBin - gtRes[0].fBin) >= fGuard))
+  			gu8Resonators++;
+  	}
 
   	gfQ2 = 0;
   	gfQ1 = 0;
 }
 
+/**
+  * @brief Sets the harmonics detected along with the fundamental, in the
+  * same pass over the block (Goertzel_CalcHarmonics). Each one costs a
+  * resonator update per sample. Takes effect at the next Goertzel_Init,
+  * as does a window change (main lobe guard).
+  *
+  * @param  u8Count: harmonics above the fundamental (order 2 to u8Count+1),
+  *         0 to disable, up to GOERTZEL_MAX_HARMONICS
+  * @retval None
+  */
+void Goertzel_SetHarmonics (uint8_t u8Count)
+{
+	if (u8Count > GOERTZEL_MAX_HARMONICS)
+		u8Count = GOERTZEL_MAX_HARMONICS;
+	gu8Harmonics = u8Count;
+}
+
+/**
+  * @brief Returns the harmonics requested
+  *
+  * @param  None
+  * @retval Harmonics above the fundamental, 0 if disabled
+  */
+uint8_t Goertzel_GetHarmonicCount (void)
+{
+	return gu8Harmonics;
+}
+
+/**
+  * @brief Returns the harmonic vectors of the last Goertzel_CalcHarmonics, same
+  * convention as the fundamental. Harmonics that fold onto DC or next to
+  * the fundamental are not measured: their vector is 0 and their bit is
+  * clear in the returned mask.
+  *
+  * @param  tVect: returns the vectors, index 0 is the 2nd harmonic
+  * @retval Mask of the measured harmonics, bit 0 is the 2nd harmonic
+  */
+uint8_t Goertzel_GetHarmonics (complex double tVect[])
+{
+	uint8_t u8Mask = 0;
+	uint8_t u8Res;
+	uint8_t ii;
+
+	for (ii = 0; ii < gu8Harmonics; ii++)
+		tVect[ii] = 0;
+	for (u8Res = 1; u8Res < gu8Resonators; u8Res++)
+	{
+		ii = gtRes[u8Res].u8Order - 2;
+		tVect[ii] = gtHarm[u8Res-1];
+		u8Mask |= 1 << ii;
+	}
+	return u8Mask;
+}
+
+/**
+  * @brief Enables the generalized (non integer bin) mode. Takes effect at
+  * the next Goertzel_Init.
+  *
+  * @param  u8Enable: 1 to enable
+  * @retval None
+  */
+void Goertzel_SetGeneralized (uint8_t u8Enable)
+{
+	gu8Generalized = u8Enable;
+}
+
+/**
+  * @brief Returns the generalized mode state
+  *
+  * @param  None
+  * @retval 1 if enabled
+  */
+uint8_t Goertzel_GetGeneralized (void)
+{
+	return gu8Generalized;
+}
+
+/**
+  * @brief Returns the detected bin: fractional in generalized mode
+  *
+  * @param  None
+  * @retval Bin
+  */
+double Goertzel_GetBin (void)
+{
+	return gtRes[0].fBin;
+}
+
 /**
   * @brief Performs the Goertzel algorithm on sampled data.
-  * Returns magnitude and phase.
+  * Returns magnitude and phase. Fundamental only: the harmonics, if
+  * enabled, are left to Goertzel_CalcHarmonics.
   *
   * @param  txSampleData: data samples
   * @param  pvect: returns the complex vector
@@ -70,28 +206,436 @@ void Goertzel_Init (uint16_t u16BlockSize, uint32_t u32Freq, uint32_t u32SampleR
   */
 void Goertzel_Calc (uint16_t txSampleData[], complex double *pvect)
 {
+	double fCoeff = gtRes[0].fCoeff;
 	complex double vect;
   	uint16_t u16Idx;
 
   	gfQ2 = 0;
   	gfQ1 = 0;
 
-	/* Process the samples */
+  	/* Process the samples */
 	for (u16Idx = 0; u16Idx < gu16BlockSize; u16Idx++)
 	{
 		double Q0;
-		Q0 = gfCoeff * gfQ1 - gfQ2 + (double) txSampleData[u16Idx];
+		Q0 = fCoeff * gfQ1 - gfQ2 + (double) txSampleData[u16Idx];
 		gfQ2 = gfQ1;
 		gfQ1 = Q0;
 	}
-	/* Do the "basic Goertzel" processing. */
-  	__real__ vect = (gfQ1 - gfQ2 * gfCosine);
-  	__imag__ vect = (gfQ2 * gfSine);
+	vect = Output(&gtRes[0], gfQ1, gfQ2);
 
   	if (pvect)
   		*pvect = vect;
 }
 
+/**
+  * @brief Same as Goertzel_Calc, with the resonators of the harmonics
+  * (Goertzel_SetHarmonics) run in the same loop, read back with
+  * Goertzel_GetHarmonics. Same cost as Goertzel_Calc when none is
+  * measurable.
+  *
+  * @param  txSampleData: data samples
+  * @param  pvect: returns the fundamental vector
+  * @retval None
+  */
+void Goertzel_CalcHarmonics (uint16_t txSampleData[], complex double *pvect)
+{
+	double tfQ1[GOERTZEL_MAX_HARMONICS];
+	double tfQ2[GOERTZEL_MAX_HARMONICS];
+	double tfCoeff[GOERTZEL_MAX_HARMONICS];
+	double fCoeff = gtRes[0].fCoeff;
+	uint8_t u8Count = gu8Resonators - 1;
+	uint8_t u8Res;
+	uint16_t u16Idx;
+
+	if (u8Count == 0)
+	{
+		Goertzel_Calc(txSampleData, pvect);
+		return;
+	}
+
+	for (u8Res = 0; u8Res < u8Count; u8Res++)
+	{
+		tfCoeff[u8Res] = gtRes[u8Res+1].fCoeff;
+		tfQ1[u8Res] = 0;
+		tfQ2[u8Res] = 0;
+	}
+	gfQ2 = 0;
+	gfQ1 = 0;
+
+	/* Fundamental and harmonics, one sample read for all */
+	for (u16Idx = 0; u16Idx < gu16BlockSize; u16Idx++)
+	{
+		double fX = (double) txSampleData[u16Idx];
+		double Q0;
+
+		Q0 = fCoeff * gfQ1 - gfQ2 + fX;
+		gfQ2 = gfQ1;
+		gfQ1 = Q0;
+		for (u8Res = 0; u8Res < u8Count; u8Res++)
+		{
+			Q0 = tfCoeff[u8Res] * tfQ1[u8Res] - tfQ2[u8Res] + fX;
+			tfQ2[u8Res] = tfQ1[u8Res];
+			tfQ1[u8Res] = Q0;
+		}
+	}
+
+	for (u8Res = 0; u8Res < u8Count; u8Res++)
+		gtHarm[u8Res] = Output(&gtRes[u8Res+1], tfQ1[u8Res], tfQ2[u8Res]);
+	if (pvect)
+		*pvect = Output(&gtRes[0], gfQ1, gfQ2);
+}
+
+/**
+  * @brief Goertzel on several integer bins in a single pass over the block.
+  * All resonators are updated per sample, so the block is read once.
+  * Output uses the same convention as Goertzel_Calc.
+  *
+  * @param  txSampleData: data samples
+  * @param  tu16Bins: bin indexes
+  * @param  u8Count: number of bins, up to GOERTZEL_MAX_BINS
+  * @param  tVect: returns the complex vectors
+  * @retval None
+  */
+void Goertzel_CalcMulti (uint16_t txSampleData[], const uint16_t tu16Bins[], uint8_t u8Count, complex double tVect[])
+{
+	double tfCoeff[GOERTZEL_MAX_BINS];
+	double tfQ1[GOERTZEL_MAX_BINS];
+	double tfQ2[GOERTZEL_MAX_BINS];
+	uint16_t u16Idx;
+	uint8_t u8Bin;
+
+	if (u8Count > GOERTZEL_MAX_BINS)
+		u8Count = GOERTZEL_MAX_BINS;
+
+	for (u8Bin = 0; u8Bin < u8Count; u8Bin++)
+	{
+		tfCoeff[u8Bin] = 2.0 * cos((2.0 * M_PI * tu16Bins[u8Bin]) / (double)gu16BlockSize);
+		tfQ1[u8Bin] = 0;
+		tfQ2[u8Bin] = 0;
+	}
+
+	for (u16Idx = 0; u16Idx < gu16BlockSize; u16Idx++)
+	{
+		double fX = (double) txSampleData[u16Idx];
+
+		for (u8Bin = 0; u8Bin < u8Count; u8Bin++)
+		{
+			double Q0;
+			Q0 = tfCoeff[u8Bin] * tfQ1[u8Bin] - tfQ2[u8Bin] + fX;
+			tfQ2[u8Bin] = tfQ1[u8Bin];
+			tfQ1[u8Bin] = Q0;
+		}
+	}
+
+	for (u8Bin = 0; u8Bin < u8Count; u8Bin++)
+	{
+		double fOmega = (2.0 * M_PI * tu16Bins[u8Bin]) / (double)gu16BlockSize;
+
+		__real__ tVect[u8Bin] = (tfQ1[u8Bin] - tfQ2[u8Bin] * cos(fOmega));
+		__imag__ tVect[u8Bin] = (tfQ2[u8Bin] * sin(fOmega));
+	}
+}
+
+/**
+  * @brief Fundamental of both channels straight from a block of dual ADC
+  * words: oversampling sum, deinterleave, window and Goertzel in one
+  * pass, without the uint16 channel blocks. Same result as Sample_Take,
+  * Windowing_Calc and Goertzel_Calc on each channel, less the rounding
+  * of the windowed samples.
+  *
+  * @param  tu32Words: dual ADC words of the block (channel 1 in the low half word)
+  * @param  tfWindow: window table (Windowing_GetTable), NULL for none
+  * @param  pvr: returns the channel 1 vector
+  * @param  pvm: returns the channel 2 vector
+  * @retval None
+  */
+void Goertzel_CalcDual (const uint32_t tu32Words[], const float tfWindow[], complex double *pvr,
+		complex double *pvm)
+{
+	double fCoeff = gtRes[0].fCoeff;
+	double fQ1r = 0, fQ2r = 0;
+	double fQ1m = 0, fQ2m = 0;
+	uint8_t u8Os = Sample_GetOversampling();
+	float fMid = (float)(SAMPLE_MID_SCALE << u8Os);
+	uint16_t u16Idx;
+
+	for (u16Idx = 0; u16Idx < gu16BlockSize; u16Idx++)
+	{
+		uint32_t u32Sum = 0;
+		float fR, fM;
+		double Q0;
+		int jj;
+
+		/* 2^4 x 4095 cannot carry into the upper half word */
+		for (jj = (1 << u8Os); jj > 0; jj--)
+			u32Sum += *tu32Words++;
+		fR = (float)(u32Sum & 0xFFFF);
+		fM = (float)(u32Sum >> 16);
+		if (tfWindow)
+		{
+			fR = tfWindow[u16Idx]*(fR - fMid) + fMid;
+			fM = tfWindow[u16Idx]*(fM - fMid) + fMid;
+		}
+
+		Q0 = fCoeff * fQ1r - fQ2r + (double)fR;
+		fQ2r = fQ1r;
+		fQ1r = Q0;
+		Q0 = fCoeff * fQ1m - fQ2m + (double)fM;
+		fQ2m = fQ1m;
+		fQ1m = Q0;
+	}
+
+	if (pvr)
+		*pvr = Output(&gtRes[0], fQ1r, fQ2r);
+	if (pvm)
+		*pvm = Output(&gtRes[0], fQ1m, fQ2m);
+}
+
+/**
+  * @brief Estimates the offset of the true signal frequency from fFreq on
+  * raw (not windowed) samples: DTFT at fFreq of both block halves, each
+  * with its own Hann window, so the window phase cancels and the phase
+  * advance between halves is (w'-w).N/2. Unambiguous within one bin of the
+  * half block. Costs about one Goertzel pass. Undersampled frequencies
+  * are estimated at their alias.
+  *
+  * @param  txSampleData: raw data samples (block size of Goertzel_Init)
+  * @param  fFreq: expected frequency (Hz)
+  * @param  fSampleRate: sampling rate (sps)
+  * @param  pfOffset: returns the frequency offset (Hz)
+  * @retval 0 if OK, -1 if too few cycles per half block
+  */
+int Goertzel_FreqOffset (uint16_t txSampleData[], double fFreq, double fSampleRate, double *pfOffset)
+{
+	uint16_t u16Half = gu16BlockSize/2;
+	uint8_t u8Inverted;
+	double fAlias = Alias(fFreq, fSampleRate, &u8Inverted);
+	double fOmega = (2.0 * M_PI * fAlias) / fSampleRate;
+	double fMean = 0;
+	complex double tX[2] = {0, 0};
+	complex double cStep, cWinStep;
+	complex double cRot, cWin;
+	complex double cRatio;
+	uint16_t u16Idx;
+	int iHalf;
+
+	if ((u16Half == 0) || (((fAlias * u16Half) / fSampleRate) < FREQ_EST_MIN_BINS))
+		return -1;
+
+	for (u16Idx = 0; u16Idx < 2*u16Half; u16Idx++)
+		fMean += (double) txSampleData[u16Idx];
+	fMean /= (double)(2*u16Half);
+
+	__real__ cStep = cos(fOmega);
+	__imag__ cStep = -sin(fOmega);
+	__real__ cWinStep = cos((2.0 * M_PI) / u16Half);
+	__imag__ cWinStep = sin((2.0 * M_PI) / u16Half);
+
+	for (iHalf = 0; iHalf < 2; iHalf++)
+	{
+		uint16_t u16Start = iHalf*u16Half;
+
+		__real__ cRot = cos(fOmega * u16Start);
+		__imag__ cRot = -sin(fOmega * u16Start);
+		cWin = 1.0;
+		for (u16Idx = 0; u16Idx < u16Half; u16Idx++)
+		{
+			double fW = 0.5 - 0.5 * __real__ cWin;
+
+			tX[iHalf] += (fW * ((double) txSampleData[u16Start+u16Idx] - fMean)) * cRot;
+			cRot *= cStep;
+			cWin *= cWinStep;
+		}
+	}
+	if ((tX[0] == 0) || (tX[1] == 0))
+		return -1;
+
+	cRatio = tX[1] / tX[0];
+	*pfOffset = (atan2(__imag__ cRatio, __real__ cRatio) * fSampleRate) / (2.0 * M_PI * u16Half);
+	if (u8Inverted)
+		*pfOffset = -*pfOffset;
+	return 0;
+}
+
+/**
+  * @brief Estimates the noise floor of a sampled block as the mean power of
+  * the off-signal bins. Bins in the window main lobe around the signal bin
+  * and around the (aliased) harmonics are excluded, as well as DC.
+  * Result is in the same units as |vect|^2 from Goertzel_Calc, so the ratio
+  * gives the per bin SNR.
+  * Diagnostic use only: costs N/2 Goertzel passes.
+  *
+  * @param  txSampleData: data samples (windowed)
+  * @retval mean off-bin power
+  */
+double Goertzel_NoiseFloor (uint16_t txSampleData[])
+{
+	uint16_t u16Bin;
+	uint16_t u16Count = 0;
+	double fSum = 0;
+
+	for (u16Bin = 2; u16Bin < gu16BlockSize/2; u16Bin++)
+	{
+		if (IsSignalBin(u16Bin))
+			continue;
+		fSum += BinPower(txSampleData, u16Bin);
+		u16Count++;
+	}
+	if (u16Count == 0)
+		return 0;
+	return fSum / (double)u16Count;
+}
+
+/**
+  * @brief Resonator coefficients for a frequency.
+  * The bin is rounded to the nearest integer, unless generalized mode is
+  * enabled: then the fractional bin is kept.
+  *
+  * @param  pRes: returns the coefficients
+  * @param  fN: samples per block
+  * @param  fFreq: frequency to detect (Hz), any Nyquist zone
+  * @param  fSampleRate: sampling rate (sps)
+  * @retval None
+  */
+static void Resonator (TRESONATOR *pRes, double fN, double fFreq, double fSampleRate)
+{
+	int	iK;
+	double fOmega;
+
+  	fFreq = Alias(fFreq, fSampleRate, &pRes->u8Inverted);
+  	pRes->fBin = (fN * fFreq) / fSampleRate;
+  	iK = (int) (0.5 + pRes->fBin);
+  	if (iK < 1)
+  		iK = 1;
+  	if (!gu8Generalized || (pRes->fBin <= 0))
+  		pRes->fBin = (double)iK;
+  	fOmega = (double)((2.0 * M_PI * pRes->fBin) / fN);
+  	pRes->fSine = (double)sin(fOmega);
+  	pRes->fCosine = (double)cos(fOmega);
+  	pRes->fCoeff = (double)(2.0 * pRes->fCosine);
+
+  	/* Generalized mode: exp(-jw(N-1)) takes the resonator output to the
+  	 * DTFT at w, as the last cycle is not complete */
+  	pRes->fCorrCos = cos(fOmega * (fN - 1.0));
+  	pRes->fCorrSin = -sin(fOmega * (fN - 1.0));
+
+  	/* Off grid, the constant mid scale offset leaks into the bin:
+  	 * mid.(1-exp(-jwN))/(1-exp(-jw)), subtracted after the pass. The mid
+  	 * scale grows with the oversampling */
+  	pRes->cMidScale = 0;
+  	if (gu8Generalized && (fabs(pRes->fBin - iK) > 1e-9))
+  	{
+  		complex double cNum, cDen;
+
+  		__real__ cNum = 1.0 - cos(fOmega * fN);
+  		__imag__ cNum = sin(fOmega * fN);
+  		__real__ cDen = 1.0 - pRes->fCosine;
+  		__imag__ cDen = pRes->fSine;
+  		pRes->cMidScale = (double)(SAMPLE_MID_SCALE << Sample_GetOversampling()) * cNum / cDen;
+  	}
+}
+
+/**
+  * @brief Resonator state to the complex vector, once per block
+  *
+  * @param  pRes: resonator coefficients
+  * @param  fQ1: last state
+  * @param  fQ2: previous state
+  * @retval Complex vector
+  */
+static complex double Output (const TRESONATOR *pRes, double fQ1, double fQ2)
+{
+	complex double vect;
+
+	/* Do the "basic Goertzel" processing. */
+  	__real__ vect = (fQ1 - fQ2 * pRes->fCosine);
+  	__imag__ vect = (fQ2 * pRes->fSine);
+
+  	/* Generalized: final phase correction */
+  	if (gu8Generalized)
+  	{
+  		double fRe = __real__ vect;
+
+  		__real__ vect = fRe * pRes->fCorrCos - __imag__ vect * pRes->fCorrSin;
+  		__imag__ vect = fRe * pRes->fCorrSin + __imag__ vect * pRes->fCorrCos;
+  		vect -= pRes->cMidScale;
+  	}
+
+  	if (pRes->u8Inverted)
+  		__imag__ vect = -__imag__ vect;
+	return vect;
+}
+
+/**
+  * @brief Goertzel power at an arbitrary integer bin
+  *
+  * @param  txSampleData: data samples
+  * @param  u16Bin: bin index
+  * @retval power
+  */
+static double BinPower (uint16_t txSampleData[], uint16_t u16Bin)
+{
+	double fCoeff;
+	double fQ1 = 0;
+	double fQ2 = 0;
+	uint16_t u16Idx;
+
+	fCoeff = 2.0 * cos((2.0 * M_PI * u16Bin) / (double)gu16BlockSize);
+	for (u16Idx = 0; u16Idx < gu16BlockSize; u16Idx++)
+	{
+		double Q0;
+		Q0 = fCoeff * fQ1 - fQ2 + (double) txSampleData[u16Idx];
+		fQ2 = fQ1;
+		fQ1 = Q0;
+	}
+	return (fQ1 * fQ1) + (fQ2 * fQ2) - (fCoeff * fQ1 * fQ2);
+}
+
+/**
+  * @brief Checks if a bin holds signal energy: main lobe of the fundamental
+  * or of one of its harmonics, folded to the first Nyquist zone (from the
+  * signal frequency, so it also holds when undersampling).
+  *
+  * @param  u16Bin: bin index
+  * @retval 1 if excluded from noise estimation
+  */
+static int IsSignalBin (uint16_t u16Bin)
+{
+	int iH;
+
+	for (iH = 1; iH <= NOISE_HARMONICS; iH++)
+	{
+		int iAlias = (int)((iH * gu32Cycles) % gu16BlockSize);
+
+		if (iAlias > gu16BlockSize/2)
+			iAlias = gu16BlockSize - iAlias;
+		if (abs((int)u16Bin - iAlias) <= NOISE_GUARD_BINS)
+			return 1;
+	}
+	return 0;
+}
+
+/**
+  * @brief Folds a frequency to the first Nyquist zone
+  *
+  * @param  fFreq: frequency (Hz)
+  * @param  fSampleRate: sampling rate (sps)
+  * @param  pu8Inverted: returns 1 if the alias is a mirror image
+  * @retval Alias frequency (Hz)
+  */
+static double Alias (double fFreq, double fSampleRate, uint8_t *pu8Inverted)
+{
+	double fAlias = fmod(fFreq, fSampleRate);
+
+	*pu8Inverted = 0;
+	if (fAlias > (0.5 * fSampleRate))
+	{
+		fAlias = fSampleRate - fAlias;
+		*pu8Inverted = 1;
+	}
+	return fAlias;
+}
+
 /************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
 
 
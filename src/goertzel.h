@@ -26,10 +26,25 @@
 
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
+#define GOERTZEL_MAX_BINS	16		/* Multi-bin pass (multi-tone excitation) */
+#define GOERTZEL_MAX_HARMONICS	8	/* Harmonics detected with the fundamental: 2nd to 9th */
+
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions ------------------------------------------------------- */
-extern void Goertzel_Init (uint16_t u16BlockSize, uint32_t u32Freq, uint32_t u32SampleRate);
+extern void Goertzel_Init (uint16_t u16BlockSize, double fFreq, double fSampleRate);
+extern void Goertzel_SetGeneralized (uint8_t u8Enable);
+extern uint8_t Goertzel_GetGeneralized (void);
+extern double Goertzel_GetBin (void);
+extern int Goertzel_FreqOffset (uint16_t txSampleData[], double fFreq, double fSampleRate, double *pfOffset);
+extern void Goertzel_SetHarmonics (uint8_t u8Count);
+extern uint8_t Goertzel_GetHarmonicCount (void);
+extern uint8_t Goertzel_GetHarmonics (complex double tVect[]);
 extern void Goertzel_Calc (uint16_t txSampleData[], complex double *pvect);
+extern void Goertzel_CalcHarmonics (uint16_t txSampleData[], complex double *pvect);
+extern double Goertzel_NoiseFloor (uint16_t txSampleData[]);
+extern void Goertzel_CalcMulti (uint16_t txSampleData[], const uint16_t tu16Bins[], uint8_t u8Count, complex double tVect[]);
+extern void Goertzel_CalcDual (const uint32_t tu32Words[], const float tfWindow[], complex double *pvr,
+		complex double *pvm);
 
 #endif	/* __GOERTZEL_H__ */
 
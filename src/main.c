@@ -25,17 +25,27 @@
 #include "usbd_usr.h"
 #include "usbd_desc.h"
 #include "complex.h"
+#include "arena.h"
+#include "zparam.h"
+#include "measure.h"
+#include "fit.h"
+#include "search.h"
+#include "calib.h"
+#include "decimate.h"
+#include "scope.h"
+#include "fft.h"
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
-#define MAX_Z_MAG			999999.9
-#define NUM_AVG				8
-#define REFERENCE_R			4740.0		/* Adjust to the actual implemented value */
+#define BUTTON_DEBOUNCE_MS	20			/* Button debounce/release poll period */
 
-#define LIMIT_MAX_C			999999.99
-#define LIMIT_MAX_L			999999.99
-#define LIMIT_MIN_R			0.1
-#define LIMIT_MIN_X			1.0
+/* Button debounce states */
+#define BUTTON_ARMED		0			/* Waiting EXTI edge */
+#define BUTTON_PRESS		1			/* Edge seen, confirming press */
+#define BUTTON_RELEASE		2			/* Press reported, waiting release */
+
+#define CMD_LINE_SIZE		32			/* Host command line buffer */
+#define USB_SEND_TIMEOUT_MS	100			/* Give up if the host does not read */
 
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
@@ -46,6 +56,13 @@
 #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
 __ALIGN_BEGIN USB_OTG_CORE_HANDLE  USB_OTG_dev __ALIGN_END;
 static __IO uint32_t TimingDelay;
+static __IO uint8_t gu8ButtonEvent;		/* Set by TIM7 ISR on debounced press */
+static __IO uint8_t gu8ButtonState;
+static __IO uint8_t gu8CmdEvent;		/* Set by USB ISR on complete command line */
+static char gszCmdLine[CMD_LINE_SIZE];
+static uint8_t gu8CmdLen;
+static uint16_t gu16SweepCount;					/* Points in gArenaCcm.tSweep */
+static uint16_t gu16Fields = ZPARAM_DEFAULT;	/* Reported parameters */
 
 static const char gszWelcome[] = "\n\r*** Z Meter for STM32F4 ***\n\r\n\r";
 
@@ -57,17 +74,30 @@ extern uint8_t APP_Rx_Buffer[]; /* Write CDC received data in this buffer.
 extern uint32_t APP_Rx_ptr_in;  /* Increment this pointer or roll it back to
                                  * start address when writing received data in
                                  * the buffer APP_Rx_Buffer. */
+extern uint32_t APP_Rx_ptr_out; /* Read pointer of APP_Rx_Buffer, advanced by
+                                 * the CDC core as data is sent. */
 
 /* Private function prototypes -----------------------------------------------*/
-static void MeasureInit (void);
-static void Measure (complex double *pvect_ch1, complex double *pvect_ch2);
-static void MeasureZ (complex double *pZ);
-static void MeasureVector (TVECTOR_POLAR *pch1, TVECTOR_POLAR *pch2);
+static void MeasureNoise (uint8_t u8Mode);
+static void WindowReport (void);
+static void SetQuality (TZPARAM *pParam, const TMEASURE_QUALITY *pQuality);
+static void ReportZ (void);
+static void ReportSweep (void);
+static void ReportCalib (void);
+static void ReportCoherent (void);
+static void ReportDetector (void);
+static void ReportAcquisition (void);
+static void ReportDecimated (uint16_t u16Factor, uint32_t u32Samples);
+static void ReportDeinterleave (uint8_t u8Mode);
+static void ReportBurst (uint16_t u16Blocks, uint8_t u8Verbose);
+static void SendScopeFrame (const TSCOPE_CONFIG *pConfig);
+static void ReportSpectrum (uint8_t u8Channel, uint16_t u16Points, uint8_t u8PeakHold);
+static void ReportHarmonics (void);
+static void Command_Process (char *pszCmd);
 void Delay(__IO uint32_t nTime);
-static int USB_Send (char data[], uint8_t len);
-static int CheckButton (void);
-static void CalcLs (uint32_t freq, complex double zs, double *pLs);
-static void CalcCs (uint32_t freq, complex double zs, double *pLs);
+static int USB_Send (char data[], uint16_t len);
+static void Button_Init (void);
+static void Button_Arm (void);
 
 /* Private functions ---------------------------------------------------------*/
 
@@ -79,8 +109,6 @@ static void CalcCs (uint32_t freq, complex double zs, double *pLs);
   */
 int main(void)
 {
-	int ii = 0;
-
 	USBD_Init(&USB_OTG_dev,
 		#ifdef USE_USB_OTG_HS
 		  USB_OTG_HS_CORE_ID,
@@ -119,36 +147,37 @@ int main(void)
 	STM_EVAL_LEDOn(LED6);
 
 	/* Init measurement engine */
-	MeasureInit();
+	Measure_Init();
+
+	/* Interrupt driven user button */
+	Button_Init();
 
 	/* Welcome prompt */
 	Delay(1000);
 	USB_Send(gszWelcome, strlen(gszWelcome));
 
-	/* Infinite loop */
+	/* Infinite loop: event driven, core sleeps between events */
 	while (1)
 	{
-		if (CheckButton())
+		if (gu8ButtonEvent)
 		{
-			complex double z;
-			TVECTOR_POLAR vZ;
-			char text[100];
-			double cs, ls;
-
-			MeasureZ(&z);
-			CalcCs(MEASUREMENT_FREQ, z, &cs);
-			CalcLs(MEASUREMENT_FREQ, z, &ls);
-			Rect2Polar(z, &vZ);
-
-			sprintf(text, "%.2f<%.2f, R:%.2f, X:%.2f, Cs:%.2f, Ls:%.2f\n\r", vZ.fMag, RAD2DEG(vZ.fPhase), __real__ z, __imag__ z, cs, ls);
-			USB_Send(text, strlen(text));
+			gu8ButtonEvent = 0;
+			ReportZ();
 		}
-		/* Other stuff */
-		ii++;
-		if (ii&1)
-			STM_EVAL_LEDOn(LED6);
-		else
-			STM_EVAL_LEDOff(LED6);
+		if (gu8CmdEvent)
+		{
+			Command_Process(gszCmdLine);
+			gu8CmdLen = 0;
+			gu8CmdEvent = 0;
+		}
+		/* Sleep until next interrupt. Interrupts are masked while checking
+		 * the event flag so an event raised just before WFI still wakes the
+		 * core (WFI exits on pending IRQ even with PRIMASK set). Worst case
+		 * wake-to-measurement latency is the ISR exit time. */
+		__disable_irq();
+		if (!gu8ButtonEvent && !gu8CmdEvent)
+			__WFI();
+		__enable_irq();
 	}
 }
 
@@ -172,95 +201,957 @@ uint16_t EVAL_AUDIO_GetSampleCallBack(void){
 }
 
 /**
-  * @brief Initialize measurements
+  * @brief Measures the impedance and sends the result to the host, with
+  * its uncertainty and the channel SNR (Measure_GetQuality)
+  *
+  * @param  None
+  * @retval None
+  */
+static void ReportZ (void)
+{
+	complex double z;
+	TZPARAM param;
+	TMEASURE_QUALITY quality;
+	char text[400];
+	int len;
+
+	Measure_Z(&z);
+	Measure_GetQuality(&quality);
+	ZParam_Calc(z, Measure_GetFreq(), gu16Fields, &param);
+	param.u8Flags = Measure_GetFlags();
+	SetQuality(&param, &quality);
+	len = ZParam_Format(text, &param, gu16Fields);
+	USB_Send(text, len);
+
+	/* Activity indicator: one toggle per measurement */
+	STM_EVAL_LEDToggle(LED6);
+}
+
+/**
+  * @brief Copies the SNR and uncertainty of a measurement to the output
+  * parameters
+  *
+  * @param  pParam: output parameters
+  * @param  pQuality: quality (Measure_GetQuality)
+  * @retval None
+  */
+static void SetQuality (TZPARAM *pParam, const TMEASURE_QUALITY *pQuality)
+{
+	pParam->fUncR = pQuality->fUncR;
+	pParam->fUncX = pQuality->fUncX;
+	pParam->fUncMag = pQuality->fUncMag;
+	pParam->fUncPhase = pQuality->fUncPhase;
+	pParam->fSnr1 = pQuality->fSnr1;
+	pParam->fSnr2 = pQuality->fSnr2;
+}
+
+/**
+  * @brief Sends the last sweep results to the host. Points keep the
+  * uncertainty of |Z| and phase and the SNR, not that of R and X.
   *
   * @param  None
   * @retval None
   */
-static void MeasureInit (void)
+static void ReportSweep (void)
 {
-	/* Detectors */
-	Sample_Init(SAMPLE_BLOCK_SIZE);
-	Windowing_Init(SAMPLE_BLOCK_SIZE);
-	Goertzel_Init(SAMPLE_BLOCK_SIZE, MEASUREMENT_FREQ, SAMPLING_RATE);
-
-	/* Turn on signal generator */
-	SigGen_Init();
-	SigGen_Enable();
+	const TSWEEP_POINT *pPoint;
+	TZPARAM param;
+	char text[420];
+	uint16_t ii;
+	int len;
+
+	for (ii = 0; ii < gu16SweepCount; ii++)
+	{
+		pPoint = &gArenaCcm.tSweep[ii];
+		len = sprintf(text, "%.1f, ", pPoint->fFreq);
+		ZParam_Calc((complex double)pPoint->z, pPoint->fFreq, gu16Fields, &param);
+		param.u8Flags = pPoint->u8Flags;
+		param.fUncMag = pPoint->fUncMag;
+		param.fUncPhase = pPoint->fUncPhase;
+		param.fSnr1 = pPoint->i8Snr1;
+		param.fSnr2 = pPoint->i8Snr2;
+		len += ZParam_Format(&text[len], &param, gu16Fields);
+		USB_Send(text, len);
+	}
+}
+
+/**
+  * @brief Sends the channel calibration to the host: fitted gain and
+  * skew, then the ratio ch2/ch1 (magnitude, phase in degrees) per point
+  *
+  * @param  None
+  * @retval None
+  */
+static void ReportCalib (void)
+{
+	const TCALIB_POINT *pCal = Calib_GetPoints();
+	char text[80];
+	double fGain, fSkew;
+	uint8_t ii;
+
+	Calib_GetModel(&fGain, &fSkew);
+	sprintf(text, "K:%u, G:%.5f, Skew:%.2fns\n\r", Calib_GetCount(), fGain, fSkew*1e9);
+	USB_Send(text, strlen(text));
+	for (ii = 0; ii < Calib_GetCount(); ii++)
+	{
+		complex double c = (complex double)pCal[ii].c;
+
+		sprintf(text, "%.1f, %.5f<%.3f\n\r", pCal[ii].fFreq, CAbs(c),
+				RAD2DEG(atan2(__imag__ c, __real__ c)));
+		USB_Send(text, strlen(text));
+	}
+}
+
+/**
+  * @brief Sends the coherent mode state to the host: tolerance, plan of the
+  * current frequency (block size, cycles per block, DAC divider, table
+  * length and cycles) and plan cache statistics: hits, misses, hit rate
+  * and evictions. A repeated sweep of up to COHERENT_CACHE_SIZE points
+  * must not add misses.
+  *
+  * @param  None
+  * @retval None
+  */
+static void ReportCoherent (void)
+{
+	TCOHERENT_PLAN plan;
+	char text[180];
+	double fTol;
+	uint32_t u32Hits, u32Misses, u32Evictions;
+	int len;
+
+	Measure_GetCoherent(&fTol, &plan);
+	Coherent_GetCacheStats(&u32Hits, &u32Misses, &u32Evictions);
+	if (plan.i8Status == COHERENT_OK)
+		len = sprintf(text, "H:%.2e, G:%.4f, N:%u, K:%u, D:%lu, L:%u, C:%u, ", fTol,
+				plan.fActual, plan.u16BlockSize, plan.u16Bin, (unsigned long)plan.u32Divider,
+				plan.u16TableLen, plan.u16Cycles);
+	else
+		len = sprintf(text, "H:%.2e, G:%.4f, N:%u, ", fTol, Measure_GetFreq(),
+				Measure_GetActiveBlockSize());
+	sprintf(&text[len], "Hit:%lu, Miss:%lu, Hr:%.1f%%, Ev:%lu\n\r", (unsigned long)u32Hits,
+			(unsigned long)u32Misses,
+			((u32Hits + u32Misses) > 0) ? (100.0*u32Hits)/(u32Hits + u32Misses) : 0.0,
+			(unsigned long)u32Evictions);
+	USB_Send(text, strlen(text));
+}
+
+/**
+  * @brief Compares the integer and the generalized Goertzel detectors on
+  * the same blocks at the current frequency: bin, channel 1 amplitude
+  * (LSB peak, shows the scalloping loss) and impedance, with the same
+  * channel correction as Measure_Z. Off grid the integer detector loses
+  * amplitude; on grid both agree.
+  *
+  * @param  None
+  * @retval None
+  */
+static void ReportDetector (void)
+{
+	uint16_t *ch1 = gArenaSram.tu16Ch1;
+	uint16_t *ch2 = gArenaSram.tu16Ch2;
+	uint16_t u16N = Measure_GetActiveBlockSize();
+	uint8_t u8Saved = Goertzel_GetGeneralized();
+	complex double cCorr = Measure_GetCorrection();
+	complex double vr, vm;
+	complex double tZ[2] = {0, 0};
+	double tfAmp[2] = {0, 0};
+	double tfBin[2] = {0, 0};
+	double fScale = 2.0/(u16N*Windowing_GetCoherentGain()*(1 << Sample_GetOversampling()));
+	char text[160];
+	int ii, jj;
+
+	for (ii = 0; ii < MEASURE_NUM_AVG; ii++)
+	{
+		Sample_Take(ch1, ch2);
+		Windowing_Calc(ch1);
+		Windowing_Calc(ch2);
+		for (jj = 0; jj < 2; jj++)
+		{
+			Goertzel_SetGeneralized((uint8_t)jj);
+			Goertzel_Init(u16N, Measure_GetGenFreq(), Sample_GetRate());
+			Goertzel_Calc(ch1, &vr);
+			Goertzel_Calc(ch2, &vm);
+			tfBin[jj] = Goertzel_GetBin();
+			tfAmp[jj] += fScale*CAbs(vr);
+			tZ[jj] += Measure_CalcZ(vr, vm * cCorr);
+		}
+	}
+	Measure_SetGeneralized(u8Saved);
+
+	for (jj = 0; jj < 2; jj++)
+	{
+		tZ[jj] /= (double)MEASURE_NUM_AVG;
+		sprintf(text, "D%d%s K:%.3f, A1:%.1f, R:%.2f, X:%.2f\n\r", jj, (jj==u8Saved)?"*":"",
+				tfBin[jj], tfAmp[jj]/(double)MEASURE_NUM_AVG, __real__ tZ[jj], __imag__ tZ[jj]);
+		USB_Send(text, strlen(text));
+	}
 }
 
 /**
-  * @brief Perform measurements
+  * @brief Acquisition mode report: oversampling, dither, sampling rate,
+  * Nyquist frequency (above
+  * it the excitation is undersampled), and the time of one block acquisition against the time
+  * the detectors take on it (windowing and Goertzel, both channels)
   *
   * @param  None
   * @retval None
   */
-static void Measure (complex double *pvect_ch1, complex double *pvect_ch2)
+static void ReportAcquisition (void)
 {
-	uint16_t ch1[SAMPLE_BLOCK_SIZE];
-	uint16_t ch2[SAMPLE_BLOCK_SIZE];
-	complex double vect_ch1, vect_ch2;
+	uint16_t *ch1 = gArenaSram.tu16Ch1;
+	uint16_t *ch2 = gArenaSram.tu16Ch2;
+	double fRate = Sample_GetRate();
+	uint32_t u32Start, u32Take, u32Calc;
+	complex double vr, vm;
+	char text[120];
 
-	/* Sampling */
+	u32Start = DWT->CYCCNT;
 	Sample_Take(ch1, ch2);
+	u32Take = DWT->CYCCNT - u32Start;
 
-	/* Signal processing */
+	u32Start = DWT->CYCCNT;
 	Windowing_Calc(ch1);
 	Windowing_Calc(ch2);
-	Goertzel_Calc(ch1, &vect_ch1);
-	Goertzel_Calc(ch2, &vect_ch2);
+	Goertzel_Calc(ch1, &vr);
+	Goertzel_Calc(ch2, &vm);
+	u32Calc = DWT->CYCCNT - u32Start;
 
-	if (pvect_ch1)
-		*pvect_ch1 = vect_ch1;
-	if (pvect_ch2)
-		*pvect_ch2 = vect_ch2;
+	sprintf(text, "A:%u, Os:%u, Dt:%u, Fs:%.1f, Fn:%.1f, N:%u, Ta:%luus, Tp:%luus\n\r", Sample_GetMode(),
+			Sample_GetOversampling(), SigGen_GetDither(), fRate, fRate/2, Measure_GetActiveBlockSize(),
+			(unsigned long)(u32Take/(SystemCoreClock/1000000)), (unsigned long)(u32Calc/(SystemCoreClock/1000000)));
+	USB_Send(text, strlen(text));
 }
 
 /**
-  * @brief
+  * @brief Measures the impedance on the decimated stream and reports it
+  * with the decimated rate, samples, time and processing load
   *
-  * @param  None
+  * @param  u16Factor: decimation factor
+  * @param  u32Samples: decimated samples integrated
   * @retval None
   */
-static void MeasureZ (complex double *pZ)
+static void ReportDecimated (uint16_t u16Factor, uint32_t u32Samples)
 {
-	complex double vr;
-	complex double vm;
+	TDECIMATE_STATS stats;
+	TMEASURE_QUALITY quality;
 	complex double z = 0;
-	int ii;
+	TZPARAM param;
+	char text[400];
+	int iStatus;
+	int len;
+
+	iStatus = Measure_ZDecimated(u16Factor, u32Samples, &z);
+	Decimate_GetStats(&stats);
+	if (iStatus == DECIMATE_OK)
+	{
+		Measure_GetQuality(&quality);
+		ZParam_Calc(z, Measure_GetFreq(), gu16Fields, &param);
+		param.u8Flags = Measure_GetFlags();
+		SetQuality(&param, &quality);
+		len = ZParam_Format(text, &param, gu16Fields);
+		USB_Send(text, len);
+	}
+	sprintf(text, "I:%u, Fd:%.1f, N:%lu, T:%lums, Cpu:%lu%%, St:%d\n\r", u16Factor, stats.fRate,
+			(unsigned long)stats.u32Samples, (unsigned long)stats.u32TimeMs,
+			(unsigned long)stats.u32LoadPct, iStatus);
+	USB_Send(text, strlen(text));
+}
+
+/**
+  * @brief Burst measurement: captures the blocks back to back, processes
+  * them in bulk and sends the mean impedance (or every block) and the
+  * timing: measured and gap free capture time, processing time, capture
+  * and processing throughput (samples per second and channel)
+  *
+  * @param  u16Blocks: blocks requested
+  * @param  u8Verbose: 1 sends the impedance of each block
+  * @retval None
+  */
+static void ReportBurst (uint16_t u16Blocks, uint8_t u8Verbose)
+{
+	TBURST_STATS stats;
+	TMEASURE_QUALITY quality;
+	complex double z = 0;
+	TZPARAM param;
+	char text[420];
+	uint32_t u32Samples;
+	uint16_t ii;
+	int len;
+
+	Measure_Burst(u16Blocks, gArenaCcm.tBurstZ, &stats);
+	for (ii = 0; ii < stats.u16Blocks; ii++)
+	{
+		z += (complex double)gArenaCcm.tBurstZ[ii];
+		if (!u8Verbose)
+			continue;
+		len = sprintf(text, "%u, ", ii);
+		ZParam_Calc((complex double)gArenaCcm.tBurstZ[ii], Measure_GetFreq(), gu16Fields, &param);
+		param.u8Flags = Measure_GetFlags();
+		len += ZParam_Format(&text[len], &param, gu16Fields);
+		USB_Send(text, len);
+	}
+	if (stats.u16Blocks == 0)
+	{
+		USB_Send("?\n\r", 3);
+		return;
+	}
+
+	Measure_GetQuality(&quality);
+	ZParam_Calc(z/(double)stats.u16Blocks, Measure_GetFreq(), gu16Fields, &param);
+	param.u8Flags = Measure_GetFlags();
+	SetQuality(&param, &quality);
+	len = ZParam_Format(text, &param, gu16Fields);
+	USB_Send(text, len);
+
+	u32Samples = (uint32_t)stats.u16Blocks*stats.u16BlockSize;
+	sprintf(text, "U:%u, N:%u, Tc:%luus, Te:%luus, Tp:%luus, Fc:%.0f, Fp:%.0f\n\r", stats.u16Blocks,
+			stats.u16BlockSize, (unsigned long)stats.u32CaptureUs, (unsigned long)stats.u32ExpectedUs,
+			(unsigned long)stats.u32ProcessUs,
+			(stats.u32CaptureUs > 0) ? (1e6*u32Samples)/stats.u32CaptureUs : 0.0,
+			(stats.u32ProcessUs > 0) ? (1e6*u32Samples)/stats.u32ProcessUs : 0.0);
+	USB_Send(text, strlen(text));
+}
+
+/**
+  * @brief Captures a triggered waveform and sends it as a binary frame:
+  * TSCOPE_FRAME header, channel 1 and channel 2 samples, 16 bit sum of
+  * the samples. Only the header is sent if the capture failed.
+  *
+  * @param  pConfig: trigger and depth
+  * @retval None
+  */
+static void SendScopeFrame (const TSCOPE_CONFIG *pConfig)
+{
+	TSCOPE_FRAME frame;
+	uint16_t u16Sum = 0;
+	uint16_t ii;
+
+	Scope_Capture(pConfig, &frame);
+	USB_Send((char *)&frame, sizeof(frame));
+	if (frame.u16Count == 0)
+		return;
+
+	for (ii = 0; ii < frame.u16Count; ii++)
+		u16Sum += gArenaSram.tu16Ch1[ii] + gArenaSram.tu16Ch2[ii];
+	USB_Send((char *)gArenaSram.tu16Ch1, frame.u16Count*sizeof(uint16_t));
+	USB_Send((char *)gArenaSram.tu16Ch2, frame.u16Count*sizeof(uint16_t));
+	USB_Send((char *)&u16Sum, sizeof(u16Sum));
+}
+
+/**
+  * @brief FFT analysis of one block of both channels: fundamental bin,
+  * level and phase, noise floor, SFDR (and largest spur frequency) and
+  * THD per channel. The spectrum of one channel may follow, reduced to
+  * u16Points lines (frequency, dBFS) by peak hold or by power average.
+  * The FFT takes the first samples of the block, the largest power of two
+  * that fits (up to FFT_MAX_SIZE), windowed at that length on the fly:
+  * the window table of the block is not rebuilt.
+  *
+  * @param  u8Channel: spectrum sent for channel 1 or 2, 0 none
+  * @param  u16Points: spectrum lines
+  * @param  u8PeakHold: 1 peak of each group of bins, 0 average
+  * @retval None
+  */
+static void ReportSpectrum (uint8_t u8Channel, uint16_t u16Points, uint8_t u8PeakHold)
+{
+	uint16_t *tu16Ch[2] = {gArenaSram.tu16Ch1, gArenaSram.tu16Ch2};
+	uint16_t u16Block = Measure_GetActiveBlockSize();
+	uint16_t u16N = FFT_MAX_SIZE;
+	double fBinHz, fFundBin;
+	TFFT_RESULT res;
+	char text[160];
+	uint16_t ii, jj, u16Group;
+	int cc;
+
+	while (u16N > u16Block)
+		u16N >>= 1;
+	if (u16N < FFT_MIN_SIZE)
+	{
+		USB_Send("?\n\r", 3);
+		return;
+	}
+	fBinHz = Sample_GetRate()/u16N;
+	fFundBin = (Goertzel_GetBin()*u16N)/u16Block;
+
+	Sample_Take(tu16Ch[0], tu16Ch[1]);
+	for (cc = 0; cc < 2; cc++)
+	{
+		if (Fft_Analyze(tu16Ch[cc], u16N, fFundBin, &res) != FFT_OK)
+		{
+			USB_Send("?\n\r", 3);
+			break;
+		}
+		sprintf(text, "P:%d, N:%u, F1:%.1f, A1:%.1fdBFS, Ph:%.1f, NF:%.1fdBFS, SFDR:%.1fdBc, Fsp:%.1f, THD:%.1fdBc\n\r",
+				cc+1, u16N, res.u16FundBin*fBinHz, res.fFundDb, 180.0*atan2(__imag__ res.cFund, __real__ res.cFund)/M_PI,
+				res.fNoiseDb, res.fSfdrDb, res.u16SpurBin*fBinHz, res.fThdDb);
+		USB_Send(text, strlen(text));
+		if ((cc+1) != u8Channel)
+			continue;
+
+		/* Spectrum, N/2 bins in u16Points groups */
+		if (u16Points > u16N/2)
+			u16Points = u16N/2;
+		u16Group = (u16N/2)/u16Points;
+		for (ii = 0; ii < u16Points; ii++)
+		{
+			const float *pfBin = &Fft_GetSpectrum()[ii*u16Group];
+			float fOut = 0;
+
+			for (jj = 0; jj < u16Group; jj++)
+			{
+				if (u8PeakHold)
+					fOut = (pfBin[jj] > fOut) ? pfBin[jj] : fOut;
+				else
+					fOut += pfBin[jj]/u16Group;
+			}
+			sprintf(text, "%.1f, %.1f\n\r", (ii*u16Group + (u16Group-1)/2.0)*fBinHz,
+					10.0*log10(fOut + 1e-20));
+			USB_Send(text, strlen(text));
+		}
+	}
+}
+
+/**
+  * @brief Measures the impedance with harmonics and reports THD of both
+  * channels, the impedance at each harmonic ("-" if it folds within the
+  * window main lobe of DC or of the fundamental) and the Goertzel cost on one block: cycles
+  * without (Tg) and with the harmonics (Th), and per sample and harmonic
+  *
+  * @param  None
+  * @retval None
+  */
+static void ReportHarmonics (void)
+{
+	uint16_t *ch1 = gArenaSram.tu16Ch1;
+	uint16_t u16N = Measure_GetActiveBlockSize();
+	uint8_t u8Count = Goertzel_GetHarmonicCount();
+	TMEASURE_HARMONICS harm;
+	complex double z, vect;
+	uint32_t u32Harm, u32Fund;
+	uint8_t u8Measured = 0;
+	char text[160];
+	int hh;
 
-	for (ii = 0; ii < NUM_AVG; ii++)
+	Measure_Z(&z);
+	Measure_GetHarmonics(&harm);
+
+	/* Cost on the last block, with and without the harmonics */
+	u32Harm = DWT->CYCCNT;
+	Goertzel_CalcHarmonics(ch1, &vect);
+	u32Harm = DWT->CYCCNT - u32Harm;
+	u32Fund = DWT->CYCCNT;
+	Goertzel_Calc(ch1, &vect);
+	u32Fund = DWT->CYCCNT - u32Fund;
+
+	for (hh = 0; hh < u8Count; hh++)
+		if (harm.u8Mask & (1 << hh))
+			u8Measured++;
+	sprintf(text, "E:%u, F:%.1f, R:%.2f, X:%.2f, THD1:%.3f%%, THD2:%.3f%%, Tg:%lu, Th:%lu, Th/NH:%.2f\n\r",
+			u8Count, Measure_GetFreq(), __real__ z, __imag__ z,
+			harm.fThd1, harm.fThd2,
+			(unsigned long)u32Fund, (unsigned long)u32Harm,
+			u8Measured ? ((double)u32Harm - u32Fund)/((double)u16N*u8Measured) : 0.0);
+	USB_Send(text, strlen(text));
+
+	for (hh = 0; hh < u8Count; hh++)
 	{
-		Measure (&vr, &vm);
-		/* Derives impedance */
-		if (vr==vm)
-			z += 99999999.99;
+		if (harm.u8Mask & (1 << hh))
+			sprintf(text, "H%d, F:%.1f, R:%.2f, X:%.2f\n\r", hh+2, (hh+2)*Measure_GetFreq(),
+					__real__ harm.tZ[hh], __imag__ harm.tZ[hh]);
 		else
-			z += REFERENCE_R * vm / (vr-vm);
+			sprintf(text, "H%d, F:%.1f, -\n\r", hh+2, (hh+2)*Measure_GetFreq());
+		USB_Send(text, strlen(text));
+	}
+}
+
+/**
+  * @brief Measures the per bin SNR of both channels with the given low
+  * noise context options and reports it with the interrupt latency cost.
+  *
+  * @param  u8Mode: SAMPLE_QUIET_xxx bit mask
+  * @retval None
+  */
+static void MeasureNoise (uint8_t u8Mode)
+{
+	uint16_t *ch1 = gArenaSram.tu16Ch1;
+	uint16_t *ch2 = gArenaSram.tu16Ch2;
+	complex double vect;
+	double fSig1 = 0, fSig2 = 0;
+	double fNoise1 = 0, fNoise2 = 0;
+	uint32_t u32MaxCycles = 0;
+	double fEnbw, fScale;
+	char text[100];
+	int ii;
+
+	Sample_SetQuietMode(u8Mode);
+	for (ii = 0; ii < MEASURE_NUM_AVG; ii++)
+	{
+		Sample_Take(ch1, ch2);
+		if (Sample_GetQuietCycles() > u32MaxCycles)
+			u32MaxCycles = Sample_GetQuietCycles();
+
+		Windowing_Calc(ch1);
+		Windowing_Calc(ch2);
+		Goertzel_Calc(ch1, &vect);
+		fSig1 += CAbs(vect)*CAbs(vect);
+		Goertzel_Calc(ch2, &vect);
+		fSig2 += CAbs(vect)*CAbs(vect);
+		fNoise1 += Goertzel_NoiseFloor(ch1);
+		fNoise2 += Goertzel_NoiseFloor(ch2);
 	}
-	z = z / (double)NUM_AVG;
 
-	/* Outputs the value */
-	if (pZ)
-		*pZ = z;
+	/* Refer SNR to a rectangular window (ENBW) and amplitudes to LSB peak
+	 * (coherent gain) so results compare across windows */
+	fSig1 /= (double)MEASURE_NUM_AVG;
+	fSig2 /= (double)MEASURE_NUM_AVG;
+	fNoise1 /= (double)MEASURE_NUM_AVG;
+	fNoise2 /= (double)MEASURE_NUM_AVG;
+	fEnbw = Windowing_GetEnbw();
+	fScale = 2.0/(Measure_GetActiveBlockSize()*Windowing_GetCoherentGain()*(1 << Sample_GetOversampling()));
+	sprintf(text, "Q:%02X, A1:%.1f, A2:%.1f, SNR1:%.1fdB, SNR2:%.1fdB, Lat:%luus\n\r", u8Mode,
+			sqrt(fSig1)*fScale, sqrt(fSig2)*fScale,
+			10.0*log10(fEnbw*fSig1/(fNoise1+1e-12)), 10.0*log10(fEnbw*fSig2/(fNoise2+1e-12)),
+			(unsigned long)(u32MaxCycles/(SystemCoreClock/1000000)));
+	USB_Send(text, strlen(text));
 }
 
 /**
-  * @brief
+  * @brief Deinterleave report: CPU cycles one block spends splitting the
+  * dual ADC words, total and per sample, and the whole acquisition time
+  *
+  * @param  u8Mode: SAMPLE_DEINT_xxx
+  * @retval None
+  */
+static void ReportDeinterleave (uint8_t u8Mode)
+{
+	uint16_t *ch1 = gArenaSram.tu16Ch1;
+	uint16_t *ch2 = gArenaSram.tu16Ch2;
+	uint16_t u16N = Measure_GetActiveBlockSize();
+	uint32_t u32Take;
+	char text[80];
+
+	Sample_SetDeinterleave(u8Mode);
+	u32Take = DWT->CYCCNT;
+	Sample_Take(ch1, ch2);
+	u32Take = DWT->CYCCNT - u32Take;
+
+	sprintf(text, "X:%u, N:%u, Td:%lu, Td/N:%.2f, Ta:%luus\n\r", u8Mode, u16N,
+			(unsigned long)Sample_GetDeintCycles(), (double)Sample_GetDeintCycles()/u16N,
+			(unsigned long)(u32Take/(SystemCoreClock/1000000)));
+	USB_Send(text, strlen(text));
+}
+
+/**
+  * @brief Benchmarks the available windows on a sampled block: corrections,
+  * scalloping loss, table build and per block cost. Active window is
+  * restored afterwards.
   *
   * @param  None
   * @retval None
   */
-static void MeasureVector (TVECTOR_POLAR *pch1, TVECTOR_POLAR *pch2)
+static void WindowReport (void)
+{
+	uint16_t *ch1 = gArenaSram.tu16Ch1;
+	uint16_t *ch2 = gArenaSram.tu16Ch2;
+	uint8_t u8Saved = Windowing_GetType();
+	float fBeta = Windowing_GetBeta();
+	uint32_t u32Init, u32Calc;
+	char text[100];
+	uint8_t u8Type;
+
+	Sample_Take(ch1, ch2);
+	for (u8Type = 0; u8Type < WINDOW_COUNT; u8Type++)
+	{
+		u32Init = DWT->CYCCNT;
+		Windowing_Select(u8Type, fBeta);
+		u32Init = DWT->CYCCNT - u32Init;
+
+		memcpy(ch2, ch1, Measure_GetActiveBlockSize()*sizeof(uint16_t));
+		u32Calc = DWT->CYCCNT;
+		Windowing_Calc(ch2);
+		u32Calc = DWT->CYCCNT - u32Calc;
+
+		sprintf(text, "W%d %s%s CG:%.3f, ENBW:%.3f, SL:%.2fdB, Init:%lu, Calc:%lu\n\r", u8Type,
+				Windowing_GetName(u8Type), (u8Type==u8Saved)?"*":"",
+				Windowing_GetCoherentGain(), Windowing_GetEnbw(), Windowing_GetScallopLoss(),
+				(unsigned long)u32Init, (unsigned long)u32Calc);
+		USB_Send(text, strlen(text));
+	}
+	Windowing_Select(u8Saved, fBeta);
+}
+
+/**
+  * @brief Executes a host command line.
+  *
+  * M       Measure impedance, with its uncertainty and channel SNR
+  * Q       Report low noise context options
+  * Q hh    Set low noise context options (SAMPLE_QUIET_xxx hex mask)
+  * N       Noise floor report: SNR and latency with no option, each option
+  *         alone and all options
+  * B       Report block size
+  * B n     Set block size (samples, up to SAMPLE_MAX_BLOCK_SIZE)
+  * W       Window report and benchmark (* marks the active one)
+  * W n [b] Select window WINDOW_xxx, b: Kaiser beta
+  * F       Report output fields
+  * F hhhh  Select output fields (ZPARAM_xxx hex mask)
+  * G       Report measurement frequency
+  * G f     Set measurement frequency (Hz), above the Nyquist frequency
+  *         it is undersampled (coherent alias plan). Reports the measured offset
+  *         of the excitation from the generator, settling time, and the
+  *         flags and SNR of a measurement at the frequency
+  * S f1 f2 n [l] Sweep n points from f1 to f2 (Hz), l=1 logarithmic.
+  *         Points carry the uncertainty of |Z| and phase and the SNR
+  * T f1 f2 n [l] Multi-tone: n tones (up to SIGGEN_MAX_TONES) from f1 to
+  *         f2 (Hz) measured at once, l=1 logarithmic. Result becomes the
+  *         last sweep
+  * L       Report excitation level and automatic level control
+  * L x     Fixed excitation level x (0.01 to 1), 0 for automatic
+  * K       Report channel calibration: gain, skew and points
+  * K f1 f2 [n] Calibrate n points (log) from f1 to f2 (Hz), DUT removed
+  * K 0     Drop the channel calibration
+  * H       Report coherent mode and the plan of the current frequency
+  * H t [n] Coherent mode, relative tolerance t, blocks up to n samples
+  * H 0     Coherent mode off
+  * D       Detector report: integer and generalized Goertzel on the same
+  *         blocks (bin, channel 1 amplitude, impedance)
+  * D n     Detector: 0 integer bin, 1 generalized (fractional bin)
+  * A       Acquisition report: mode, oversampling, dither, sampling rate,
+  *         Nyquist frequency,
+  *         acquisition and detector time per block
+  * A m [o [d]] Acquisition mode SAMPLE_MODE_xxx: 0 normal (218750sps), 1
+  *         fast (525000sps, shorter ADC sample time). Calibrate each mode
+  *         (K). o: oversampling, 2^o conversions summed per sample (up to
+  *         SAMPLE_MAX_OVERSAMPLING). d: excitation dither (DAC LSB)
+  * X       Deinterleave report: CPU cycles per block with each mode
+  * X n     Deinterleave SAMPLE_DEINT_xxx: 0 CPU, 1 DMA memory to memory
+  *         (no oversampling only)
+  * O s e l p q [d] Scope: binary frame (TSCOPE_FRAME) of p pre and q
+  *         post trigger samples, d conversions averaged per sample.
+  *         s: SCOPE_TRIG_xxx, e: SCOPE_EDGE_xxx, l: level (ADC counts)
+  *         or excitation table index
+  * E       Harmonics report: impedance measurement with THD per channel
+  *         and impedance at each harmonic, Goertzel cycles per block
+  * E n     Harmonics: n above the fundamental (up to
+  *         GOERTZEL_MAX_HARMONICS) measured with every impedance, 0 off
+  * P [c [m [h]]] FFT analysis of a block (size a power of two, up to
+  *         FFT_MAX_SIZE): fundamental, noise floor, SFDR, THD per channel.
+  *         c: spectrum of channel 1 or 2 in m lines (default 64), h=0
+  *         averaged, 1 peak held (default)
+  * U m [v] Burst: m blocks back to back at full rate (up to the burst
+  *         buffer), processed afterwards. v=1 sends every block
+  * I r n   Long integration: n samples of the stream decimated by r (CIC,
+  *         DECIMATE_MIN_FACTOR to DECIMATE_MAX_FACTOR), constant memory
+  * C m     Fit circuit model FIT_xxx to the last sweep
+  * R f1 f2 [p [m]] Resonance search between f1 and f2 (Hz), p=1 parallel,
+  *         m: FIT_xxx model. Measured points become the last sweep
+  *
+  * @param  pszCmd: null terminated command line
+  * @retval None
+  */
+static void Command_Process (char *pszCmd)
+{
+	char text[140];
+	unsigned int uMode;
+	unsigned int uSize;
+	unsigned int uLog;
+	unsigned long ulCount;
+	float fBeta;
+	float fFreq1, fFreq2;
+	TFIT_RESULT fit;
+	TSEARCH_RESULT res;
+	TMEASURE_QUALITY quality;
+	uint32_t u32Cycles;
+	uint8_t u8Saved;
+	TSCOPE_CONFIG scope;
+	unsigned int tuScope[6];
+	int ii;
+
+	switch (pszCmd[0])
+	{
+	case 'M':
+	case 'm':
+		ReportZ();
+		break;
+	case 'Q':
+	case 'q':
+		if (sscanf(&pszCmd[1], "%x", &uMode) == 1)
+			Sample_SetQuietMode((uint8_t)uMode);
+		uMode = Sample_GetQuietMode();
+		sprintf(text, "Q:%02X, SYSTICK:%d, USB:%d, LEDS:%d, FLASH:%d, RAMWAIT:%d\n\r", uMode,
+				(uMode&SAMPLE_QUIET_SYSTICK)!=0, (uMode&SAMPLE_QUIET_USB)!=0, (uMode&SAMPLE_QUIET_LEDS)!=0,
+				(uMode&SAMPLE_QUIET_FLASH)!=0, (uMode&SAMPLE_QUIET_RAMWAIT)!=0);
+		USB_Send(text, strlen(text));
+		break;
+	case 'N':
+	case 'n':
+		u8Saved = Sample_GetQuietMode();
+		MeasureNoise(0);
+		for (ii = 0; (1<<ii) <= SAMPLE_QUIET_ALL; ii++)
+			MeasureNoise(1<<ii);
+		MeasureNoise(SAMPLE_QUIET_ALL);
+		Sample_SetQuietMode(u8Saved);
+		break;
+	case 'B':
+	case 'b':
+		if ((sscanf(&pszCmd[1], "%u", &uSize) == 1) && (uSize >= 16))
+			Measure_Config((uSize > Sample_GetMaxBlockSize()) ? Sample_GetMaxBlockSize() : (uint16_t)uSize);
+		sprintf(text, "B:%u, MAX:%u\n\r", Measure_GetBlockSize(), Sample_GetMaxBlockSize());
+		USB_Send(text, strlen(text));
+		break;
+	case 'F':
+	case 'f':
+		if ((sscanf(&pszCmd[1], "%x", &uMode) == 1) && (uMode & ZPARAM_ALL))
+			gu16Fields = (uint16_t)(uMode & ZPARAM_ALL);
+		sprintf(text, "F:%04X\n\r", gu16Fields);
+		USB_Send(text, strlen(text));
+		break;
+	case 'G':
+	case 'g':
+		if (sscanf(&pszCmd[1], "%f", &fFreq1) == 1)
+			Measure_SetFreq(fFreq1);
+		Measure_Z(NULL);
+		Measure_GetQuality(&quality);
+		sprintf(text, "G:%.3f, Fe:%+.3f, Ts:%luus, Fl:%02X, SNR1:%.1f, SNR2:%.1f\n\r", Measure_GetFreq(),
+				Measure_GetFreqOffset(), (unsigned long)Measure_GetSettleUs(), Measure_GetFlags(),
+				quality.fSnr1, quality.fSnr2);
+		USB_Send(text, strlen(text));
+		break;
+	case 'S':
+	case 's':
+		uLog = 0;
+		if (sscanf(&pszCmd[1], "%f %f %u %u", &fFreq1, &fFreq2, &uSize, &uLog) < 3)
+		{
+			USB_Send("?\n\r", 3);
+			break;
+		}
+		gu16SweepCount = Measure_Sweep(fFreq1, fFreq2, (uint16_t)uSize, (uint8_t)uLog, gArenaCcm.tSweep);
+		ReportSweep();
+		break;
+	case 'T':
+	case 't':
+		uLog = 0;
+		if ((sscanf(&pszCmd[1], "%f %f %u %u", &fFreq1, &fFreq2, &uSize, &uLog) < 3) || (uSize > SIGGEN_MAX_TONES))
+		{
+			USB_Send("?\n\r", 3);
+			break;
+		}
+		u32Cycles = DWT->CYCCNT;
+		gu16SweepCount = Measure_MultiTone(fFreq1, fFreq2, (uint8_t)uSize, (uint8_t)uLog, gArenaCcm.tSweep);
+		u32Cycles = DWT->CYCCNT - u32Cycles;
+		ReportSweep();
+		sprintf(text, "T:%lums\n\r", (unsigned long)(u32Cycles/(SystemCoreClock/1000)));
+		USB_Send(text, strlen(text));
+		break;
+	case 'L':
+	case 'l':
+		if (sscanf(&pszCmd[1], "%f", &fFreq1) == 1)
+		{
+			if (fFreq1 <= 0)
+			{
+				Measure_SetAutoLevel(1);
+			}
+			else
+			{
+				Measure_SetAutoLevel(0);
+				SigGen_SetLevel(fFreq1);
+			}
+		}
+		sprintf(text, "L:%.3f, Auto:%u, Fl:%02X\n\r", SigGen_GetLevel(), Measure_GetAutoLevel(), Measure_GetFlags());
+		USB_Send(text, strlen(text));
+		break;
+	case 'K':
+	case 'k':
+		uSize = 16;
+		ii = sscanf(&pszCmd[1], "%f %f %u", &fFreq1, &fFreq2, &uSize);
+		if (ii >= 2)
+		{
+			if (Calib_Run(fFreq1, fFreq2, (uint8_t)((uSize > CALIB_MAX_POINTS) ? CALIB_MAX_POINTS : uSize)) == 0)
+			{
+				USB_Send("?\n\r", 3);
+				break;
+			}
+		}
+		else if ((ii == 1) && (fFreq1 == 0))
+		{
+			Calib_Clear();
+		}
+		ReportCalib();
+		break;
+	case 'H':
+	case 'h':
+		uSize = SAMPLE_MAX_BLOCK_SIZE;
+		if (sscanf(&pszCmd[1], "%f %u", &fBeta, &uSize) >= 1)
+			Measure_SetCoherent(fBeta, (uSize > SAMPLE_MAX_BLOCK_SIZE) ? SAMPLE_MAX_BLOCK_SIZE : (uint16_t)uSize);
+		ReportCoherent();
+		break;
+	case 'I':
+	case 'i':
+		if (sscanf(&pszCmd[1], "%u %lu", &uSize, &ulCount) != 2)
+		{
+			USB_Send("?\n\r", 3);
+			break;
+		}
+		ReportDecimated((uSize > DECIMATE_MAX_FACTOR) ? 0 : (uint16_t)uSize, (uint32_t)ulCount);
+		break;
+	case 'A':
+	case 'a':
+		uSize = Sample_GetOversampling();
+		uLog = SigGen_GetDither();
+		if (sscanf(&pszCmd[1], "%u %u %u", &uMode, &uSize, &uLog) >= 1)
+		{
+			Measure_SetSampleMode((uint8_t)uMode, (uSize > SAMPLE_MAX_OVERSAMPLING) ? SAMPLE_MAX_OVERSAMPLING : (uint8_t)uSize);
+			Measure_SetDither((uLog > SIGGEN_MAX_DITHER) ? SIGGEN_MAX_DITHER : (uint8_t)uLog);
+		}
+		ReportAcquisition();
+		break;
+	case 'D':
+	case 'd':
+		if (sscanf(&pszCmd[1], "%u", &uMode) == 1)
+			Measure_SetGeneralized(uMode ? 1 : 0);
+		ReportDetector();
+		break;
+	case 'C':
+	case 'c':
+		if ((sscanf(&pszCmd[1], "%u", &uMode) != 1) || (uMode >= FIT_MODEL_COUNT))
+			uMode = FIT_SERIES_RLC;
+		u32Cycles = DWT->CYCCNT;
+		Fit_Run(gArenaCcm.tSweep, gu16SweepCount, (uint8_t)uMode, &fit);
+		u32Cycles = DWT->CYCCNT - u32Cycles;
+		Fit_Format(text, &fit);
+		USB_Send(text, strlen(text));
+		sprintf(text, "T:%lums\n\r", (unsigned long)(u32Cycles/(SystemCoreClock/1000)));
+		USB_Send(text, strlen(text));
+		break;
+	case 'R':
+	case 'r':
+		uLog = SEARCH_SERIES;
+		uMode = FIT_MODEL_COUNT;
+		if (sscanf(&pszCmd[1], "%f %f %u %u", &fFreq1, &fFreq2, &uLog, &uMode) < 2)
+		{
+			USB_Send("?\n\r", 3);
+			break;
+		}
+		if (uMode >= FIT_MODEL_COUNT)
+			uMode = (uLog == SEARCH_PARALLEL) ? FIT_PARALLEL_RLC : FIT_SERIES_RLC;
+		Search_Resonance(fFreq1, fFreq2, (uint8_t)uLog, (uint8_t)uMode, gArenaCcm.tSweep, &res);
+		gu16SweepCount = res.u16Points;
+		/* U: points a uniform sweep would need for the same resolution */
+		sprintf(text, "Fr:%.3f, Res:%.4f, Q:%.3f, R:%.3f, X:%.3f, N:%u, U:%.0f, St:%d\n\r", res.fFreq,
+				res.fResolution, res.fQ, __real__ res.z, __imag__ res.z, res.u16Points,
+				(res.fResolution > 0) ? (fFreq2-fFreq1)/res.fResolution : 0.0, res.i8Status);
+		USB_Send(text, strlen(text));
+		Fit_Format(text, &res.fit);
+		USB_Send(text, strlen(text));
+		break;
+	case 'E':
+	case 'e':
+		if (sscanf(&pszCmd[1], "%u", &uMode) == 1)
+			Measure_SetHarmonics((uMode > GOERTZEL_MAX_HARMONICS) ? GOERTZEL_MAX_HARMONICS : (uint8_t)uMode);
+		ReportHarmonics();
+		break;
+	case 'P':
+	case 'p':
+		uMode = 0;
+		uSize = 64;
+		uLog = 1;
+		sscanf(&pszCmd[1], "%u %u %u", &uMode, &uSize, &uLog);
+		if (uSize > 0)
+			ReportSpectrum((uint8_t)uMode, (uSize > FFT_MAX_SIZE/2) ? FFT_MAX_SIZE/2 : (uint16_t)uSize, (uint8_t)uLog);
+		else
+			USB_Send("?\n\r", 3);
+		break;
+	case 'O':
+	case 'o':
+		tuScope[5] = 1;
+		if (sscanf(&pszCmd[1], "%u %u %u %u %u %u", &tuScope[0], &tuScope[1], &tuScope[2],
+				&tuScope[3], &tuScope[4], &tuScope[5]) >= 5)
+		{
+			scope.u8Source = (uint8_t)tuScope[0];
+			scope.u8Edge = (uint8_t)tuScope[1];
+			scope.u16Level = (tuScope[2] > 0xFFFF) ? 0xFFFF : (uint16_t)tuScope[2];
+			scope.u16Pre = (tuScope[3] > SCOPE_MAX_DEPTH) ? SCOPE_MAX_DEPTH : (uint16_t)tuScope[3];
+			scope.u16Post = (tuScope[4] > SCOPE_MAX_DEPTH) ? SCOPE_MAX_DEPTH : (uint16_t)tuScope[4];
+			scope.u16Decim = (tuScope[5] > SCOPE_MAX_DECIM) ? SCOPE_MAX_DECIM : (uint16_t)tuScope[5];
+			SendScopeFrame(&scope);
+		}
+		else
+		{
+			USB_Send("?\n\r", 3);
+		}
+		break;
+	case 'U':
+	case 'u':
+		uLog = 0;
+		if (sscanf(&pszCmd[1], "%u %u", &uSize, &uLog) >= 1)
+			ReportBurst((uSize > MEASURE_BURST_MAX_BLOCKS) ? MEASURE_BURST_MAX_BLOCKS : (uint16_t)uSize, (uint8_t)uLog);
+		else
+			USB_Send("?\n\r", 3);
+		break;
+	case 'X':
+	case 'x':
+		if (sscanf(&pszCmd[1], "%u", &uMode) == 1)
+		{
+			ReportDeinterleave((uMode > SAMPLE_DEINT_DMA) ? SAMPLE_DEINT_DMA : (uint8_t)uMode);
+		}
+		else
+		{
+			u8Saved = Sample_GetDeinterleave();
+			ReportDeinterleave(SAMPLE_DEINT_CPU);
+			ReportDeinterleave(SAMPLE_DEINT_DMA);
+			Sample_SetDeinterleave(u8Saved);
+		}
+		break;
+	case 'W':
+	case 'w':
+		fBeta = Windowing_GetBeta();
+		switch (sscanf(&pszCmd[1], "%u %f", &uMode, &fBeta))
+		{
+		case 1:
+		case 2:
+			if (Measure_SetWindow((uint8_t)uMode, fBeta) != 0)
+				USB_Send("?\n\r", 3);
+			break;
+		default:
+			WindowReport();
+			break;
+		}
+		break;
+	default:
+		USB_Send("?\n\r", 3);
+		break;
+	}
+}
+
+/**
+  * @brief Receives host data. Assembles a command line to be executed from
+  * the main loop. Called from the USB ISR (VCP_DataRx).
+  *
+  * @param  Buf: received data
+  * @param  Len: number of bytes
+  * @retval None
+  */
+void USB_Receive (uint8_t *Buf, uint32_t Len)
 {
-	complex double ch1;
-	complex double ch2;
-
-	Measure (&ch1, &ch2);
-	if (pch1)
-		Rect2Polar(ch1, pch1);
-	if (pch2)
-		Rect2Polar(ch2, pch2);
+	uint32_t ii;
+
+	for (ii = 0; ii < Len; ii++)
+	{
+		/* Previous command still pending: drop */
+		if (gu8CmdEvent)
+			return;
+		if ((Buf[ii] == '\r') || (Buf[ii] == '\n'))
+		{
+			if (gu8CmdLen == 0)
+				continue;
+			gszCmdLine[gu8CmdLen] = 0;
+			gu8CmdEvent = 1;
+		}
+		else if (gu8CmdLen < CMD_LINE_SIZE-1)
+		{
+			gszCmdLine[gu8CmdLen++] = (char)Buf[ii];
+		}
+	}
 }
 
 /**
@@ -269,15 +1160,28 @@ static void MeasureVector (TVECTOR_POLAR *pch1, TVECTOR_POLAR *pch2)
   * @param  None
   * @retval None
   */
-static int USB_Send (char data[], uint8_t len)
+static int USB_Send (char data[], uint16_t len)
 {
 	int ii;
+	uint32_t u32Next;
+	uint32_t u32Timeout;
 
 	for (ii = 0; ii < len; ii++)
 	{
+		u32Next = APP_Rx_ptr_in + 1;
+		if (u32Next == APP_RX_DATA_SIZE)
+			u32Next = 0;
+		/* Buffer full: wait for the IN transfers to drain it */
+		u32Timeout = USB_SEND_TIMEOUT_MS;
+		while ((u32Next == APP_Rx_ptr_out) && u32Timeout)
+		{
+			Delay(1);
+			u32Timeout--;
+		}
+		if (u32Timeout == 0)
+			return ii;
 		APP_Rx_Buffer[APP_Rx_ptr_in] = data[ii];
-		if (++APP_Rx_ptr_in == APP_RX_DATA_SIZE)
-			APP_Rx_ptr_in = 0;
+		APP_Rx_ptr_in = u32Next;
 	}
 	return len;
 }
@@ -291,7 +1195,9 @@ void Delay(__IO uint32_t nTime)
 {
   TimingDelay = nTime;
 
-  while(TimingDelay != 0);
+  /* Sleep between SysTick interrupts instead of spinning */
+  while(TimingDelay != 0)
+	  __WFI();
 }
 
 /**
@@ -308,74 +1214,95 @@ void TimingDelay_Decrement(void)
 }
 
 /**
-  * @brief  Checks if button is pressed.
+  * @brief  Configures the user button as EXTI source and TIM7 as one shot
+  * debounce timer.
+  * TIM7 clock: APB1 x2 = 84MHz, prescaled to 10KHz
   * @param  None
   * @retval None
   */
-static int CheckButton (void)
+static void Button_Init (void)
 {
-	int ii;
+	TIM_TimeBaseInitTypeDef TIM_TimeBaseStructure;
+	NVIC_InitTypeDef NVIC_InitStructure;
 
-	if (!STM_EVAL_PBGetState(BUTTON_USER))
-		return 0;
-	/* Debounce */
-	for (ii = 0; ii < 5; ii++)
-	{
-		if (!STM_EVAL_PBGetState(BUTTON_USER))
-			return 0;
-		Delay(10);
-	}
-	/* Wait release */
-	for (ii = 0; ii < 100; ii++)
-	{
-		if (!STM_EVAL_PBGetState(BUTTON_USER))
-			break;
-		Delay(10);
-	}
-	return 1;
+	/* TIM7 one pulse debounce timer */
+	RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM7, ENABLE);
+	TIM_TimeBaseStructInit(&TIM_TimeBaseStructure);
+	TIM_TimeBaseStructure.TIM_Prescaler = (SystemCoreClock/2/10000)-1;
+	TIM_TimeBaseStructure.TIM_Period = (BUTTON_DEBOUNCE_MS*10)-1;
+	TIM_TimeBaseStructure.TIM_CounterMode = TIM_CounterMode_Up;
+	TIM_TimeBaseInit(TIM7, &TIM_TimeBaseStructure);
+	TIM_SelectOnePulseMode(TIM7, TIM_OPMode_Single);
+	TIM_ClearITPendingBit(TIM7, TIM_IT_Update);
+	TIM_ITConfig(TIM7, TIM_IT_Update, ENABLE);
+
+	NVIC_InitStructure.NVIC_IRQChannel = TIM7_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0x0F;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0x0F;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+
+	gu8ButtonEvent = 0;
+	gu8ButtonState = BUTTON_ARMED;
+
+	/* Button on EXTI line, rising edge */
+	STM_EVAL_PBInit(BUTTON_USER, BUTTON_MODE_EXTI);
 }
 
 /**
-  * @brief Calculates inductance
-  *
-  * @param i32Freq	Frequency
-  * @param fX		Reactance
-  * @retval Inductance in uH
+  * @brief  Re-enables button EXTI line after a debounce cycle
+  * @param  None
+  * @retval None
   */
-static void CalcLs (uint32_t freq, complex double zs, double *pLs)
+static void Button_Arm (void)
 {
-	double dfLs;
-
-	dfLs = (__imag__ zs)/(double)(2.0*M_PI*((double)freq/1000000.0));
+	gu8ButtonState = BUTTON_ARMED;
+	EXTI_ClearITPendingBit(USER_BUTTON_EXTI_LINE);
+	EXTI->IMR |= USER_BUTTON_EXTI_LINE;
+}
 
-	if (fabs(dfLs) > LIMIT_MAX_L)
-		dfLs = LIMIT_MAX_L;
+/**
+  * @brief  Button EXTI edge. Masks the line and starts the debounce timer.
+  * Called from EXTI0_IRQHandler.
+  * @param  None
+  * @retval None
+  */
+void Button_EXTI_Handler (void)
+{
+	EXTI->IMR &= ~USER_BUTTON_EXTI_LINE;
+	EXTI_ClearITPendingBit(USER_BUTTON_EXTI_LINE);
 
-	if (pLs)
-		*pLs = dfLs;
+	gu8ButtonState = BUTTON_PRESS;
+	TIM_SetCounter(TIM7, 0);
+	TIM_Cmd(TIM7, ENABLE);
 }
 
 /**
-  * @brief Calculates capacitance
-  *
-  * @param i32Freq	Frequency
-  * @param fX		Reactance
-  * @retval Capacitance in pF
+  * @brief  Debounce timer expired. Confirms press, then polls for release
+  * before re-arming the EXTI line. Called from TIM7_IRQHandler.
+  * @param  None
+  * @retval None
   */
-static void CalcCs (uint32_t freq, complex double zs, double *pLs)
+void Button_Debounce_Handler (void)
 {
-	double dfCs;
+	TIM_ClearITPendingBit(TIM7, TIM_IT_Update);
 
-	if (fabs(__imag__ zs) > LIMIT_MIN_X)
-		dfCs = ((double)(-1000000.0)/(double)(__imag__ zs*2.0*M_PI*((double)freq)/1000000.0));
+	if (STM_EVAL_PBGetState(BUTTON_USER))
+	{
+		if (gu8ButtonState == BUTTON_PRESS)
+		{
+			gu8ButtonEvent = 1;
+			gu8ButtonState = BUTTON_RELEASE;
+		}
+		/* Still pressed: poll again */
+		TIM_SetCounter(TIM7, 0);
+		TIM_Cmd(TIM7, ENABLE);
+	}
 	else
-		dfCs = -LIMIT_MAX_C;
-
-	if (fabs(dfCs) > LIMIT_MAX_C)
-		dfCs = -LIMIT_MAX_C;
-
-	if (pLs)
-		*pLs = dfCs;
+	{
+		/* Bounce or released */
+		Button_Arm();
+	}
 }
 
 /************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
@@ -0,0 +1,1147 @@
+/**
+  ******************************************************************************
+  * @file    measure.c
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Impedance measurement engine
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stm32f4xx.h"
+#include "stm32f4_discovery.h"
+#include "sample.h"
+#include "siggen.h"
+#include "windowing_fn.h"
+#include "goertzel.h"
+#include "complex.h"
+#include "arena.h"
+#include "measure.h"
+#include "calib.h"
+#include "coherent.h"
+#include "decimate.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/* Running sums for TMEASURE_QUALITY, taken about the first result */
+typedef struct
+{
+	uint16_t u16Count;
+	complex double tShift[3];		/* First Z, vr and vm */
+	complex double tSum[3];			/* Sums of the differences to tShift */
+	double fRR, fXX, fRX;			/* Products of the Z differences */
+	double tfNorm[2];				/* |vr|^2 and |vm|^2 of the differences */
+} TQUALITY_SUM;
+
+/* Private define ------------------------------------------------------------*/
+#define MAX_Z_MAG			99999999.99
+#define REFERENCE_R			4740.0		/* Adjust to the actual implemented value */
+#define SETTLE_TOL			2e-3		/* Block to block change of vm/vr taken as settled */
+#define SETTLE_HITS			2			/* Consecutive blocks below SETTLE_TOL */
+#define SETTLE_MAX_BLOCKS	64			/* Gives up (MEASURE_FLAG_UNSETTLED) */
+#define LEVEL_LOW			900.0		/* Signal peak range kept by the level loop (ADC counts) */
+#define LEVEL_HIGH			1800.0
+#define LEVEL_TARGET		1400.0
+#define LEVEL_MAX_ITER		4
+#define FREQ_EST_BLOCKS		3			/* Last settle blocks averaged by the frequency estimator */
+#define FREQ_EST_MIN_REL	1e-6		/* Offsets below this (relative) are taken as zero */
+#define ALIAS_TOL			1e-3		/* Coherent plan tolerance when undersampling */
+
+/* Private macro -------------------------------------------------------------*/
+ARENA_ASSERT(COHERENT_CACHE_SIZE >= SWEEP_MAX_POINTS, coherent_cache_holds_sweep);
+
+/* Private variables ---------------------------------------------------------*/
+static uint16_t gu16BlockSize;			/* Configured (minimum) block size */
+static uint16_t gu16Active = 0;			/* Block size the detectors run with */
+static double gfCohTol = 0;				/* Coherent mode tolerance, 0 if off */
+static uint16_t gu16CohMaxBlock = SAMPLE_MAX_BLOCK_SIZE;
+static TCOHERENT_PLAN gtPlan;
+static double gfFreq = MEASUREMENT_FREQ;		/* Generator frequency (divider derived) */
+static double gfTrueFreq = MEASUREMENT_FREQ;	/* Measured excitation frequency */
+static double gfFreqOffset = 0;				/* Last estimate of gfTrueFreq - gfFreq */
+static uint8_t gu8Flags = 0;
+static uint32_t gu32SettleUs = 0;
+static uint8_t gu8AutoLevel = 1;
+static complex double gcCorr = 1.0;		/* Channel mismatch correction for vm */
+static complex double gtHarmVr[GOERTZEL_MAX_HARMONICS];	/* Harmonic vectors of the last block */
+static complex double gtHarmVm[GOERTZEL_MAX_HARMONICS];
+static uint8_t gu8HarmMask = 0;
+static TMEASURE_HARMONICS gtHarm;		/* Harmonics of the last Measure_Z */
+static TMEASURE_QUALITY gtQuality;		/* SNR and uncertainty of the last measurement */
+static TQUALITY_SUM gtToneSum[SIGGEN_MAX_TONES];	/* Multi-tone quality, one per tone */
+
+/* Private function prototypes -----------------------------------------------*/
+extern void Delay(__IO uint32_t nTime);
+static void Settle (const uint16_t *pu16Bin);
+static void AutoLevel (void);
+static void ApplyBlockSize (uint16_t u16BlockSize);
+static void QualityAdd (TQUALITY_SUM *pSum, complex double z, complex double vr, complex double vm);
+static uint8_t QualityGet (const TQUALITY_SUM *pSum, TMEASURE_QUALITY *pQuality);
+static float Snr (complex double cMean, double fVar);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief Initialize measurements
+  *
+  * @param  None
+  * @retval None
+  */
+void Measure_Init (void)
+{
+	/* Detectors */
+	Measure_Config(SAMPLE_BLOCK_SIZE);
+
+	/* Turn on signal generator */
+	SigGen_Init();
+	SigGen_Enable();
+	gfFreq = SigGen_GetFreq();
+	Settle(NULL);
+	AutoLevel();
+}
+
+/**
+  * @brief Configures the detectors for a block size
+  *
+  * @param  u16BlockSize: samples per block, up to Sample_GetMaxBlockSize
+  * @retval None
+  */
+void Measure_Config (uint16_t u16BlockSize)
+{
+	if (u16BlockSize > Sample_GetMaxBlockSize())
+		u16BlockSize = Sample_GetMaxBlockSize();
+	gu16BlockSize = u16BlockSize;
+
+	gu16Active = 0;
+	ApplyBlockSize(u16BlockSize);
+	Goertzel_Init(u16BlockSize, gfFreq, Sample_GetRate());
+}
+
+/**
+  * @brief Returns the configured block size
+  *
+  * @param  None
+  * @retval samples per block
+  */
+uint16_t Measure_GetBlockSize (void)
+{
+	return gu16BlockSize;
+}
+
+/**
+  * @brief Returns the block size of the current frequency: the configured
+  * one, or the coherent plan one
+  *
+  * @param  None
+  * @retval samples per block
+  */
+uint16_t Measure_GetActiveBlockSize (void)
+{
+	return gu16Active;
+}
+
+/**
+  * @brief Coherent mode: every frequency is moved to a coherent one, a
+  * whole number of cycles in a block that the DAC plays exactly. The
+  * shortest block (from the configured block size up to u16MaxBlock)
+  * with such a frequency within fTol wins; a longer block could land
+  * closer, but costs time. Plans are cached (COHERENT_CACHE_SIZE, at
+  * least SWEEP_MAX_POINTS, least recently used replaced), so a repeated
+  * sweep only runs the solver for points it did not visit before.
+  *
+  * @param  fTol: relative frequency tolerance, 0 to disable
+  * @param  u16MaxBlock: largest block size (time budget)
+  * @retval None
+  */
+void Measure_SetCoherent (double fTol, uint16_t u16MaxBlock)
+{
+	if (u16MaxBlock > SAMPLE_MAX_BLOCK_SIZE)
+		u16MaxBlock = SAMPLE_MAX_BLOCK_SIZE;
+	gfCohTol = (fTol > 0) ? fTol : 0;
+	gu16CohMaxBlock = u16MaxBlock;
+	Measure_SetFreq(gfFreq);
+}
+
+/**
+  * @brief Selects the detector: integer bin Goertzel, or generalized
+  * Goertzel at the exact (fractional) excitation bin
+  *
+  * @param  u8Enable: 1 for the generalized detector
+  * @retval None
+  */
+void Measure_SetGeneralized (uint8_t u8Enable)
+{
+	Goertzel_SetGeneralized(u8Enable);
+	Goertzel_Init(gu16Active, gfFreq, Sample_GetRate());
+}
+
+/**
+  * @brief Selects the window (Windowing_Select). The Goertzel is set up
+  * again, as the harmonics it skips depend on the window main lobe.
+  *
+  * @param  u8Type: WINDOW_xxx
+  * @param  fBeta: Kaiser beta, ignored for other windows
+  * @retval 0 if OK, -1 if unknown window
+  */
+int Measure_SetWindow (uint8_t u8Type, float fBeta)
+{
+	if (Windowing_Select(u8Type, fBeta) != 0)
+		return -1;
+	Goertzel_Init(gu16Active, gfFreq, Sample_GetRate());
+	return 0;
+}
+
+/**
+  * @brief Harmonic detection: the first u8Count harmonics are measured in
+  * the same Goertzel pass as the fundamental, so every Measure_Z also
+  * reports both channels THD and the impedance at each harmonic
+  * (Measure_GetHarmonics). Costs a resonator update per sample and
+  * harmonic, only in Measure_Vectors: settling, level control
+  * (AutoLevel), burst, decimated and multi-tone measurements run the
+  * fundamental alone. Harmonics within
+  * the window main lobe of DC or the fundamental are skipped.
+  *
+  * @param  u8Count: harmonics above the fundamental, 0 to disable, up to GOERTZEL_MAX_HARMONICS
+  * @retval None
+  */
+void Measure_SetHarmonics (uint8_t u8Count)
+{
+	Goertzel_SetHarmonics(u8Count);
+	Goertzel_Init(gu16Active, gfFreq, Sample_GetRate());
+}
+
+/**
+  * @brief Returns the harmonics of the last Measure_Z
+  *
+  * @param  pHarm: returns THD and harmonic impedances
+  * @retval None
+  */
+void Measure_GetHarmonics (TMEASURE_HARMONICS *pHarm)
+{
+	*pHarm = gtHarm;
+}
+
+/**
+  * @brief Selects the acquisition mode (SAMPLE_MODE_xxx) and the
+  * oversampling (2^n conversions per sample). Coherent plans depend on the
+  * sampling rate, so the plan cache is dropped, the block size is limited
+  * to what fits the arena, and the measurement frequency is set again.
+  * The channel calibration is kept per mode (calib.c).
+  *
+  * @param  u8Mode: SAMPLE_MODE_xxx
+  * @param  u8Oversampling: n, up to SAMPLE_MAX_OVERSAMPLING
+  * @retval None
+  */
+void Measure_SetSampleMode (uint8_t u8Mode, uint8_t u8Oversampling)
+{
+	if ((u8Mode >= SAMPLE_NUM_MODES) || (u8Oversampling > SAMPLE_MAX_OVERSAMPLING))
+		return;
+	if ((u8Mode == Sample_GetMode()) && (u8Oversampling == Sample_GetOversampling()))
+		return;
+	Sample_SetMode(u8Mode);
+	Sample_SetOversampling(u8Oversampling);
+	Coherent_ClearCache();
+	if (gu16BlockSize > Sample_GetMaxBlockSize())
+		gu16BlockSize = Sample_GetMaxBlockSize();
+	gu16Active = 0;
+	Measure_SetFreq(gfFreq);
+}
+
+/**
+  * @brief Sets the excitation dither (SigGen_SetDither) and rebuilds the
+  * table at the measurement frequency
+  *
+  * @param  u8Lsb: DAC LSB peak, 0 for none
+  * @retval None
+  */
+void Measure_SetDither (uint8_t u8Lsb)
+{
+	if (u8Lsb == SigGen_GetDither())
+		return;
+	SigGen_SetDither(u8Lsb);
+	Measure_SetFreq(gfFreq);
+}
+
+/**
+  * @brief Returns the coherent plan of the current frequency
+  *
+  * @param  pfTol: returns the tolerance, 0 if coherent mode is off
+  * @param  pPlan: returns the plan (i8Status COHERENT_NOT_FOUND if the
+  *         frequency was measured non coherently)
+  * @retval None
+  */
+void Measure_GetCoherent (double *pfTol, TCOHERENT_PLAN *pPlan)
+{
+	if (pfTol)
+		*pfTol = gfCohTol;
+	if (pPlan)
+		*pPlan = gtPlan;
+}
+
+/**
+  * @brief Sets the measurement frequency: generator and detector.
+  * The generator hops without stopping whenever it can, then the settling
+  * monitor waits only as long as the DUT needs (see Measure_GetFlags and
+  * Measure_GetSettleUs).
+  * Above the Nyquist frequency the signal is undersampled and detected at
+  * its alias (Goertzel_Init); the coherent plan is then always used, with
+  * at least ALIAS_TOL, to place the alias exactly on a bin clear of DC,
+  * fs/2 and the folded DAC images.
+  *
+  * @param  fFreq: requested frequency (Hz)
+  * @retval Actual frequency (Hz)
+  */
+double Measure_SetFreq (double fFreq)
+{
+	double fTol = gfCohTol;
+
+	if ((fTol <= 0) && ((2.0*fFreq) > Sample_GetRate()))
+		fTol = ALIAS_TOL;
+
+	gtPlan.i8Status = COHERENT_NOT_FOUND;
+	if ((fTol > 0) && (Coherent_Lookup(fFreq, fTol, gu16BlockSize, gu16CohMaxBlock, &gtPlan) == COHERENT_OK))
+	{
+		ApplyBlockSize(gtPlan.u16BlockSize);
+		gfFreq = SigGen_SetTable(gtPlan.u32Divider, gtPlan.u16TableLen, gtPlan.u16Cycles);
+	}
+	else
+	{
+		ApplyBlockSize(gu16BlockSize);
+		gfFreq = SigGen_Hop(fFreq);
+	}
+	Goertzel_Init(gu16Active, gfFreq, Sample_GetRate());
+	gcCorr = Calib_GetCorrection(gfFreq);
+
+	/* Let the DUT settle, measures the excitation frequency */
+	Settle(NULL);
+	AutoLevel();
+
+	return gfTrueFreq;
+}
+
+/**
+  * @brief Returns the actual measurement frequency: the excitation
+  * frequency measured on the samples when it departs from the generator
+  * setting (ADC and DAC clock mismatch), the generator setting otherwise.
+  * Measured once per frequency change, so it costs nothing per measurement.
+  * For reports and the L/C conversion only: save and restore the
+  * frequency with Measure_GetGenFreq.
+  *
+  * @param  None
+  * @retval Frequency (Hz)
+  */
+double Measure_GetFreq (void)
+{
+	return gfTrueFreq;
+}
+
+/**
+  * @brief Returns the generator setting for the current frequency: the
+  * value to pass back to Measure_SetFreq to restore it (the measured
+  * frequency would move it by the clock offset each time)
+  *
+  * @param  None
+  * @retval Frequency (Hz)
+  */
+double Measure_GetGenFreq (void)
+{
+	return gfFreq;
+}
+
+/**
+  * @brief Returns the last measured offset of the excitation frequency
+  * from the generator setting, whether it was applied or not
+  *
+  * @param  None
+  * @retval Offset (Hz)
+  */
+double Measure_GetFreqOffset (void)
+{
+	return gfFreqOffset;
+}
+
+/**
+  * @brief Returns the channel mismatch correction at the current
+  * frequency, the factor Measure_Z applies to vm
+  *
+  * @param  None
+  * @retval Correction
+  */
+complex double Measure_GetCorrection (void)
+{
+	return gcCorr;
+}
+
+/**
+  * @brief Returns the flags of the last measurement
+  *
+  * @param  None
+  * @retval MEASURE_FLAG_xxx
+  */
+uint8_t Measure_GetFlags (void)
+{
+	return gu8Flags;
+}
+
+/**
+  * @brief Returns the time taken to settle after the last frequency change
+  *
+  * @param  None
+  * @retval Settling time (us)
+  */
+uint32_t Measure_GetSettleUs (void)
+{
+	return gu32SettleUs;
+}
+
+/**
+  * @brief Enables the automatic excitation level control. When disabled
+  * the level set with SigGen_SetLevel is kept.
+  *
+  * @param  u8Enable: 1 to enable
+  * @retval None
+  */
+void Measure_SetAutoLevel (uint8_t u8Enable)
+{
+	gu8AutoLevel = u8Enable;
+	if (u8Enable)
+		AutoLevel();
+}
+
+/**
+  * @brief Returns the automatic excitation level control state
+  *
+  * @param  None
+  * @retval 1 if enabled
+  */
+uint8_t Measure_GetAutoLevel (void)
+{
+	return gu8AutoLevel;
+}
+
+/**
+  * @brief Perform measurements. The only path that runs the harmonic
+  * resonators (Measure_SetHarmonics).
+  *
+  * @param  None
+  * @retval None
+  */
+void Measure_Vectors (complex double *pvect_ch1, complex double *pvect_ch2)
+{
+	uint16_t *ch1 = gArenaSram.tu16Ch1;
+	uint16_t *ch2 = gArenaSram.tu16Ch2;
+	complex double vect_ch1, vect_ch2;
+
+	/* Sampling */
+	Sample_Take(ch1, ch2);
+
+	/* Signal processing */
+	Windowing_Calc(ch1);
+	Windowing_Calc(ch2);
+	Goertzel_CalcHarmonics(ch1, &vect_ch1);
+	if (Goertzel_GetHarmonicCount())
+		Goertzel_GetHarmonics(gtHarmVr);
+	Goertzel_CalcHarmonics(ch2, &vect_ch2);
+	if (Goertzel_GetHarmonicCount())
+		gu8HarmMask = Goertzel_GetHarmonics(gtHarmVm);
+
+	if (pvect_ch1)
+		*pvect_ch1 = vect_ch1;
+	if (pvect_ch2)
+		*pvect_ch2 = vect_ch2;
+}
+
+/**
+  * @brief Impedance from the detector vectors of both channels:
+  * Z = R.vm/(vr-vm), MAX_Z_MAG when open (vr = vm): callers flag it.
+  * Window gain, oversampling and filter gains are common to both
+  * channels and cancel.
+  *
+  * @param  vr: reference channel vector
+  * @param  vm: DUT channel vector, corrected
+  * @retval Impedance
+  */
+complex double Measure_CalcZ (complex double vr, complex double vm)
+{
+	if (vr==vm)
+		return MAX_Z_MAG;
+	return REFERENCE_R * vm / (vr-vm);
+}
+
+/**
+  * @brief Measures the impedance, averaging MEASURE_NUM_AVG blocks.
+  * With harmonics enabled (Measure_SetHarmonics), THD and harmonic
+  * impedances come from the same blocks.
+  * The spread of the blocks gives the SNR of both channels and the
+  * standard uncertainty of the average (Measure_GetQuality); results
+  * below MEASURE_MIN_SNR_DB get MEASURE_FLAG_LOW_CONF.
+  *
+  * @param  pZ: returns the impedance
+  * @retval None
+  */
+void Measure_Z (complex double *pZ)
+{
+	complex double vr;
+	complex double vm;
+	complex double z = 0;
+	complex double zb;
+	TQUALITY_SUM tSum;
+	complex double tCorr[GOERTZEL_MAX_HARMONICS];
+	complex double tZ[GOERTZEL_MAX_HARMONICS];
+	double tfPower[2] = {0, 0};
+	double tfHarm[2] = {0, 0};
+	uint8_t u8Count = Goertzel_GetHarmonicCount();
+	int ii, hh;
+
+	for (hh = 0; hh < u8Count; hh++)
+	{
+		tCorr[hh] = Calib_GetCorrection((hh+2)*gfFreq);
+		tZ[hh] = 0;
+	}
+
+	memset(&tSum, 0, sizeof(tSum));
+	gu8Flags &= ~(MEASURE_FLAG_CLIPPED|MEASURE_FLAG_LOW_CONF);
+	for (ii = 0; ii < MEASURE_NUM_AVG; ii++)
+	{
+		Measure_Vectors (&vr, &vm);
+		if (Sample_GetClip())
+			gu8Flags |= MEASURE_FLAG_CLIPPED;
+		/* Derives impedance */
+		if (vr == vm * gcCorr)
+			gu8Flags |= MEASURE_FLAG_LOW_CONF;
+		zb = Measure_CalcZ(vr, vm * gcCorr);
+		QualityAdd(&tSum, zb, vr, vm);
+		z += zb;
+
+		/* Harmonics: powers summed over the blocks */
+		if (u8Count == 0)
+			continue;
+		tfPower[0] += CNorm(vr);
+		tfPower[1] += CNorm(vm);
+		for (hh = 0; hh < u8Count; hh++)
+		{
+			if (!(gu8HarmMask & (1 << hh)))
+				continue;
+			tfHarm[0] += CNorm(gtHarmVr[hh]);
+			tfHarm[1] += CNorm(gtHarmVm[hh]);
+			tZ[hh] += Measure_CalcZ(gtHarmVr[hh], gtHarmVm[hh] * tCorr[hh]);
+		}
+	}
+	z = z / (double)MEASURE_NUM_AVG;
+	gu8Flags |= QualityGet(&tSum, &gtQuality);
+
+	gtHarm.u8Count = u8Count;
+	gtHarm.u8Mask = u8Count ? gu8HarmMask : 0;
+	gtHarm.fThd1 = (tfPower[0] > 0) ? (float)(100.0*sqrt(tfHarm[0]/tfPower[0])) : 0;
+	gtHarm.fThd2 = (tfPower[1] > 0) ? (float)(100.0*sqrt(tfHarm[1]/tfPower[1])) : 0;
+	for (hh = 0; hh < u8Count; hh++)
+		gtHarm.tZ[hh] = (complex float)(tZ[hh] / (double)MEASURE_NUM_AVG);
+
+	/* Outputs the value */
+	if (pZ)
+		*pZ = z;
+}
+
+/**
+  * @brief Returns the SNR and the uncertainty of the last Measure_Z,
+  * Measure_Burst or Measure_ZDecimated. Uncertainties are -1 when the
+  * measurement had fewer than two blocks.
+  *
+  * @param  pQuality: returns the estimates
+  * @retval None
+  */
+void Measure_GetQuality (TMEASURE_QUALITY *pQuality)
+{
+	*pQuality = gtQuality;
+}
+
+/**
+  * @brief Impedance at the measurement frequency from the decimated stream
+  * (decimate.c): long integrations and low frequencies in constant memory.
+  * Sets the flags as Measure_Z. The quality (Measure_GetQuality) is an
+  * estimate from the spread of the unwindowed segment sums
+  * (Decimate_GetSegments): SNR per segment, uncertainty of their mean.
+  *
+  * @param  u16Factor: decimation factor, DECIMATE_MIN_FACTOR to DECIMATE_MAX_FACTOR
+  * @param  u32Samples: decimated samples integrated
+  * @param  pZ: returns the impedance
+  * @retval DECIMATE_xxx status
+  */
+int Measure_ZDecimated (uint16_t u16Factor, uint32_t u32Samples, complex double *pZ)
+{
+	complex double vr, vm;
+	complex double tVr[DECIMATE_SEGMENTS];
+	complex double tVm[DECIMATE_SEGMENTS];
+	TQUALITY_SUM tSum;
+	uint8_t u8Segs, ii;
+	int iStatus;
+
+	iStatus = Decimate_Measure(u16Factor, gfFreq, u32Samples, &vr, &vm);
+	gu8Flags &= ~(MEASURE_FLAG_CLIPPED|MEASURE_FLAG_LOW_CONF);
+	if (Sample_GetClip())
+		gu8Flags |= MEASURE_FLAG_CLIPPED;
+	if (iStatus != DECIMATE_OK)
+		return iStatus;
+
+	if (vr == vm * gcCorr)
+		gu8Flags |= MEASURE_FLAG_LOW_CONF;
+	*pZ = Measure_CalcZ(vr, vm * gcCorr);
+
+	memset(&tSum, 0, sizeof(tSum));
+	u8Segs = Decimate_GetSegments(tVr, tVm);
+	for (ii = 0; ii < u8Segs; ii++)
+		QualityAdd(&tSum, Measure_CalcZ(tVr[ii], tVm[ii] * gcCorr), tVr[ii], tVm[ii]);
+	gu8Flags |= QualityGet(&tSum, &gtQuality);
+	return iStatus;
+}
+
+/**
+  * @brief Burst measurement: captures up to u16Blocks back to back blocks
+  * at full rate in one transfer (Sample_BurstTake), then runs the fused
+  * kernel (Goertzel_CalcDual) on the dual ADC words of every block:
+  * deinterleave, window and Goertzel of both channels in one pass. The impedance of each block is kept, so
+  * results can be sent afterwards at the host pace. Sets the flags as
+  * Measure_Z; the quality (Measure_GetQuality) is that of the mean of
+  * the blocks.
+  *
+  * @param  u16Blocks: blocks requested, up to MEASURE_BURST_MAX_BLOCKS
+  * @param  tZ: returns the impedance of each block
+  * @param  pStats: returns the capture and processing times
+  * @retval Blocks measured
+  */
+uint16_t Measure_Burst (uint16_t u16Blocks, complex float tZ[], TBURST_STATS *pStats)
+{
+	const float *pfWindow = Windowing_GetTable();
+	complex double vr, vm;
+	complex double z;
+	TQUALITY_SUM tSum;
+	uint32_t u32Start;
+	uint16_t ii;
+
+	if (u16Blocks > MEASURE_BURST_MAX_BLOCKS)
+		u16Blocks = MEASURE_BURST_MAX_BLOCKS;
+	u16Blocks = Sample_BurstTake(u16Blocks);
+	gu8Flags &= ~(MEASURE_FLAG_CLIPPED|MEASURE_FLAG_LOW_CONF);
+	if (Sample_GetClip())
+		gu8Flags |= MEASURE_FLAG_CLIPPED;
+
+	memset(&tSum, 0, sizeof(tSum));
+	u32Start = DWT->CYCCNT;
+	for (ii = 0; ii < u16Blocks; ii++)
+	{
+		Goertzel_CalcDual(Sample_GetBurstBlock(ii), pfWindow, &vr, &vm);
+		if (vr == vm * gcCorr)
+			gu8Flags |= MEASURE_FLAG_LOW_CONF;
+		z = Measure_CalcZ(vr, vm * gcCorr);
+		QualityAdd(&tSum, z, vr, vm);
+		tZ[ii] = (complex float)z;
+	}
+	gu8Flags |= QualityGet(&tSum, &gtQuality);
+
+	pStats->u16Blocks = u16Blocks;
+	pStats->u16BlockSize = gu16Active;
+	pStats->u32ProcessUs = (DWT->CYCCNT - u32Start)/(SystemCoreClock/1000000);
+	pStats->u32CaptureUs = Sample_GetBurstCycles()/(SystemCoreClock/1000000);
+	pStats->u32ExpectedUs = (uint32_t)((1e6*u16Blocks*gu16Active)/Sample_GetRate() + 0.5);
+	return u16Blocks;
+}
+
+/**
+  * @brief Frequency sweep. Measurement frequency is left at the last point.
+  *
+  * @param  fStart: start frequency (Hz)
+  * @param  fStop: stop frequency (Hz)
+  * @param  u16Points: number of points, up to SWEEP_MAX_POINTS
+  * @param  u8Log: 1 for logarithmic spacing, 0 for linear
+  * @param  tPoints: returns the measured points
+  * @retval Number of points measured
+  */
+uint16_t Measure_Sweep (double fStart, double fStop, uint16_t u16Points, uint8_t u8Log, TSWEEP_POINT tPoints[])
+{
+	complex double z;
+	uint16_t ii;
+
+	if (u16Points > SWEEP_MAX_POINTS)
+		u16Points = SWEEP_MAX_POINTS;
+	if (u16Points < 2)
+		u16Points = 2;
+	if (u8Log && ((fStart <= 0) || (fStop <= 0)))
+		u8Log = 0;
+
+	for (ii = 0; ii < u16Points; ii++)
+	{
+		double fFreq;
+
+		if (u8Log)
+			fFreq = fStart*pow(fStop/fStart, (double)ii/(double)(u16Points-1));
+		else
+			fFreq = fStart + ((fStop-fStart)*ii)/(double)(u16Points-1);
+
+		fFreq = Measure_SetFreq(fFreq);
+		Measure_Z(&z);
+		Measure_SetPoint(&tPoints[ii], fFreq, z, gu8Flags, &gtQuality);
+	}
+	return u16Points;
+}
+
+/**
+  * @brief Fills a sweep point, SNR rounded to whole dB
+  *
+  * @param  pPoint: point to fill
+  * @param  fFreq: frequency (Hz)
+  * @param  z: impedance
+  * @param  u8Flags: MEASURE_FLAG_xxx
+  * @param  pQuality: SNR and uncertainty (Measure_GetQuality)
+  * @retval None
+  */
+void Measure_SetPoint (TSWEEP_POINT *pPoint, double fFreq, complex double z, uint8_t u8Flags,
+		const TMEASURE_QUALITY *pQuality)
+{
+	float tfSnr[2];
+	int8_t ti8Snr[2];
+	int ii;
+
+	tfSnr[0] = pQuality->fSnr1;
+	tfSnr[1] = pQuality->fSnr2;
+	for (ii = 0; ii < 2; ii++)
+	{
+		if (tfSnr[ii] > 127.0f)
+			tfSnr[ii] = 127.0f;
+		if (tfSnr[ii] < -127.0f)
+			tfSnr[ii] = -127.0f;
+		ti8Snr[ii] = (int8_t)((tfSnr[ii] >= 0) ? tfSnr[ii] + 0.5f : tfSnr[ii] - 0.5f);
+	}
+	pPoint->fFreq = (float)fFreq;
+	pPoint->z = (complex float)z;
+	pPoint->fUncMag = pQuality->fUncMag;
+	pPoint->fUncPhase = pQuality->fUncPhase;
+	pPoint->u8Flags = u8Flags;
+	pPoint->i8Snr1 = ti8Snr[0];
+	pPoint->i8Snr2 = ti8Snr[1];
+}
+
+/**
+  * @brief Multi-tone measurement: all the tones are excited at once and
+  * measured from the same blocks, so the whole set takes the time of a
+  * single point. Tones are rounded to ADC bins (Sample_GetRate()/block size
+  * spacing) and kept distinct; use a rectangular window for tones closer
+  * than the window main lobe. Each point carries the quality and
+  * MEASURE_FLAG_LOW_CONF of its own tone. Single tone excitation is
+  * restored at the end.
+  *
+  * @param  fStart: lowest tone (Hz)
+  * @param  fStop: highest tone (Hz)
+  * @param  u8Tones: number of tones, up to SIGGEN_MAX_TONES
+  * @param  u8Log: 1 for logarithmic spacing, 0 for linear
+  * @param  tPoints: returns the measured points
+  * @retval Number of points measured, 0 on error
+  */
+uint8_t Measure_MultiTone (double fStart, double fStop, uint8_t u8Tones, uint8_t u8Log, TSWEEP_POINT tPoints[])
+{
+	uint16_t tu16Bins[SIGGEN_MAX_TONES];
+	complex double tVr[SIGGEN_MAX_TONES];
+	complex double tVm[SIGGEN_MAX_TONES];
+	complex double tZ[SIGGEN_MAX_TONES];
+	complex double tCorr[SIGGEN_MAX_TONES];
+	TMEASURE_QUALITY tQuality;
+	uint16_t *ch1 = gArenaSram.tu16Ch1;
+	uint16_t *ch2 = gArenaSram.tu16Ch2;
+	uint8_t u8Count = 0;
+	uint8_t tu8Flags[SIGGEN_MAX_TONES];
+	uint8_t u8Low = 0;
+	int ii, mm;
+
+	if (u8Tones > SIGGEN_MAX_TONES)
+		u8Tones = SIGGEN_MAX_TONES;
+	if (u8Tones < 2)
+		u8Tones = 2;
+	if (u8Log && ((fStart <= 0) || (fStop <= 0)))
+		u8Log = 0;
+
+	/* Tones to distinct bins, increasing */
+	for (mm = 0; mm < u8Tones; mm++)
+	{
+		double fFreq;
+		int iBin;
+
+		if (u8Log)
+			fFreq = fStart*pow(fStop/fStart, (double)mm/(double)(u8Tones-1));
+		else
+			fFreq = fStart + ((fStop-fStart)*mm)/(double)(u8Tones-1);
+
+		iBin = (int)((fFreq*gu16BlockSize)/Sample_GetRate() + 0.5);
+		if ((u8Count > 0) && (iBin <= tu16Bins[u8Count-1]))
+			iBin = tu16Bins[u8Count-1] + 1;
+		if (iBin < 1)
+			iBin = 1;
+		if (iBin >= gu16BlockSize/2)
+			break;
+		tu16Bins[u8Count++] = (uint16_t)iBin;
+	}
+	if (u8Count == 0)
+		return 0;
+
+	ApplyBlockSize(gu16BlockSize);
+	Goertzel_Init(gu16BlockSize, gfFreq, Sample_GetRate());
+	if (SigGen_SetMultiTone(tu16Bins, u8Count, gu16BlockSize) != 0)
+	{
+		Measure_SetFreq(gfFreq);
+		return 0;
+	}
+	/* Lowest tone usually settles last */
+	Settle(&tu16Bins[0]);
+
+	for (mm = 0; mm < u8Count; mm++)
+	{
+		tZ[mm] = 0;
+		tu8Flags[mm] = 0;
+		tCorr[mm] = Calib_GetCorrection(((double)tu16Bins[mm]*Sample_GetRate())/gu16BlockSize);
+	}
+	memset(gtToneSum, 0, sizeof(gtToneSum));
+	gu8Flags &= ~(MEASURE_FLAG_CLIPPED|MEASURE_FLAG_LOW_CONF);
+	for (ii = 0; ii < MEASURE_NUM_AVG; ii++)
+	{
+		Sample_Take(ch1, ch2);
+		if (Sample_GetClip())
+			gu8Flags |= MEASURE_FLAG_CLIPPED;
+		Windowing_Calc(ch1);
+		Windowing_Calc(ch2);
+		Goertzel_CalcMulti(ch1, tu16Bins, u8Count, tVr);
+		Goertzel_CalcMulti(ch2, tu16Bins, u8Count, tVm);
+
+		for (mm = 0; mm < u8Count; mm++)
+		{
+			complex double z = Measure_CalcZ(tVr[mm], tVm[mm] * tCorr[mm]);
+
+			if (tVr[mm] == tVm[mm] * tCorr[mm])
+				tu8Flags[mm] |= MEASURE_FLAG_LOW_CONF;
+			QualityAdd(&gtToneSum[mm], z, tVr[mm], tVm[mm]);
+			tZ[mm] += z;
+		}
+	}
+	for (mm = 0; mm < u8Count; mm++)
+	{
+		tu8Flags[mm] |= QualityGet(&gtToneSum[mm], &tQuality);
+		u8Low |= tu8Flags[mm];
+		Measure_SetPoint(&tPoints[mm], ((double)tu16Bins[mm]*Sample_GetRate())/gu16BlockSize,
+				tZ[mm] / (double)MEASURE_NUM_AVG, gu8Flags | tu8Flags[mm], &tQuality);
+	}
+	gu8Flags |= u8Low;
+
+	/* Back to single tone */
+	Measure_SetFreq(gfFreq);
+
+	return u8Count;
+}
+
+/**
+  * @brief Settling monitor. Waits the generator estimate, then takes
+  * consecutive blocks until the vm/vr phasor changes less than SETTLE_TOL
+  * for SETTLE_HITS blocks. The change is relative to max(|r|,|1-r|), so it
+  * works from short to open. Sets MEASURE_FLAG_UNSETTLED after
+  * SETTLE_MAX_BLOCKS and records the time taken.
+  * At the measurement frequency the raw samples of the reference channel
+  * also feed the frequency estimator (Goertzel_FreqOffset). The last
+  * FREQ_EST_BLOCKS estimates are averaged, and the result replaces the
+  * generator frequency only when it is significant against both their
+  * spread and FREQ_EST_MIN_REL: with ADC and DAC on the same clock the
+  * divider derived frequency is exact.
+  *
+  * @param  pu16Bin: ADC bin to monitor, NULL for the measurement frequency
+  * @retval None
+  */
+static void Settle (const uint16_t *pu16Bin)
+{
+	uint16_t *ch1 = gArenaSram.tu16Ch1;
+	uint16_t *ch2 = gArenaSram.tu16Ch2;
+	uint32_t u32Us = SigGen_GetSettleUs();
+	uint32_t u32Start = DWT->CYCCNT;
+	complex double vr, vm, r;
+	complex double rPrev = 0;
+	double tfOffset[FREQ_EST_BLOCKS];
+	uint8_t u8Est = 0;
+	uint8_t u8Hits = 0;
+	int ii;
+
+	/* Generator */
+	if (u32Us >= 1000)
+	{
+		Delay((u32Us+999)/1000);
+	}
+	else
+	{
+		uint32_t u32Cycles = u32Us*(SystemCoreClock/1000000);
+
+		while ((DWT->CYCCNT - u32Start) < u32Cycles)
+		{;}
+	}
+
+	/* DUT and fixture */
+	for (ii = 0; ii < SETTLE_MAX_BLOCKS; ii++)
+	{
+		if (pu16Bin == NULL)
+		{
+			Sample_Take(ch1, ch2);
+			if (Goertzel_FreqOffset(ch1, gfFreq, Sample_GetRate(), &tfOffset[u8Est % FREQ_EST_BLOCKS]) == 0)
+				u8Est++;
+			Windowing_Calc(ch1);
+			Windowing_Calc(ch2);
+			Goertzel_Calc(ch1, &vr);
+			Goertzel_Calc(ch2, &vm);
+		}
+		else
+		{
+			Sample_Take(ch1, ch2);
+			Windowing_Calc(ch1);
+			Windowing_Calc(ch2);
+			Goertzel_CalcMulti(ch1, pu16Bin, 1, &vr);
+			Goertzel_CalcMulti(ch2, pu16Bin, 1, &vm);
+		}
+		if (vr == 0)
+			continue;
+		r = vm / vr;
+
+		if ((ii > 0) && (CAbs(r - rPrev) <= SETTLE_TOL*fmax(CAbs(r), CAbs(1.0 - r))))
+		{
+			if (++u8Hits >= SETTLE_HITS)
+				break;
+		}
+		else
+		{
+			u8Hits = 0;
+		}
+		rPrev = r;
+	}
+
+	if (u8Hits >= SETTLE_HITS)
+		gu8Flags &= ~MEASURE_FLAG_UNSETTLED;
+	else
+		gu8Flags |= MEASURE_FLAG_UNSETTLED;
+	gu32SettleUs = (DWT->CYCCNT - u32Start)/(SystemCoreClock/1000000);
+
+	/* Excitation frequency */
+	if (pu16Bin == NULL)
+	{
+		gfTrueFreq = gfFreq;
+		gfFreqOffset = 0;
+		if (u8Est >= FREQ_EST_BLOCKS)
+		{
+			double fMin = tfOffset[0];
+			double fMax = tfOffset[0];
+			double fSum = 0;
+
+			for (ii = 0; ii < FREQ_EST_BLOCKS; ii++)
+			{
+				fSum += tfOffset[ii];
+				fMin = fmin(fMin, tfOffset[ii]);
+				fMax = fmax(fMax, tfOffset[ii]);
+			}
+			gfFreqOffset = fSum/FREQ_EST_BLOCKS;
+			if (fabs(gfFreqOffset) > fmax(3.0*(fMax - fMin), FREQ_EST_MIN_REL*gfFreq))
+				gfTrueFreq = gfFreq + gfFreqOffset;
+		}
+	}
+}
+
+/**
+  * @brief Excitation level control loop. Keeps the largest channel peak
+  * between LEVEL_LOW and LEVEL_HIGH ADC counts: halves the level on
+  * clipping, otherwise scales it towards LEVEL_TARGET. The peak comes from
+  * the fundamental Goertzel vectors (2|X|/(N*CG)), without the harmonic
+  * resonators, so it costs no extra pass over the samples. Sets MEASURE_FLAG_LOW_LEVEL when full excitation is not
+  * enough. Level changes are hops: the output is never stopped.
+  *
+  * @param  None
+  * @retval None
+  */
+static void AutoLevel (void)
+{
+	uint16_t *ch1 = gArenaSram.tu16Ch1;
+	uint16_t *ch2 = gArenaSram.tu16Ch2;
+	complex double vr, vm;
+	double fScale = 2.0/(gu16Active*Windowing_GetCoherentGain()*(1 << Sample_GetOversampling()));
+	double fPeak = LEVEL_TARGET;
+	float fLevel;
+	float fOld;
+	int ii;
+
+	gu8Flags &= ~MEASURE_FLAG_LOW_LEVEL;
+	if (!gu8AutoLevel)
+		return;
+
+	for (ii = 0; ii < LEVEL_MAX_ITER; ii++)
+	{
+		/* Fundamental only, as Settle */
+		Sample_Take(ch1, ch2);
+		Windowing_Calc(ch1);
+		Windowing_Calc(ch2);
+		Goertzel_Calc(ch1, &vr);
+		Goertzel_Calc(ch2, &vm);
+		fPeak = fScale*fmax(CAbs(vr), CAbs(vm));
+		fOld = SigGen_GetLevel();
+		fLevel = fOld;
+
+		if (Sample_GetClip())
+			fLevel *= 0.5f;
+		else if ((fPeak < LEVEL_LOW) || (fPeak > LEVEL_HIGH))
+			fLevel *= (float)(LEVEL_TARGET/fmax(fPeak, 1.0));
+		else
+			break;
+
+		if (SigGen_SetLevel(fLevel) == fOld)
+			break;			/* Limited */
+		Settle(NULL);
+	}
+
+	if ((fPeak < LEVEL_LOW) && (SigGen_GetLevel() >= SIGGEN_MAX_LEVEL))
+		gu8Flags |= MEASURE_FLAG_LOW_LEVEL;
+}
+
+/**
+  * @brief Sets the block size the acquisition and the window run with.
+  * Only reconfigures when it changes; the caller sets the Goertzel bin.
+  *
+  * @param  u16BlockSize: samples per block
+  * @retval None
+  */
+static void ApplyBlockSize (uint16_t u16BlockSize)
+{
+	if (u16BlockSize == gu16Active)
+		return;
+	gu16Active = u16BlockSize;
+	Sample_Init(u16BlockSize);
+	Windowing_Init(u16BlockSize);
+}
+
+/**
+  * @brief Adds a result to the quality sums. Blocks start at an
+  * arbitrary phase of the excitation (the ADC is not locked to the DAC),
+  * so the channel vectors are taken in the phase of vr: |vr| and
+  * vm.conj(vr)/|vr|. The spread of vr is then its amplitude noise, that
+  * of vm includes the noise of the phase between the channels.
+  *
+  * @param  pSum: running sums, zeroed before the first result
+  * @param  z: impedance
+  * @param  vr: reference channel vector
+  * @param  vm: DUT channel vector
+  * @retval None
+  */
+static void QualityAdd (TQUALITY_SUM *pSum, complex double z, complex double vr, complex double vm)
+{
+	complex double tD[3];
+	complex double cRef;
+	double fAbs = CAbs(vr);
+	int ii;
+
+	if (fAbs > 0)
+	{
+		__real__ cRef = __real__ vr / fAbs;
+		__imag__ cRef = -__imag__ vr / fAbs;
+		vm *= cRef;
+		vr = fAbs;
+	}
+	if (pSum->u16Count == 0)
+	{
+		pSum->tShift[0] = z;
+		pSum->tShift[1] = vr;
+		pSum->tShift[2] = vm;
+	}
+	tD[0] = z - pSum->tShift[0];
+	tD[1] = vr - pSum->tShift[1];
+	tD[2] = vm - pSum->tShift[2];
+	for (ii = 0; ii < 3; ii++)
+		pSum->tSum[ii] += tD[ii];
+	pSum->fRR += __real__ tD[0] * __real__ tD[0];
+	pSum->fXX += __imag__ tD[0] * __imag__ tD[0];
+	pSum->fRX += __real__ tD[0] * __imag__ tD[0];
+	pSum->tfNorm[0] += CNorm(tD[1]);
+	pSum->tfNorm[1] += CNorm(tD[2]);
+	pSum->u16Count++;
+}
+
+/**
+  * @brief Quality from the sums: SNR of both channels and standard
+  * uncertainty of the mean impedance, propagated to |Z| and phase to
+  * first order. With fewer than two results the uncertainties are -1
+  * and the SNR 0.
+  *
+  * @param  pSum: running sums
+  * @param  pQuality: returns the estimates
+  * @retval MEASURE_FLAG_LOW_CONF when either SNR is below MEASURE_MIN_SNR_DB, else 0
+  */
+static uint8_t QualityGet (const TQUALITY_SUM *pSum, TMEASURE_QUALITY *pQuality)
+{
+	double fN = pSum->u16Count;
+	complex double tMean[3];
+	double fRR, fXX, fRX;
+	double fR, fX, fMag2;
+	int ii;
+
+	if (pSum->u16Count < 2)
+	{
+		pQuality->fSnr1 = 0;
+		pQuality->fSnr2 = 0;
+		pQuality->fUncR = -1;
+		pQuality->fUncX = -1;
+		pQuality->fUncMag = -1;
+		pQuality->fUncPhase = -1;
+		return 0;
+	}
+	for (ii = 0; ii < 3; ii++)
+		tMean[ii] = pSum->tSum[ii]/fN;
+
+	/* Covariance of R and X, then of their mean */
+	fRR = (pSum->fRR - fN * __real__ tMean[0] * __real__ tMean[0])/(fN*(fN-1));
+	fXX = (pSum->fXX - fN * __imag__ tMean[0] * __imag__ tMean[0])/(fN*(fN-1));
+	fRX = (pSum->fRX - fN * __real__ tMean[0] * __imag__ tMean[0])/(fN*(fN-1));
+
+	/* First order propagation to |Z| and phase */
+	fR = __real__ (pSum->tShift[0] + tMean[0]);
+	fX = __imag__ (pSum->tShift[0] + tMean[0]);
+	fMag2 = fR*fR + fX*fX;
+	pQuality->fUncR = (float)sqrt(fabs(fRR));
+	pQuality->fUncX = (float)sqrt(fabs(fXX));
+	pQuality->fUncMag = 0;
+	pQuality->fUncPhase = 0;
+	if (fMag2 > 0)
+	{
+		pQuality->fUncMag = (float)sqrt(fabs(fR*fR*fRR + fX*fX*fXX + 2.0*fR*fX*fRX)/fMag2);
+		pQuality->fUncPhase = (float)RAD2DEG(sqrt(fabs(fX*fX*fRR + fR*fR*fXX - 2.0*fR*fX*fRX))/fMag2);
+	}
+	pQuality->fSnr1 = Snr(pSum->tShift[1] + tMean[1], (pSum->tfNorm[0] - fN*CNorm(tMean[1]))/(fN-1));
+	pQuality->fSnr2 = Snr(pSum->tShift[2] + tMean[2], (pSum->tfNorm[1] - fN*CNorm(tMean[2]))/(fN-1));
+	if ((pQuality->fSnr1 < MEASURE_MIN_SNR_DB) || (pQuality->fSnr2 < MEASURE_MIN_SNR_DB))
+		return MEASURE_FLAG_LOW_CONF;
+	return 0;
+}
+
+/**
+  * @brief SNR of a channel: power of the mean vector over the variance
+  * of the vectors around it. Slow drifts count as noise.
+  *
+  * @param  cMean: mean vector
+  * @param  fVar: variance of the vectors
+  * @retval SNR (dB), up to MEASURE_MAX_SNR_DB
+  */
+static float Snr (complex double cMean, double fVar)
+{
+	double fSnr;
+
+	if (fVar <= 0)
+		return (float)MEASURE_MAX_SNR_DB;
+	if (CNorm(cMean) <= 0)
+		return (float)-MEASURE_MAX_SNR_DB;
+	fSnr = 10.0*log10(CNorm(cMean)/fVar);
+	if (fSnr > MEASURE_MAX_SNR_DB)
+		fSnr = MEASURE_MAX_SNR_DB;
+	return (float)fSnr;
+}
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
@@ -0,0 +1,116 @@
+/**
+  ******************************************************************************
+  * @file    measure.h
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Impedance measurement engine
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __MEASURE_H__
+#define __MEASURE_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include <math.h>
+
+#include "stm32f4xx.h"
+#include "complex.h"
+#include "coherent.h"
+#include "goertzel.h"
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+	float fFreq;			/* Actual frequency (Hz) */
+	complex float z;		/* Impedance (ohm) */
+	float fUncMag;			/* Standard uncertainty of |Z| (ohm), -1 unknown */
+	float fUncPhase;		/* (deg) */
+	uint8_t u8Flags;		/* MEASURE_FLAG_xxx */
+	int8_t i8Snr1;			/* Block SNR (dB), clamped to +-127 */
+	int8_t i8Snr2;
+} TSWEEP_POINT;
+
+typedef struct
+{
+	uint16_t u16Blocks;		/* Blocks captured */
+	uint16_t u16BlockSize;	/* Samples per block */
+	uint32_t u32CaptureUs;	/* Measured capture time */
+	uint32_t u32ExpectedUs;	/* Blocks x N / fs: equal to the capture time when gap free */
+	uint32_t u32ProcessUs;	/* Bulk processing time, all blocks */
+} TBURST_STATS;
+
+typedef struct
+{
+	uint8_t u8Count;		/* Harmonics requested above the fundamental */
+	uint8_t u8Mask;			/* Measured harmonics, bit 0 is the 2nd (Goertzel_GetHarmonics) */
+	float fThd1;			/* Total harmonic distortion of the measured harmonics (%) */
+	float fThd2;
+	complex float tZ[GOERTZEL_MAX_HARMONICS];	/* Impedance at each harmonic (ohm), index 0 is the 2nd */
+} TMEASURE_HARMONICS;
+
+typedef struct
+{
+	float fSnr1;			/* Block SNR: |mean vector|^2 over the block to block variance (dB), vectors in the phase of vr */
+	float fSnr2;
+	float fUncR;			/* Standard uncertainty of the averaged result (ohm) */
+	float fUncX;
+	float fUncMag;
+	float fUncPhase;		/* (deg) */
+} TMEASURE_QUALITY;
+
+/* Exported constants --------------------------------------------------------*/
+#define MEASURE_NUM_AVG			8			/* Blocks averaged per impedance */
+#define SWEEP_MAX_POINTS		256
+#define MEASURE_BURST_MAX_BLOCKS	1024	/* Burst results kept: 16 sample blocks fill the burst buffer */
+
+/* Measurement flags */
+#define MEASURE_FLAG_UNSETTLED	0x01		/* Phasor did not converge after a frequency change */
+#define MEASURE_FLAG_CLIPPED	0x02		/* ADC analog watchdog hit: overrange */
+#define MEASURE_FLAG_LOW_LEVEL	0x04		/* Signal below range at full excitation */
+#define MEASURE_FLAG_LOW_CONF	0x08		/* SNR below MEASURE_MIN_SNR_DB, or vr = vm (open) */
+
+#define MEASURE_MIN_SNR_DB		20.0		/* Low confidence threshold, either channel */
+#define MEASURE_MAX_SNR_DB		200.0		/* Reported when blocks are identical */
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+extern void Measure_Init (void);
+extern void Measure_Config (uint16_t u16BlockSize);
+extern uint16_t Measure_GetBlockSize (void);
+extern uint16_t Measure_GetActiveBlockSize (void);
+extern void Measure_SetCoherent (double fTol, uint16_t u16MaxBlock);
+extern void Measure_GetCoherent (double *pfTol, TCOHERENT_PLAN *pPlan);
+extern void Measure_SetGeneralized (uint8_t u8Enable);
+extern int Measure_SetWindow (uint8_t u8Type, float fBeta);
+extern void Measure_SetHarmonics (uint8_t u8Count);
+extern void Measure_GetHarmonics (TMEASURE_HARMONICS *pHarm);
+extern void Measure_SetSampleMode (uint8_t u8Mode, uint8_t u8Oversampling);
+extern void Measure_SetDither (uint8_t u8Lsb);
+extern complex double Measure_CalcZ (complex double vr, complex double vm);
+extern double Measure_SetFreq (double fFreq);
+extern double Measure_GetFreq (void);
+extern double Measure_GetGenFreq (void);
+extern double Measure_GetFreqOffset (void);
+extern complex double Measure_GetCorrection (void);
+extern uint8_t Measure_GetFlags (void);
+extern uint32_t Measure_GetSettleUs (void);
+extern void Measure_SetAutoLevel (uint8_t u8Enable);
+extern uint8_t Measure_GetAutoLevel (void);
+extern void Measure_Vectors (complex double *pvect_ch1, complex double *pvect_ch2);
+extern void Measure_Z (complex double *pZ);
+extern void Measure_GetQuality (TMEASURE_QUALITY *pQuality);
+extern int Measure_ZDecimated (uint16_t u16Factor, uint32_t u32Samples, complex double *pZ);
+extern uint16_t Measure_Burst (uint16_t u16Blocks, complex float tZ[], TBURST_STATS *pStats);
+extern uint16_t Measure_Sweep (double fStart, double fStop, uint16_t u16Points, uint8_t u8Log, TSWEEP_POINT tPoints[]);
+extern void Measure_SetPoint (TSWEEP_POINT *pPoint, double fFreq, complex double z, uint8_t u8Flags,
+		const TMEASURE_QUALITY *pQuality);
+extern uint8_t Measure_MultiTone (double fStart, double fStop, uint8_t u8Tones, uint8_t u8Log, TSWEEP_POINT tPoints[]);
+
+#endif	 /* __MEASURE_H__ */
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
@@ -16,19 +16,53 @@
 #include "stm32f4xx.h"
 #include "stm32f4_discovery.h"
 #include "sample.h"
+#include "arena.h"
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
 #define ADC_CCR_ADDRESS    ((uint32_t)0x40012308)
 
+#ifdef USE_USB_OTG_HS
+#define USB_OTG_IRQn		OTG_HS_IRQn
+#else
+#define USB_OTG_IRQn		OTG_FS_IRQn
+#endif
+
+#define LEDS_MASK			(LED3_PIN | LED4_PIN | LED5_PIN | LED6_PIN)
+#define DEINT_MIN_CYCLES	1000		/* Deinterleave DMA timeout: fixed part (CPU cycles) */
+#define DEINT_SAMPLE_CYCLES	32			/* Deinterleave DMA timeout: per sample, well above the transfer time */
+#define DEINT_ERR_FLAGS		(DMA_LISR_TEIF1 | DMA_LISR_DMEIF1 | DMA_LISR_FEIF1 | DMA_LISR_TEIF2 | DMA_LISR_DMEIF2 | DMA_LISR_FEIF2)
+#define DEINT_ALL_FLAGS		(DMA_LIFCR_CTCIF1 | DMA_LIFCR_CHTIF1 | DMA_LIFCR_CTEIF1 | DMA_LIFCR_CDMEIF1 | DMA_LIFCR_CFEIF1 \
+							| DMA_LIFCR_CTCIF2 | DMA_LIFCR_CHTIF2 | DMA_LIFCR_CTEIF2 | DMA_LIFCR_CDMEIF2 | DMA_LIFCR_CFEIF2)
+
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
 static uint16_t gu16BlockSize;
+static uint8_t gu8QuietMode = SAMPLE_QUIET_DEFAULT;
+static uint32_t gu32QuietCycles;
+static uint32_t gu32QuietStart;
+static uint16_t gu16LedsState;
+static uint8_t gu8Clip;
+static uint8_t gu8Mode = SAMPLE_MODE_NORMAL;
+static uint8_t gu8Oversampling = 0;
+static uint32_t *gpu32Ring;
+static uint16_t gu16RingHalf;
+static uint8_t gu8Overrun;
+static uint8_t gu8Deint = SAMPLE_DEINT_CPU;
+static uint32_t gu32DeintCycles;
+static uint32_t gu32BurstCycles;
 
 /* Private function prototypes -----------------------------------------------*/
 static void RCC_Configuration();
 static void GPIO_Configuration(void);
 static void LowNoiseContext (int enter);
+static void AdcStart (uint32_t tu32Buffer[], uint32_t u32Size, uint32_t u32DmaMode);
+static void AdcStop (void);
+static void DeintStart (DMA_Stream_TypeDef *pStream, uint32_t u32Src, uint16_t tu16Dst[], uint16_t u16Count);
+static int DeintWait (void);
+static void Deinterleave (const uint32_t *pu32Word, uint16_t ch1[], uint16_t ch2[]);
+static void WaitTransferComplete (void);
+static void WaitTransferCompleteRam (void) __attribute__ ((section(".RamFunc"), noinline, long_call));
 
 /* Private functions ---------------------------------------------------------*/
 
@@ -39,6 +73,8 @@ static void LowNoiseContext (int enter);
   */
 void Sample_Init (uint16_t u16BlockSize)
 {
+  	if (u16BlockSize > Sample_GetMaxBlockSize())
+  		u16BlockSize = Sample_GetMaxBlockSize();
   	gu16BlockSize = u16BlockSize;
 
   	/* System clocks configuration ---------------------------------------------*/
@@ -46,6 +82,183 @@ void Sample_Init (uint16_t u16BlockSize)
 
   	/* GPIO configuration ------------------------------------------------------*/
   	GPIO_Configuration();
+
+  	/* Cycle counter used to time the low noise window */
+  	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  	DWT->CYCCNT = 0;
+  	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+  * @brief  Selects the acquisition mode. Both keep the dual regular
+  * simultaneous conversion, so the channels stay sampled at the same
+  * instant; the fast mode shortens the sample time, which needs a lower
+  * source impedance and changes the channel mismatch (calibrate per mode).
+  *
+  * @param  u8Mode: SAMPLE_MODE_xxx
+  * @retval None
+  */
+void Sample_SetMode (uint8_t u8Mode)
+{
+	if (u8Mode < SAMPLE_NUM_MODES)
+		gu8Mode = u8Mode;
+}
+
+/**
+  * @brief  Returns the acquisition mode
+  *
+  * @retval SAMPLE_MODE_xxx
+  */
+uint8_t Sample_GetMode (void)
+{
+	return gu8Mode;
+}
+
+/**
+  * @brief  Sets the oversampling: each block sample is the sum of 2^n
+  * consecutive conversions (accumulate and dump), 12+n bits. The rate
+  * drops by 2^n and the quantization and white noise by sqrt(2^n), so
+  * the detectors get fewer samples with more resolution. Takes effect at
+  * the next Sample_Init; blocks are limited to Sample_GetMaxBlockSize.
+  *
+  * @param  u8Log2: n, up to SAMPLE_MAX_OVERSAMPLING
+  * @retval None
+  */
+void Sample_SetOversampling (uint8_t u8Log2)
+{
+	if (u8Log2 <= SAMPLE_MAX_OVERSAMPLING)
+		gu8Oversampling = u8Log2;
+}
+
+/**
+  * @brief  Returns the oversampling
+  *
+  * @retval n: 2^n conversions per sample
+  */
+uint8_t Sample_GetOversampling (void)
+{
+	return gu8Oversampling;
+}
+
+/**
+  * @brief  Returns the ADC conversion rate of the acquisition mode
+  *
+  * @retval Conversions per second
+  */
+uint32_t Sample_GetAdcRate (void)
+{
+	return (gu8Mode == SAMPLE_MODE_FAST) ? SAMPLING_RATE_FAST : SAMPLING_RATE;
+}
+
+/**
+  * @brief  Returns the sampling rate of the blocks (after oversampling)
+  *
+  * @retval Samples per second
+  */
+double Sample_GetRate (void)
+{
+	return (double)Sample_GetAdcRate()/(1 << gu8Oversampling);
+}
+
+/**
+  * @brief  Returns the APB2 clock ticks per block sample
+  *
+  * @retval Ticks (84MHz)
+  */
+uint32_t Sample_GetClockDiv (void)
+{
+	uint32_t u32Div = (gu8Mode == SAMPLE_MODE_FAST) ? SAMPLE_CLOCK_DIV_FAST : SAMPLE_CLOCK_DIV;
+
+	return u32Div << gu8Oversampling;
+}
+
+/**
+  * @brief  Returns the largest block that fits the arena with the
+  * current oversampling
+  *
+  * @retval Samples
+  */
+uint16_t Sample_GetMaxBlockSize (void)
+{
+	return SAMPLE_MAX_BLOCK_SIZE >> gu8Oversampling;
+}
+
+/**
+  * @brief  Selects how the dual ADC words are split into the channels.
+  * SAMPLE_DEINT_DMA hands the split to two DMA2 memory to memory streams
+  * (one per half word) that run while the ADC is stopped and the low
+  * noise context is left. Oversampling needs the sum, so it always uses
+  * the CPU loop.
+  *
+  * @param  u8Mode: SAMPLE_DEINT_xxx
+  * @retval None
+  */
+void Sample_SetDeinterleave (uint8_t u8Mode)
+{
+	if (u8Mode <= SAMPLE_DEINT_DMA)
+		gu8Deint = u8Mode;
+}
+
+/**
+  * @brief  Returns the deinterleave mode
+  *
+  * @retval SAMPLE_DEINT_xxx
+  */
+uint8_t Sample_GetDeinterleave (void)
+{
+	return gu8Deint;
+}
+
+/**
+  * @brief  Returns the CPU cycles the last block spent in the deinterleave:
+  * the loop, or the DMA set up plus the wait left after the overlapped work
+  *
+  * @retval cycles
+  */
+uint32_t Sample_GetDeintCycles (void)
+{
+	return gu32DeintCycles;
+}
+
+/**
+  * @brief  Selects the low noise context options used during acquisition
+  *
+  * @param  u8Mode: SAMPLE_QUIET_xxx bit mask
+  * @retval None
+  */
+void Sample_SetQuietMode (uint8_t u8Mode)
+{
+	gu8QuietMode = u8Mode & SAMPLE_QUIET_ALL;
+}
+
+/**
+  * @brief  Returns the active low noise context options
+  *
+  * @retval SAMPLE_QUIET_xxx bit mask
+  */
+uint8_t Sample_GetQuietMode (void)
+{
+	return gu8QuietMode;
+}
+
+/**
+  * @brief  Returns the duration of the last low noise window in CPU cycles
+  *
+  * @retval cycles
+  */
+uint32_t Sample_GetQuietCycles (void)
+{
+	return gu32QuietCycles;
+}
+
+/**
+  * @brief  Returns the channels clipped in the last acquisition
+  *
+  * @retval SAMPLE_CLIP_xxx bit mask
+  */
+uint8_t Sample_GetClip (void)
+{
+	return gu8Clip;
 }
 
 /**
@@ -57,6 +270,7 @@ void Sample_Init (uint16_t u16BlockSize)
   * Tconv = Sampling time + 12 cycles
   *
   * Tconv = 84 + 12 = 218.750sps (60Khz)
+  * Tconv = 28 + 12 = 525.000sps (150Khz), SAMPLE_MODE_FAST
   *
   * @param  ch1
   * @param  ch2
@@ -64,24 +278,254 @@ void Sample_Init (uint16_t u16BlockSize)
   */
 void Sample_Take(uint16_t ch1[], uint16_t ch2[] )
 {
-	int ii;
+	uint32_t *ADCSamples = gArenaSram.tu32Adc;
+	uint32_t u32Conv = (uint32_t)gu16BlockSize << gu8Oversampling;
+	uint32_t *pu32Word;
+	uint32_t u32Start;
+	uint8_t u8Dma = (gu8Deint == SAMPLE_DEINT_DMA) && (gu8Oversampling == 0);
+
+	AdcStart(ADCSamples, u32Conv+SAMPLE_DUMMY_READS, DMA_Mode_Normal);
+
+	/* Low noise context enter */
+	LowNoiseContext(1);
+
+	/* Start ADC1 Software Conversion */
+	ADC_SoftwareStartConv(ADC1);
+
+	/* Dummy reads are not watched: clear the watchdog once they are in */
+	while (DMA2_Stream0->NDTR > u32Conv)
+	{;}
+	ADC_ClearFlag(ADC1, ADC_FLAG_AWD);
+	ADC_ClearFlag(ADC2, ADC_FLAG_AWD);
+
+	if (gu8QuietMode & SAMPLE_QUIET_RAMWAIT)
+		WaitTransferCompleteRam();
+	else
+		WaitTransferComplete();
+
+	/* Clear DMA1 channel1 transfer complete flag */
+	DMA_ClearFlag(DMA2_Stream0, DMA_FLAG_TCIF0);
+
+	/* Discard first sample: first ADC2 sample is wrong */
+	pu32Word = &ADCSamples[SAMPLE_DUMMY_READS];
+	gu32DeintCycles = 0;
+	if (u8Dma)
+	{
+		/* Low half words to ch1, high half words to ch2 */
+		u32Start = DWT->CYCCNT;
+		DeintStart(DMA2_Stream1, (uint32_t)pu32Word, ch1, gu16BlockSize);
+		DeintStart(DMA2_Stream2, (uint32_t)pu32Word + sizeof(uint16_t), ch2, gu16BlockSize);
+		gu32DeintCycles = DWT->CYCCNT - u32Start;
+	}
+
+	AdcStop();
+
+	/* Low noise context exit */
+	LowNoiseContext(0);
+
+	u32Start = DWT->CYCCNT;
+	/* A failed DMA deinterleave falls back to the CPU, the words are
+	 * still in place */
+	if (!u8Dma || (DeintWait() != 0))
+	{
+		Deinterleave(pu32Word, ch1, ch2);
+	}
+	gu32DeintCycles += DWT->CYCCNT - u32Start;
+}
+
+/**
+  * @brief  Captures back to back blocks of the current block size and
+  * oversampling in a single DMA transfer, so there is no gap between
+  * them: block b starts exactly b.N samples after block 0. The blocks
+  * are kept as dual ADC words in the arena and extracted afterwards with
+  * Sample_GetBurstBlock. The whole burst runs in the low noise context.
+  *
+  * @param  u16Blocks: blocks requested
+  * @retval Blocks captured, up to Sample_GetBurstMaxBlocks
+  */
+uint16_t Sample_BurstTake (uint16_t u16Blocks)
+{
+	uint32_t *ADCSamples = gArenaSram.tu32Adc;
+	uint32_t u32Conv;
+	uint32_t u32Start;
+
+	if (u16Blocks > Sample_GetBurstMaxBlocks())
+		u16Blocks = Sample_GetBurstMaxBlocks();
+	if (u16Blocks == 0)
+		return 0;
+	u32Conv = ((uint32_t)u16Blocks*gu16BlockSize) << gu8Oversampling;
+
+	AdcStart(ADCSamples, u32Conv+SAMPLE_DUMMY_READS, DMA_Mode_Normal);
+	LowNoiseContext(1);
+
+	u32Start = DWT->CYCCNT;
+	ADC_SoftwareStartConv(ADC1);
+
+	/* Dummy reads are not watched */
+	while (DMA2_Stream0->NDTR > u32Conv)
+	{;}
+	ADC_ClearFlag(ADC1, ADC_FLAG_AWD);
+	ADC_ClearFlag(ADC2, ADC_FLAG_AWD);
+
+	if (gu8QuietMode & SAMPLE_QUIET_RAMWAIT)
+		WaitTransferCompleteRam();
+	else
+		WaitTransferComplete();
+	gu32BurstCycles = DWT->CYCCNT - u32Start;
+	DMA_ClearFlag(DMA2_Stream0, DMA_FLAG_TCIF0);
+
+	AdcStop();
+	LowNoiseContext(0);
+	return u16Blocks;
+}
+
+/**
+  * @brief  Returns one block of the last burst as dual ADC words, 2^n
+  * per sample with oversampling, channel 1 in the low half word
+  * (Goertzel_CalcDual)
+  *
+  * @param  u16Block: block index, below the blocks captured
+  * @retval First dual word of the block
+  */
+const uint32_t *Sample_GetBurstBlock (uint16_t u16Block)
+{
+	uint32_t u32Offset = ((uint32_t)u16Block*gu16BlockSize) << gu8Oversampling;
+
+	return &gArenaSram.tu32Adc[SAMPLE_DUMMY_READS + u32Offset];
+}
+
+/**
+  * @brief  Returns the blocks a burst can hold with the current block size
+  * and oversampling
+  *
+  * @retval Blocks
+  */
+uint16_t Sample_GetBurstMaxBlocks (void)
+{
+	uint32_t u32Block = (uint32_t)gu16BlockSize << gu8Oversampling;
+
+	if (u32Block == 0)
+		return 0;
+	return (uint16_t)((SAMPLE_BURST_WORDS - SAMPLE_DUMMY_READS)/u32Block);
+}
+
+/**
+  * @brief  Returns the CPU cycles from the start of the last burst to the
+  * end of its transfer: blocks x N x 2^n conversion periods when gap free
+  *
+  * @retval cycles
+  */
+uint32_t Sample_GetBurstCycles (void)
+{
+	return gu32BurstCycles;
+}
+
+/**
+  * @brief  Starts continuous acquisition into a ring of dual ADC words
+  * (channel 1 in the low half word). The DMA runs in circular mode and
+  * each half of the ring is handed over with Sample_StreamWait while the
+  * other one is being filled, so the acquisition length is not bounded
+  * by memory. The first SAMPLE_DUMMY_READS words are not valid. The low
+  * noise context is not entered: the stream may last for seconds.
+  *
+  * @param  tu32Ring: ring buffer
+  * @param  u16Size: ring size (words), even
+  * @retval None
+  */
+void Sample_StreamStart (uint32_t tu32Ring[], uint16_t u16Size)
+{
+	gpu32Ring = tu32Ring;
+	gu16RingHalf = u16Size/2;
+	gu8Overrun = 0;
+
+	AdcStart(tu32Ring, 2*gu16RingHalf, DMA_Mode_Circular);
+	ADC_SoftwareStartConv(ADC1);
+
+	/* Dummy reads are not watched */
+	while (DMA2_Stream0->NDTR > (uint32_t)(2*gu16RingHalf - SAMPLE_DUMMY_READS))
+	{;}
+	ADC_ClearFlag(ADC1, ADC_FLAG_AWD);
+	ADC_ClearFlag(ADC2, ADC_FLAG_AWD);
+}
+
+/**
+  * @brief  Waits for the next half of the ring. Both halves complete
+  * means the consumer fell behind and samples were overwritten.
+  *
+  * @retval Half ring (u16Size/2 words), NULL on overrun
+  */
+uint32_t *Sample_StreamWait (void)
+{
+	uint32_t u32Flags;
+
+	while (((u32Flags = DMA2->LISR) & (DMA_LISR_HTIF0 | DMA_LISR_TCIF0)) == 0)
+	{;}
+	if ((u32Flags & (DMA_LISR_HTIF0 | DMA_LISR_TCIF0)) == (DMA_LISR_HTIF0 | DMA_LISR_TCIF0))
+	{
+		DMA2->LIFCR = DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTCIF0;
+		gu8Overrun = 1;
+		return NULL;
+	}
+	if (u32Flags & DMA_LISR_HTIF0)
+	{
+		DMA2->LIFCR = DMA_LIFCR_CHTIF0;
+		return gpu32Ring;
+	}
+	DMA2->LIFCR = DMA_LIFCR_CTCIF0;
+	return &gpu32Ring[gu16RingHalf];
+}
+
+/**
+  * @brief  Returns the ring index the DMA writes next. Read together with
+  * another timer it ties ring words to that time base.
+  *
+  * @retval Word index in the ring
+  */
+uint16_t Sample_StreamPosition (void)
+{
+	return (uint16_t)(2*gu16RingHalf - DMA2_Stream0->NDTR);
+}
+
+/**
+  * @brief  Stops the continuous acquisition. Clipping is reported by
+  * Sample_GetClip as for a block.
+  *
+  * @retval 1 if an overrun happened, 0 otherwise
+  */
+uint8_t Sample_StreamStop (void)
+{
+	AdcStop();
+	return gu8Overrun;
+}
+
+/**
+  * @brief  Configures DMA2 stream0 and the dual ADC (regular simultaneous),
+  * ready for the software start
+  *
+  * @param  tu32Buffer: destination of the dual ADC words
+  * @param  u32Size: words
+  * @param  u32DmaMode: DMA_Mode_Normal (block) or DMA_Mode_Circular (stream)
+  * @retval None
+  */
+static void AdcStart (uint32_t tu32Buffer[], uint32_t u32Size, uint32_t u32DmaMode)
+{
 	ADC_InitTypeDef ADC_InitStructure;
 	ADC_CommonInitTypeDef ADC_CommonInitStructure;
 	DMA_InitTypeDef DMA_InitStructure;
-	__IO uint32_t ADCSamples[SAMPLE_BLOCK_SIZE+SAMPLE_DUMMY_READS];
+	uint8_t u8SampleTime = (gu8Mode == SAMPLE_MODE_FAST) ? ADC_SampleTime_28Cycles : ADC_SampleTime_84Cycles;
 
 	/* DMA2 stream0 configuration ----------------------------------------------*/
 	DMA_DeInit(DMA2_Stream0);
 	DMA_InitStructure.DMA_Channel = DMA_Channel_0;
 	DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)ADC_CCR_ADDRESS;
-	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)&ADCSamples;
+	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)tu32Buffer;
 	DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralToMemory;
-	DMA_InitStructure.DMA_BufferSize = gu16BlockSize+SAMPLE_DUMMY_READS;
+	DMA_InitStructure.DMA_BufferSize = u32Size;
 	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
 	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
 	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
 	DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Word;
-	DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+	DMA_InitStructure.DMA_Mode = u32DmaMode;
 	DMA_InitStructure.DMA_Priority = DMA_Priority_High;
 	DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Disable;
 	DMA_InitStructure.DMA_FIFOThreshold = DMA_FIFOThreshold_HalfFull;
@@ -110,7 +554,12 @@ void Sample_Take(uint16_t ch1[], uint16_t ch2[] )
 	ADC_Init(ADC1, &ADC_InitStructure);
 
 	/* ADC1 regular channel1 configuration */
-	ADC_RegularChannelConfig(ADC1, ADC_Channel_1, 1, ADC_SampleTime_84Cycles);
+	ADC_RegularChannelConfig(ADC1, ADC_Channel_1, 1, u8SampleTime);
+
+	/* Clipping: analog watchdog, flag only */
+	ADC_AnalogWatchdogThresholdsConfig(ADC1, SAMPLE_CLIP_HIGH, SAMPLE_CLIP_LOW);
+	ADC_AnalogWatchdogSingleChannelConfig(ADC1, ADC_Channel_1);
+	ADC_AnalogWatchdogCmd(ADC1, ADC_AnalogWatchdog_SingleRegEnable);
 
 	/* Enable ADC1 DMA */
 	ADC_DMACmd(ADC1, ENABLE);
@@ -126,7 +575,11 @@ void Sample_Take(uint16_t ch1[], uint16_t ch2[] )
 	ADC_Init(ADC2, &ADC_InitStructure);
 
 	/* ADC2 regular channel2 configuration */
-	ADC_RegularChannelConfig(ADC2, ADC_Channel_2, 1, ADC_SampleTime_84Cycles);
+	ADC_RegularChannelConfig(ADC2, ADC_Channel_2, 1, u8SampleTime);
+
+	ADC_AnalogWatchdogThresholdsConfig(ADC2, SAMPLE_CLIP_HIGH, SAMPLE_CLIP_LOW);
+	ADC_AnalogWatchdogSingleChannelConfig(ADC2, ADC_Channel_2);
+	ADC_AnalogWatchdogCmd(ADC2, ADC_AnalogWatchdog_SingleRegEnable);
 
 	ADC_MultiModeDMARequestAfterLastTransferCmd(ENABLE);
 
@@ -135,33 +588,122 @@ void Sample_Take(uint16_t ch1[], uint16_t ch2[] )
 
 	/* Enable ADC2 */
 	ADC_Cmd(ADC2, ENABLE);
+}
 
-	/* Low noise context enter */
-	LowNoiseContext(1);
-
-	/* Start ADC1 Software Conversion */
-	ADC_SoftwareStartConv(ADC1);
-
-	while (DMA_GetFlagStatus(DMA2_Stream0, DMA_FLAG_TCIF0)==RESET)
-	{;}
-
-	/* Clear DMA1 channel1 transfer complete flag */
-	DMA_ClearFlag(DMA2_Stream0, DMA_FLAG_TCIF0);
-
+/**
+  * @brief  Stops the dual ADC and its DMA, and latches the clipping flags
+  *
+  * @retval None
+  */
+static void AdcStop (void)
+{
 	ADC_Cmd(ADC1, DISABLE);
 	ADC_Cmd(ADC2, DISABLE);
 	ADC_DMACmd(ADC1, DISABLE);
+
+	gu8Clip = 0;
+	if (ADC_GetFlagStatus(ADC1, ADC_FLAG_AWD) != RESET)
+		gu8Clip |= SAMPLE_CLIP_CH1;
+	if (ADC_GetFlagStatus(ADC2, ADC_FLAG_AWD) != RESET)
+		gu8Clip |= SAMPLE_CLIP_CH2;
 	DMA_DeInit(DMA2_Stream0);
+}
 
-	/* Low noise context exit */
-	LowNoiseContext(0);
+/**
+  * @brief  Starts a DMA2 memory to memory stream copying one half word of
+  * each dual ADC word: the source address steps 4 bytes (PINCOS, needs
+  * the FIFO, which memory to memory requires anyway) and the destination
+  * 2 bytes.
+  *
+  * @param  pStream: DMA2 stream, not used by the ADC
+  * @param  u32Src: address of the first half word
+  * @param  tu16Dst: channel samples
+  * @param  u16Count: samples
+  * @retval None
+  */
+static void DeintStart (DMA_Stream_TypeDef *pStream, uint32_t u32Src, uint16_t tu16Dst[], uint16_t u16Count)
+{
+	DMA_InitTypeDef DMA_InitStructure;
+
+	DMA_DeInit(pStream);
+	DMA_InitStructure.DMA_Channel = DMA_Channel_0;
+	DMA_InitStructure.DMA_PeripheralBaseAddr = u32Src;
+	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)tu16Dst;
+	DMA_InitStructure.DMA_DIR = DMA_DIR_MemoryToMemory;
+	DMA_InitStructure.DMA_BufferSize = u16Count;
+	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Enable;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+	DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+	DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_Medium;
+	DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Enable;
+	DMA_InitStructure.DMA_FIFOThreshold = DMA_FIFOThreshold_Full;
+	DMA_InitStructure.DMA_MemoryBurst = DMA_MemoryBurst_Single;
+	DMA_InitStructure.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
+	DMA_Init(pStream, &DMA_InitStructure);
+	DMA_PeriphIncOffsetSizeConfig(pStream, DMA_PINCOS_WordAligned);
+
+	DMA_Cmd(pStream, ENABLE);
+}
+
+/**
+  * @brief  Splits a block of dual ADC words into the channels. Deinterleave
+  * and oversampling in one pass: both channels are summed at once in the
+  * dual word, 2^4 x 4095 cannot carry into the upper half word.
+  *
+  * @param  pu32Word: first dual word of the block
+  * @param  ch1
+  * @param  ch2
+  * @retval None
+  */
+static void Deinterleave (const uint32_t *pu32Word, uint16_t ch1[], uint16_t ch2[])
+{
+	int ii, jj;
 
-	/* Discard first sample: first ADC2 sample is wrong */
 	for (ii=0;ii<gu16BlockSize;ii++)
 	{
-		ch1[ii] = (ADCSamples[ii+SAMPLE_DUMMY_READS]&0xffff);
-		ch2[ii] = (ADCSamples[ii+SAMPLE_DUMMY_READS]>>16);
+		uint32_t u32Sum = 0;
+
+		for (jj = (1 << gu8Oversampling); jj > 0; jj--)
+			u32Sum += *pu32Word++;
+		ch1[ii] = (u32Sum&0xffff);
+		ch2[ii] = (u32Sum>>16);
+	}
+}
+
+/**
+  * @brief  Waits for both deinterleave streams, bounded: a transfer,
+  * FIFO or direct mode error, or a timeout, stops both streams.
+  *
+  * @retval 0 if both completed, -1 on error or timeout
+  */
+static int DeintWait (void)
+{
+	uint32_t u32Timeout = DEINT_MIN_CYCLES + DEINT_SAMPLE_CYCLES*(uint32_t)gu16BlockSize;
+	uint32_t u32Start = DWT->CYCCNT;
+	uint32_t u32Flags;
+	int iStatus = 0;
+
+	do
+	{
+		u32Flags = DMA2->LISR;
+		if ((u32Flags & DEINT_ERR_FLAGS) || ((DWT->CYCCNT - u32Start) > u32Timeout))
+		{
+			iStatus = -1;
+			break;
+		}
+	} while ((u32Flags & (DMA_LISR_TCIF1 | DMA_LISR_TCIF2)) != (DMA_LISR_TCIF1 | DMA_LISR_TCIF2));
+
+	if (iStatus != 0)
+	{
+		DMA_Cmd(DMA2_Stream1, DISABLE);
+		DMA_Cmd(DMA2_Stream2, DISABLE);
+		while ((DMA_GetCmdStatus(DMA2_Stream1) != DISABLE) || (DMA_GetCmdStatus(DMA2_Stream2) != DISABLE))
+		{;}
 	}
+	DMA2->LIFCR = DEINT_ALL_FLAGS;
+	return iStatus;
 }
 
 /**
@@ -196,27 +738,76 @@ static void GPIO_Configuration(void)
 }
 
 /**
-  * @brief Systick interrupt during measurements would cause noise -probably due to buttons scan.
-  * Disables temporarily the systick interrupt during measurements.
+  * @brief Waits for the end of the ADC DMA transfer
+  * @param  None
+  * @retval None
+  */
+static void WaitTransferComplete (void)
+{
+	while ((DMA2->LISR & DMA_LISR_TCIF0) == 0)
+	{;}
+}
+
+/**
+  * @brief Same as WaitTransferComplete but executed from RAM (.RamFunc is
+  * copied with .data), so flash stays idle while the block is sampled.
+  * Only register accesses allowed here: no calls to flash functions.
   * @param  None
   * @retval None
   */
+static void WaitTransferCompleteRam (void)
+{
+	while ((DMA2->LISR & DMA_LISR_TCIF0) == 0)
+	{;}
+}
+
+/**
+  * @brief Activity during the sampled block couples into the analog inputs.
+  * Systick interrupt would cause noise -probably due to buttons scan-, USB
+  * interrupts may fire mid-block, LEDs switch current and flash accesses
+  * add supply ripple. Each source is handled according to gu8QuietMode.
+  * The window length is recorded since it is the latency added to deferred
+  * interrupts.
+  * @param  enter: 1 entering, 0 leaving
+  * @retval None
+  */
 static void LowNoiseContext (int enter)
 {
-#if 1
 	if (enter)
 	{
-		SysTick->CTRL  = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
-//		FLASH_PrefetchBufferCmd(DISABLE);
-//		FLASH_DataCacheCmd(DISABLE);
+		gu32QuietStart = DWT->CYCCNT;
+		if (gu8QuietMode & SAMPLE_QUIET_USB)
+			NVIC_DisableIRQ(USB_OTG_IRQn);
+		if (gu8QuietMode & SAMPLE_QUIET_SYSTICK)
+			SysTick->CTRL  = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+		if (gu8QuietMode & SAMPLE_QUIET_LEDS)
+		{
+			gu16LedsState = GPIOD->ODR & LEDS_MASK;
+			GPIOD->BSRRH = LEDS_MASK;
+		}
+		if (gu8QuietMode & SAMPLE_QUIET_FLASH)
+		{
+			FLASH_PrefetchBufferCmd(DISABLE);
+			FLASH_DataCacheCmd(DISABLE);
+			FLASH_InstructionCacheCmd(DISABLE);
+		}
 	}
 	else
 	{
-		SysTick->CTRL  = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
-//		FLASH_PrefetchBufferCmd(ENABLE);
-//		FLASH_DataCacheCmd(ENABLE);
+		if (gu8QuietMode & SAMPLE_QUIET_FLASH)
+		{
+			FLASH_InstructionCacheCmd(ENABLE);
+			FLASH_DataCacheCmd(ENABLE);
+			FLASH_PrefetchBufferCmd(ENABLE);
+		}
+		if (gu8QuietMode & SAMPLE_QUIET_LEDS)
+			GPIOD->BSRRL = gu16LedsState;
+		if (gu8QuietMode & SAMPLE_QUIET_SYSTICK)
+			SysTick->CTRL  = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
+		if (gu8QuietMode & SAMPLE_QUIET_USB)
+			NVIC_EnableIRQ(USB_OTG_IRQn);
+		gu32QuietCycles = DWT->CYCCNT - gu32QuietStart;
 	}
-#endif
 }
 
 
@@ -20,13 +20,46 @@
 
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
-/* ((2xSAMPLE_BLOCK_SIZE)*FREQ)/FSAMPLE Shall be integer */
+/* ((2xSAMPLE_BLOCK_SIZE)*FREQ)/FSAMPLE Shall be integer; other frequencies
+ * get their own block size in coherent mode (coherent.c) */
 
 #define SAMPLING_RATE				218750
+#define SAMPLE_CLOCK_DIV			384		/* 84MHz/SAMPLING_RATE: ADCCLK/4, 84+12 cycles */
+#define SAMPLING_RATE_FAST			525000
+#define SAMPLE_CLOCK_DIV_FAST		160		/* 84MHz/SAMPLING_RATE_FAST: ADCCLK/4, 28+12 cycles */
 #define MEASUREMENT_FREQ			59659
 #define SAMPLE_BLOCK_SIZE			(110)
+#define SAMPLE_MAX_BLOCK_SIZE		(10240)	/* Runtime block size limit (arena size) */
 
+#define SAMPLE_BURST_WORDS			(14*1024)	/* Burst capture buffer (dual ADC words, arena) */
 #define SAMPLE_DUMMY_READS			1		/* Drops first ADC reads */
+#define SAMPLE_MID_SCALE			2048	/* ADC mid scale, one conversion */
+#define SAMPLE_MAX_OVERSAMPLING		4		/* Up to 2^4 conversions summed: 16 bit samples */
+
+/* Low noise acquisition context options (bit mask, see Sample_SetQuietMode) */
+#define SAMPLE_QUIET_SYSTICK		0x01	/* Mask SysTick interrupt */
+#define SAMPLE_QUIET_USB			0x02	/* Defer USB OTG interrupts */
+#define SAMPLE_QUIET_LEDS			0x04	/* Blank LEDs, LED updates paused */
+#define SAMPLE_QUIET_FLASH			0x08	/* Flash prefetch and caches off */
+#define SAMPLE_QUIET_RAMWAIT		0x10	/* DMA wait loop runs from RAM */
+#define SAMPLE_QUIET_ALL			0x1F
+
+#define SAMPLE_QUIET_DEFAULT		SAMPLE_QUIET_SYSTICK
+
+/* Acquisition modes (see Sample_SetMode) */
+#define SAMPLE_MODE_NORMAL			0		/* SAMPLING_RATE, 84 cycles sample time */
+#define SAMPLE_MODE_FAST			1		/* SAMPLING_RATE_FAST, 28 cycles sample time */
+#define SAMPLE_NUM_MODES			2
+
+/* Deinterleave of the dual ADC words (see Sample_SetDeinterleave) */
+#define SAMPLE_DEINT_CPU			0		/* CPU loop */
+#define SAMPLE_DEINT_DMA			1		/* DMA2 memory to memory streams 1 and 2 */
+
+/* Clipping detection: ADC analog watchdog window */
+#define SAMPLE_CLIP_LOW				16
+#define SAMPLE_CLIP_HIGH			4079
+#define SAMPLE_CLIP_CH1				0x01
+#define SAMPLE_CLIP_CH2				0x02
 
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions ------------------------------------------------------- */
@@ -47,6 +80,179 @@ extern void Sample_Init (uint16_t u16BlockSize);
   */
 extern void Sample_Take(uint16_t ch1[], uint16_t ch2[] );
 
+/**
+  * @brief  Captures back to back blocks in a single transfer
+  *
+  * @param  u16Blocks: blocks requested
+  * @retval Blocks captured, up to Sample_GetBurstMaxBlocks
+  */
+extern uint16_t Sample_BurstTake (uint16_t u16Blocks);
+
+/**
+  * @brief  Returns one block of the last burst as dual ADC words
+  *
+  * @param  u16Block: block index
+  * @retval First dual word of the block
+  */
+extern const uint32_t *Sample_GetBurstBlock (uint16_t u16Block);
+
+/**
+  * @brief  Returns the blocks a burst can hold
+  *
+  * @retval Blocks
+  */
+extern uint16_t Sample_GetBurstMaxBlocks (void);
+
+/**
+  * @brief  Returns the CPU cycles from the start of the last burst to the
+  * end of its transfer
+  *
+  * @retval cycles
+  */
+extern uint32_t Sample_GetBurstCycles (void);
+
+/**
+  * @brief  Starts continuous acquisition into a ring of dual ADC words
+  *
+  * @param  tu32Ring: ring buffer
+  * @param  u16Size: ring size (words), even
+  * @retval None
+  */
+extern void Sample_StreamStart (uint32_t tu32Ring[], uint16_t u16Size);
+
+/**
+  * @brief  Waits for the next half of the ring
+  *
+  * @retval Half ring, NULL on overrun
+  */
+extern uint32_t *Sample_StreamWait (void);
+
+/**
+  * @brief  Returns the ring index the DMA writes next
+  *
+  * @retval Word index in the ring
+  */
+extern uint16_t Sample_StreamPosition (void);
+
+/**
+  * @brief  Stops the continuous acquisition
+  *
+  * @retval 1 if an overrun happened
+  */
+extern uint8_t Sample_StreamStop (void);
+
+/**
+  * @brief  Selects the acquisition mode
+  *
+  * @param  u8Mode: SAMPLE_MODE_xxx
+  * @retval None
+  */
+extern void Sample_SetMode (uint8_t u8Mode);
+
+/**
+  * @brief  Returns the acquisition mode
+  *
+  * @retval SAMPLE_MODE_xxx
+  */
+extern uint8_t Sample_GetMode (void);
+
+/**
+  * @brief  Sets the oversampling: 2^n conversions summed per sample
+  *
+  * @param  u8Log2: n, up to SAMPLE_MAX_OVERSAMPLING
+  * @retval None
+  */
+extern void Sample_SetOversampling (uint8_t u8Log2);
+
+/**
+  * @brief  Returns the oversampling
+  *
+  * @retval n: 2^n conversions per sample
+  */
+extern uint8_t Sample_GetOversampling (void);
+
+/**
+  * @brief  Returns the ADC conversion rate of the acquisition mode
+  *
+  * @retval Conversions per second
+  */
+extern uint32_t Sample_GetAdcRate (void);
+
+/**
+  * @brief  Returns the sampling rate of the blocks (after oversampling)
+  *
+  * @retval Samples per second
+  */
+extern double Sample_GetRate (void);
+
+/**
+  * @brief  Returns the APB2 clock ticks per block sample
+  *
+  * @retval Ticks (84MHz)
+  */
+extern uint32_t Sample_GetClockDiv (void);
+
+/**
+  * @brief  Returns the largest block that fits the arena with the
+  * current oversampling
+  *
+  * @retval Samples
+  */
+extern uint16_t Sample_GetMaxBlockSize (void);
+
+/**
+  * @brief  Selects how the dual ADC words are split into the channels
+  *
+  * @param  u8Mode: SAMPLE_DEINT_xxx
+  * @retval None
+  */
+extern void Sample_SetDeinterleave (uint8_t u8Mode);
+
+/**
+  * @brief  Returns the deinterleave mode
+  *
+  * @retval SAMPLE_DEINT_xxx
+  */
+extern uint8_t Sample_GetDeinterleave (void);
+
+/**
+  * @brief  Returns the CPU cycles the last block spent in the deinterleave
+  *
+  * @retval cycles
+  */
+extern uint32_t Sample_GetDeintCycles (void);
+
+/**
+  * @brief  Selects the low noise context options used during acquisition
+  *
+  * @param  u8Mode: SAMPLE_QUIET_xxx bit mask
+  * @retval None
+  */
+extern void Sample_SetQuietMode (uint8_t u8Mode);
+
+/**
+  * @brief  Returns the active low noise context options
+  *
+  * @retval SAMPLE_QUIET_xxx bit mask
+  */
+extern uint8_t Sample_GetQuietMode (void);
+
+/**
+  * @brief  Returns the duration of the last low noise window in CPU cycles.
+  * When SAMPLE_QUIET_USB is set this is the USB interrupt latency added.
+  *
+  * @retval cycles
+  */
+extern uint32_t Sample_GetQuietCycles (void);
+
+/**
+  * @brief  Returns the channels that hit the analog watchdog window
+  * (SAMPLE_CLIP_LOW..SAMPLE_CLIP_HIGH) during the last acquisition
+  *
+  * @retval SAMPLE_CLIP_xxx bit mask
+  */
+extern uint8_t Sample_GetClip (void);
+
 #endif	 /* __SAMPLE_H__ */
 
 /************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
@@ -0,0 +1,257 @@
+/**
+  ******************************************************************************
+  * @file    scope.c
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Triggered waveform capture
+  *
+  * Time domain capture of both ADC inputs for fixture debugging. The ADC
+  * streams into a DMA ring (Sample_StreamStart) and each half is consumed
+  * while the other fills: conversions are averaged by the decimation
+  * factor and written to a circular capture buffer of pre plus post
+  * trigger samples (the channel arrays of the arena). The trigger is
+  * checked on every sample with a few integer operations:
+  * - Level, either channel: a falling edge is a rising edge of the
+  *   negated signal, re-armed SCOPE_HYSTERESIS counts below the level.
+  * - Excitation phase: the DAC table position is read once at the start
+  *   next to the ring position, so the phase of every sample follows from
+  *   the shared 84MHz clock (ADC divider vs TIM6 divider) with no further
+  *   access to the generator.
+  * Once the post trigger samples are in, the buffer is rotated in place
+  * so the frame starts at index 0.
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+
+#include "stm32f4xx.h"
+#include "sample.h"
+#include "siggen.h"
+#include "arena.h"
+#include "scope.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+#define ADC_MAX_COUNT		4095
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+/* Private function prototypes -----------------------------------------------*/
+static void Rotate (uint16_t tu16Data[], uint16_t u16Size, uint16_t u16First);
+static void Reverse (uint16_t tu16Data[], uint16_t u16From, uint16_t u16To);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief Captures a triggered frame of both channels. The generator keeps
+  * running; for SCOPE_TRIG_DAC it must not hop during the capture.
+  * Samples are left in gArenaSram.tu16Ch1 and tu16Ch2, oldest first.
+  *
+  * @param pConfig	Trigger and depth
+  * @param pFrame	Returns the frame header
+  * @retval SCOPE_xxx status
+  */
+int Scope_Capture (const TSCOPE_CONFIG *pConfig, TSCOPE_FRAME *pFrame)
+{
+	uint16_t *pu16Ch1 = gArenaSram.tu16Ch1;
+	uint16_t *pu16Ch2 = gArenaSram.tu16Ch2;
+	uint32_t u32Depth = (uint32_t)pConfig->u16Pre + pConfig->u16Post;
+	uint16_t u16Decim = pConfig->u16Decim;
+	uint16_t u16Wr = 0;
+	uint16_t u16Phase = 0;
+	uint16_t u16First = SAMPLE_DUMMY_READS;
+	uint16_t u16Left = 0;
+	uint32_t u32Written = 0;
+	uint32_t u32Acc1 = 0, u32Acc2 = 0;
+	uint32_t u32RawDiv, u32DacDiv, u32Period = 1, u32Target = 0, u32Step = 0, u32DacPhase = 0;
+	uint32_t u32Start, u32Timeout;
+	uint16_t u16TableLen, u16Pos, u16DacPos;
+	int32_t i32Level, i32Sign, i32Rearm;
+	uint8_t u8Armed = 0;
+	uint8_t u8Fire;
+	uint8_t u8Triggered = 0;
+	int iStatus = SCOPE_OK;
+
+	memset(pFrame, 0, sizeof(*pFrame));
+	pFrame->u16Sync = SCOPE_FRAME_SYNC;
+	pFrame->u8Source = pConfig->u8Source;
+	pFrame->u16Decim = u16Decim;
+	pFrame->u16Level = pConfig->u16Level;
+
+	/* Trigger set up */
+	SigGen_GetTable(&u32DacDiv, &u16TableLen);
+	u32RawDiv = Sample_GetClockDiv() >> Sample_GetOversampling();
+	if ((pConfig->u8Source > SCOPE_TRIG_FREE) || (pConfig->u8Edge > SCOPE_EDGE_FALLING)
+			|| (u16Decim < 1) || (u16Decim > SCOPE_MAX_DECIM)
+			|| (pConfig->u16Post < 1) || (u32Depth > SCOPE_MAX_DEPTH)
+			|| ((pConfig->u8Source <= SCOPE_TRIG_CH2) && (pConfig->u16Level > ADC_MAX_COUNT))
+			|| ((pConfig->u8Source == SCOPE_TRIG_DAC) && (pConfig->u16Level >= u16TableLen)))
+	{
+		pFrame->u8Status = SCOPE_BAD_PARAM;
+		return SCOPE_BAD_PARAM;
+	}
+	i32Sign = (pConfig->u8Edge == SCOPE_EDGE_FALLING) ? -1 : 1;
+	i32Level = i32Sign*(int32_t)pConfig->u16Level;
+	i32Rearm = i32Level - SCOPE_HYSTERESIS;
+
+	Sample_StreamStart(gArenaSram.tu32Adc, SCOPE_RING_SIZE);
+
+	/* Table phase (clock ticks) of the conversion before the first sample */
+	__disable_irq();
+	u16Pos = Sample_StreamPosition();
+	u16DacPos = SigGen_GetPhase();
+	__enable_irq();
+	if (pConfig->u8Source == SCOPE_TRIG_DAC)
+	{
+		int64_t i64Ticks = (int64_t)u16DacPos*u32DacDiv
+				+ ((int64_t)SAMPLE_DUMMY_READS - 1 - u16Pos)*u32RawDiv;
+
+		u32Period = (uint32_t)u16TableLen*u32DacDiv;
+		u32Target = pConfig->u16Level*u32DacDiv;
+		/* A sample is stamped with its last conversion */
+		u32Step = (u32RawDiv*u16Decim) % u32Period;
+		i64Ticks %= u32Period;
+		if (i64Ticks < 0)
+			i64Ticks += u32Period;
+		u32DacPhase = (uint32_t)i64Ticks;
+	}
+
+	u32Timeout = SCOPE_TIMEOUT_MS*(SystemCoreClock/1000);
+	u32Start = DWT->CYCCNT;
+	while (1)
+	{
+		uint32_t *pu32Half = Sample_StreamWait();
+		uint16_t ii;
+
+		if (pu32Half == NULL)
+		{
+			iStatus = SCOPE_OVERRUN;
+			break;
+		}
+
+		for (ii = u16First; ii < SCOPE_RING_SIZE/2; ii++)
+		{
+			uint32_t u32Word = pu32Half[ii];
+			uint16_t u16S1, u16S2;
+
+			u32Acc1 += u32Word & 0xFFFF;
+			u32Acc2 += u32Word >> 16;
+			if (++u16Phase < u16Decim)
+				continue;
+			u16Phase = 0;
+			u16S1 = (uint16_t)(u32Acc1/u16Decim);
+			u16S2 = (uint16_t)(u32Acc2/u16Decim);
+			u32Acc1 = 0;
+			u32Acc2 = 0;
+
+			pu16Ch1[u16Wr] = u16S1;
+			pu16Ch2[u16Wr] = u16S2;
+			if (++u16Wr == u32Depth)
+				u16Wr = 0;
+			u32Written++;
+
+			if (u8Triggered)
+			{
+				if (--u16Left == 0)
+					break;
+				continue;
+			}
+
+			/* Trigger */
+			u8Fire = 1;
+			if (pConfig->u8Source == SCOPE_TRIG_DAC)
+			{
+				u32DacPhase += u32Step;
+				if (u32DacPhase >= u32Period)
+					u32DacPhase -= u32Period;
+				/* Target crossed within the last step */
+				u8Fire = (((u32DacPhase >= u32Target) ? u32DacPhase - u32Target
+						: u32DacPhase + u32Period - u32Target) < u32Step);
+			}
+			else if (pConfig->u8Source != SCOPE_TRIG_FREE)
+			{
+				int32_t i32X = i32Sign*(int32_t)((pConfig->u8Source == SCOPE_TRIG_CH1) ? u16S1 : u16S2);
+
+				u8Fire = u8Armed && (i32X >= i32Level);
+				if (i32X < i32Rearm)
+					u8Armed = 1;
+				else if (u8Fire)
+					u8Armed = 0;
+			}
+			if (!u8Fire || (u32Written <= pConfig->u16Pre))
+				continue;
+
+			u8Triggered = 1;
+			u16Left = pConfig->u16Post;
+			if (--u16Left == 0)
+				break;
+		}
+		if (u8Triggered && (u16Left == 0))
+			break;
+		u16First = 0;
+
+		/* Auto: force the trigger on the next sample */
+		if (!u8Triggered && (u32Written >= pConfig->u16Pre) && ((DWT->CYCCNT - u32Start) > u32Timeout))
+		{
+			u8Triggered = 1;
+			u16Left = pConfig->u16Post;
+			iStatus = SCOPE_AUTO;
+		}
+	}
+	Sample_StreamStop();
+
+	pFrame->u8Status = (uint8_t)iStatus;
+	if (iStatus == SCOPE_OVERRUN)
+		return iStatus;
+
+	/* Oldest sample first */
+	Rotate(pu16Ch1, (uint16_t)u32Depth, u16Wr);
+	Rotate(pu16Ch2, (uint16_t)u32Depth, u16Wr);
+	pFrame->u16Count = (uint16_t)u32Depth;
+	pFrame->u16Trigger = pConfig->u16Pre;
+	pFrame->fRate = (float)((double)Sample_GetAdcRate()/u16Decim);
+	return iStatus;
+}
+
+/**
+  * @brief Rotates a buffer in place so that u16First becomes index 0
+  *
+  * @param tu16Data		Buffer
+  * @param u16Size		Samples
+  * @param u16First		Index of the new first sample
+  * @retval None
+  */
+static void Rotate (uint16_t tu16Data[], uint16_t u16Size, uint16_t u16First)
+{
+	if ((u16First == 0) || (u16First >= u16Size))
+		return;
+	Reverse(tu16Data, 0, u16First-1);
+	Reverse(tu16Data, u16First, u16Size-1);
+	Reverse(tu16Data, 0, u16Size-1);
+}
+
+/**
+  * @brief Reverses a range of a buffer
+  *
+  * @param tu16Data		Buffer
+  * @param u16From		First index
+  * @param u16To		Last index
+  * @retval None
+  */
+static void Reverse (uint16_t tu16Data[], uint16_t u16From, uint16_t u16To)
+{
+	while (u16From < u16To)
+	{
+		uint16_t u16T = tu16Data[u16From];
+
+		tu16Data[u16From++] = tu16Data[u16To];
+		tu16Data[u16To--] = u16T;
+	}
+}
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
@@ -0,0 +1,79 @@
+/**
+  ******************************************************************************
+  * @file    scope.h
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Triggered waveform capture
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __SCOPE_H__
+#define __SCOPE_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f4xx.h"
+#include "sample.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define SCOPE_RING_SIZE			1024	/* DMA ring (dual ADC words), two halves */
+#define SCOPE_MAX_DEPTH			SAMPLE_MAX_BLOCK_SIZE	/* Pre plus post trigger samples */
+#define SCOPE_MAX_DECIM			256		/* Decimation: mean of up to 256 conversions */
+#define SCOPE_HYSTERESIS		16		/* Level trigger re-arm band (ADC counts) */
+#define SCOPE_TIMEOUT_MS		1000	/* No trigger: forced (auto) after this time */
+
+/* Trigger source */
+#define SCOPE_TRIG_CH1			0		/* Level on channel 1 */
+#define SCOPE_TRIG_CH2			1		/* Level on channel 2 */
+#define SCOPE_TRIG_DAC			2		/* Excitation table phase */
+#define SCOPE_TRIG_FREE			3		/* As soon as the pre trigger is filled */
+
+/* Trigger edge (level sources) */
+#define SCOPE_EDGE_RISING		0
+#define SCOPE_EDGE_FALLING		1
+
+/* Status */
+#define SCOPE_OK				0		/* Triggered */
+#define SCOPE_AUTO				1		/* Trigger timed out, capture forced */
+#define SCOPE_OVERRUN			2		/* A half ring was overwritten before being processed */
+#define SCOPE_BAD_PARAM			3
+
+/* Binary frame */
+#define SCOPE_FRAME_SYNC		0x5AA5
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+	uint8_t u8Source;			/* SCOPE_TRIG_xxx */
+	uint8_t u8Edge;				/* SCOPE_EDGE_xxx */
+	uint16_t u16Level;			/* ADC counts, or table index for SCOPE_TRIG_DAC */
+	uint16_t u16Pre;			/* Samples before the trigger */
+	uint16_t u16Post;			/* Samples from the trigger on, at least 1 */
+	uint16_t u16Decim;			/* Conversions per sample, 1 to SCOPE_MAX_DECIM */
+} TSCOPE_CONFIG;
+
+/* Frame header, little endian. Followed by u16Count channel 1 samples,
+ * u16Count channel 2 samples (uint16) and the 16 bit sum of all samples */
+typedef struct __attribute__ ((packed))
+{
+	uint16_t u16Sync;			/* SCOPE_FRAME_SYNC */
+	uint8_t u8Status;			/* SCOPE_xxx */
+	uint8_t u8Source;			/* SCOPE_TRIG_xxx */
+	uint16_t u16Count;			/* Samples per channel */
+	uint16_t u16Trigger;		/* Index of the trigger sample */
+	uint16_t u16Decim;			/* Conversions per sample */
+	uint16_t u16Level;			/* Trigger level */
+	float fRate;				/* Samples per second */
+} TSCOPE_FRAME;
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+extern int Scope_Capture (const TSCOPE_CONFIG *pConfig, TSCOPE_FRAME *pFrame);
+
+#endif	 /* __SCOPE_H__ */
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
@@ -0,0 +1,250 @@
+/**
+  ******************************************************************************
+  * @file    search.c
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Adaptive resonance search
+  *
+  * Finds a series or parallel resonance with few measurements: coarse log
+  * sweeps zooming on the |Z| extremum until the phase zero crossing is
+  * bracketed, then Illinois (modified regula falsi) refinement on X (series)
+  * or B (parallel), both increasing through zero at resonance. All measured
+  * points are kept for the model fit. Q comes from the fitted model, or from
+  * the reactance slope at resonance, Q = f0/(2R).dX/df, if the fit fails.
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <math.h>
+#include <string.h>
+
+#include "stm32f4xx.h"
+#include "complex.h"
+#include "measure.h"
+#include "fit.h"
+#include "search.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+static uint16_t gu16Count;
+
+/* Private function prototypes -----------------------------------------------*/
+static double Probe (double fFreq, uint8_t u8Type, TSWEEP_POINT tPoints[], complex double *pz);
+static double Root (complex double z, uint8_t u8Type);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief Adaptive resonance search
+  *
+  * @param fStart	Start frequency (Hz)
+  * @param fStop	Stop frequency (Hz)
+  * @param u8Type	SEARCH_SERIES or SEARCH_PARALLEL
+  * @param u8Model	FIT_xxx model fitted to the measured points
+  * @param tPoints	Buffer for the measured points (SWEEP_MAX_POINTS)
+  * @param pResult	Returns the resonance
+  * @retval SEARCH_xxx status
+  */
+int Search_Resonance (double fStart, double fStop, uint8_t u8Type, uint8_t u8Model,
+		TSWEEP_POINT tPoints[], TSEARCH_RESULT *pResult)
+{
+	double fLo = fStart, fHi = fStop;
+	double fA = 0, fB = 0, fGA = 0, fGB = 0;
+	double fGATrue, fGBTrue;
+	complex double z, zRes = 0;
+	int iFound = 0;
+	int iPass, ii, iSide = 0;
+	uint16_t u16Ext = 0;
+
+	if (!pResult)
+		return SEARCH_ERROR;
+	memset(pResult, 0, sizeof(*pResult));
+	pResult->i8Status = SEARCH_ERROR;
+	pResult->fit.i8Status = FIT_ERROR;
+	if ((fStart <= 0) || (fStop <= fStart))
+		return SEARCH_ERROR;
+	gu16Count = 0;
+	pResult->u8Type = u8Type;
+
+	/* Coarse passes: zoom on the extremum until a crossing is bracketed */
+	for (iPass = 0; (iPass < SEARCH_ZOOM_PASSES) && !iFound; iPass++)
+	{
+		u16Ext = gu16Count;
+		uint16_t u16First = gu16Count;
+		double fPrevF = 0, fPrevG = 0;
+
+		for (ii = 0; ii < SEARCH_COARSE_POINTS; ii++)
+		{
+			double fF = fLo*pow(fHi/fLo, (double)ii/(double)(SEARCH_COARSE_POINTS-1));
+			double fG = Probe(fF, u8Type, tPoints, &z);
+
+			fF = tPoints[gu16Count-1].fFreq;
+			if ((ii > 0) && (fPrevG < 0) && (fG >= 0))
+			{
+				/* Keep the crossing closest to the extremum found so far */
+				if (!iFound || (fabs(fF - tPoints[u16Ext].fFreq) < fabs(fB - tPoints[u16Ext].fFreq)))
+				{
+					fA = fPrevF;
+					fGA = fPrevG;
+					fB = fF;
+					fGB = fG;
+					iFound = 1;
+				}
+			}
+			if (((u8Type == SEARCH_SERIES) && (CAbsf(tPoints[gu16Count-1].z) < CAbsf(tPoints[u16Ext].z)))
+					|| ((u8Type == SEARCH_PARALLEL) && (CAbsf(tPoints[gu16Count-1].z) > CAbsf(tPoints[u16Ext].z))))
+				u16Ext = gu16Count-1;
+			fPrevF = fF;
+			fPrevG = fG;
+		}
+
+		/* Next pass spans the neighbors of the extremum */
+		ii = u16Ext - u16First;
+		fLo = tPoints[u16First + ((ii > 0) ? ii-1 : 0)].fFreq;
+		fHi = tPoints[u16First + ((ii < SEARCH_COARSE_POINTS-1) ? ii+1 : ii)].fFreq;
+		zRes = (complex double)tPoints[u16Ext].z;
+		pResult->fFreq = tPoints[u16Ext].fFreq;
+		pResult->fResolution = fHi - fLo;
+		if (fHi <= fLo)
+			break;
+	}
+
+	if (iFound)
+	{
+		/* Illinois refinement of the zero crossing */
+		fGATrue = fGA;
+		fGBTrue = fGB;
+		for (ii = 0; ii < SEARCH_MAX_ITER; ii++)
+		{
+			double fC, fGC;
+
+			if (((fB - fA) < (SEARCH_REL_TOL*fB)) || (gu16Count >= SWEEP_MAX_POINTS))
+				break;
+			fC = (fA*fGB - fB*fGA)/(fGB - fGA);
+			fGC = Probe(fC, u8Type, tPoints, &z);
+			fC = tPoints[gu16Count-1].fFreq;
+			/* Generator resolution reached */
+			if ((fC <= fA) || (fC >= fB))
+				break;
+			if (fGC < 0)
+			{
+				fA = fC;
+				fGA = fGATrue = fGC;
+				if (iSide == -1)
+					fGB *= 0.5;
+				iSide = -1;
+			}
+			else
+			{
+				fB = fC;
+				fGB = fGBTrue = fGC;
+				if (iSide == 1)
+					fGA *= 0.5;
+				iSide = 1;
+			}
+			zRes = z;
+		}
+		pResult->fFreq = (fA*fGBTrue - fB*fGATrue)/(fGBTrue - fGATrue);
+		pResult->fResolution = fB - fA;
+
+		/* Q from the slope of X (series) or B (parallel) over R or G */
+		if (u8Type == SEARCH_SERIES)
+			pResult->fQ = (pResult->fFreq/(2.0*fabs(__real__ zRes)+1e-12)) * (fGBTrue - fGATrue)/(fB - fA);
+		else
+			pResult->fQ = (pResult->fFreq/(2.0*fabs(__real__ (1.0/zRes))+1e-12)) * (fGBTrue - fGATrue)/(fB - fA);
+		pResult->i8Status = SEARCH_OK;
+	}
+	else
+	{
+		/* Parabolic interpolation of |Z| around the last extremum */
+		if ((u16Ext > 0) && (u16Ext+1 < gu16Count))
+		{
+			double fX0 = tPoints[u16Ext-1].fFreq, fX1 = tPoints[u16Ext].fFreq, fX2 = tPoints[u16Ext+1].fFreq;
+			double fY0 = CAbsf(tPoints[u16Ext-1].z), fY1 = CAbsf(tPoints[u16Ext].z), fY2 = CAbsf(tPoints[u16Ext+1].z);
+			double fNum = (fX1-fX0)*(fX1-fX0)*(fY1-fY2) - (fX1-fX2)*(fX1-fX2)*(fY1-fY0);
+			double fDen = (fX1-fX0)*(fY1-fY2) - (fX1-fX2)*(fY1-fY0);
+
+			if (fDen != 0)
+				pResult->fFreq = fX1 - 0.5*fNum/fDen;
+		}
+		pResult->fQ = 0;
+		pResult->i8Status = SEARCH_NO_CROSSING;
+	}
+	pResult->z = zRes;
+	pResult->u16Points = gu16Count;
+
+	/* The fit uses all the points, so its Q is less noisy than the slope
+	 * over the final (narrow) bracket */
+	if ((Fit_Run(tPoints, gu16Count, u8Model, &pResult->fit) == FIT_OK) && (pResult->i8Status == SEARCH_OK))
+	{
+		double fW = 2.0*M_PI*pResult->fFreq;
+		float *pfP = pResult->fit.tfParam;
+
+		switch (u8Model)
+		{
+		case FIT_SERIES_RLC:
+		case FIT_CRYSTAL_BVD:
+			pResult->fQ = fW*pfP[1]/pfP[0];
+			break;
+		case FIT_PARALLEL_RLC:
+			pResult->fQ = pfP[0]/(fW*pfP[1]);
+			break;
+		case FIT_CAPACITOR:
+			pResult->fQ = fW*pfP[2]/pfP[1];
+			break;
+		}
+	}
+
+	return pResult->i8Status;
+}
+
+/**
+  * @brief Measures a point and stores it
+  *
+  * @param fFreq	Frequency (Hz)
+  * @param u8Type	SEARCH_SERIES or SEARCH_PARALLEL
+  * @param tPoints	Points buffer
+  * @param pz		Returns the impedance
+  * @retval Root function value
+  */
+static double Probe (double fFreq, uint8_t u8Type, TSWEEP_POINT tPoints[], complex double *pz)
+{
+	complex double z;
+	double fActual;
+	TMEASURE_QUALITY tQuality;
+
+	fActual = Measure_SetFreq(fFreq);
+	Measure_Z(&z);
+	if (gu16Count < SWEEP_MAX_POINTS)
+	{
+		Measure_GetQuality(&tQuality);
+		Measure_SetPoint(&tPoints[gu16Count], fActual, z, Measure_GetFlags(), &tQuality);
+		gu16Count++;
+	}
+	if (pz)
+		*pz = z;
+	return Root(z, u8Type);
+}
+
+/**
+  * @brief Function crossing zero upwards at resonance: X for series, B for
+  * parallel resonance.
+  *
+  * @param z		Impedance
+  * @param u8Type	SEARCH_SERIES or SEARCH_PARALLEL
+  * @retval X or B
+  */
+static double Root (complex double z, uint8_t u8Type)
+{
+	if (u8Type == SEARCH_SERIES)
+		return __imag__ z;
+	return __imag__ (1.0/z);
+}
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
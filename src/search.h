@@ -0,0 +1,57 @@
+/**
+  ******************************************************************************
+  * @file    search.h
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Adaptive resonance search
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __SEARCH_H__
+#define __SEARCH_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f4xx.h"
+#include "measure.h"
+#include "fit.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define SEARCH_SERIES			0		/* |Z| minimum, X crosses 0 upwards */
+#define SEARCH_PARALLEL			1		/* |Z| maximum, B crosses 0 upwards */
+
+#define SEARCH_COARSE_POINTS	21		/* Points per coarse pass */
+#define SEARCH_ZOOM_PASSES		3		/* Coarse passes zooming on |Z| extremum */
+#define SEARCH_MAX_ITER			24		/* Refinement measurements */
+#define SEARCH_REL_TOL			1e-6	/* Bracket width relative to frequency */
+
+/* Search status */
+#define SEARCH_OK				0
+#define SEARCH_NO_CROSSING		1		/* Extremum only, no phase zero crossing */
+#define SEARCH_ERROR			-1
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+	int8_t i8Status;			/* SEARCH_xxx */
+	uint8_t u8Type;				/* SEARCH_SERIES or SEARCH_PARALLEL */
+	double fFreq;				/* Resonant frequency (Hz) */
+	double fResolution;			/* Final bracket width (Hz) */
+	double fQ;					/* Quality factor */
+	complex double z;			/* Impedance at resonance */
+	uint16_t u16Points;			/* Measurements used */
+	TFIT_RESULT fit;			/* Model fitted to the measured points */
+} TSEARCH_RESULT;
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+extern int Search_Resonance (double fStart, double fStop, uint8_t u8Type, uint8_t u8Model,
+		TSWEEP_POINT tPoints[], TSEARCH_RESULT *pResult);
+
+#endif	 /* __SEARCH_H__ */
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
@@ -12,49 +12,64 @@
  */
 
 /* Includes ------------------------------------------------------------------*/
+#include <math.h>
 #include "stm32f4_discovery.h"
+#include "siggen.h"
+#include "arena.h"
 
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
-#define HIGH_RES_SIN		1	/* Comment for low resolution sine wave */
-
 #define DAC_DHR12R1_ADDRESS    0x40007408
+#define TIM6_ARR_ADDRESS       0x4000102C
+
+#define SIGGEN_TIM_CLOCK		84000000.0	/* TIM6 clock: APB1 x2 */
+#define SIGGEN_SPC				128			/* Target samples per cycle */
+#define SIGGEN_MID				2048.0		/* DAC mid scale */
+#define SIGGEN_AMPLITUDE		1972.0		/* Sine peak: 76..4020 */
+#define SIGGEN_HOP_TOL			1e-3		/* Max relative error of a same length hop */
+#define SIGGEN_HOP_MARGIN		8			/* Samples left to safely repoint the idle buffer */
+#define SIGGEN_SETTLE_CYCLES	10			/* DUT settling allowance after a hop (excitation cycles) */
+#define SIGGEN_SETTLE_MIN_US	50			/* Analog front end settling allowance after a hop */
+#define SIGGEN_RESTART_US		5000		/* Settling allowance after a stop/start of the output */
+#define DITHER_LCG_MUL			1664525		/* Dither LCG (Numerical Recipes) */
+#define DITHER_LCG_INC			1013904223
 
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
 static DAC_InitTypeDef  DAC_InitStructure;
 static uint8_t gu8Enabled = 0;
 
-#ifdef HIGH_RES_SIN
-static const uint16_t gtu16Sine12bit[] =
-{
-	2048, 2145, 2242, 2339, 2435, 2530, 2624, 2717, 2808, 2897,
-	2984, 3069, 3151, 3230, 3307, 3381, 3451, 3518, 3581, 3640,
-	3696, 3748, 3795, 3838, 3877, 3911, 3941, 3966, 3986, 4002,
-	4013, 4019, 4020, 4016, 4008, 3995, 3977, 3954, 3926, 3894,
-	3858, 3817, 3772, 3722, 3669, 3611, 3550, 3485, 3416, 3344,
-	3269, 3191, 3110, 3027, 2941, 2853, 2763, 2671, 2578, 2483,
-	2387, 2291, 2194, 2096, 1999, 1901, 1804, 1708, 1612, 1517,
-	1424, 1332, 1242, 1154, 1068, 985, 904, 826, 751, 679,
-	610, 545, 484, 426, 373, 323, 278, 237, 201, 169,
-	141, 118, 100, 87, 79, 75, 76, 82, 93, 109,
-	129, 154, 184, 218, 257, 300, 347, 399, 455, 514,
-	577, 644, 714, 788, 865, 944, 1026, 1111, 1198, 1287,
-	1378, 1471, 1565, 1660, 1756, 1853, 1950, 2047
-};
-#else
-static const uint16_t gtu16Sine12bit[32] =
-{
-	2047, 2447, 2831, 3185, 3498, 3750, 3939, 4056, 4095, 4056,
-	3939, 3750, 3495, 3185, 2831, 2447, 2047, 1647, 1263, 909,
-	599, 344, 155, 38, 0, 38, 155, 344, 599, 909, 1263, 1647
-};
-#endif
+/* Waveform table is synthesized in RAM: gu16Cycles sine cycles in
+ * gu16TableLen samples, played at SIGGEN_TIM_CLOCK/gu32Divider.
+ * DMA runs in double buffer mode: table gu8Active is playing, the other
+ * one is where the next waveform is built. DMA1_Stream1 (TIM6 update)
+ * runs in step with it, writing the divider of each table
+ * (gArenaSram.tu16DacArr) into the ARR preload register, so a divider
+ * change lands exactly on the first sample of its table */
+static uint8_t gu8Active = 0;
+static uint16_t gu16TableLen;
+static uint16_t gu16Cycles;
+static uint32_t gu32Divider;
+static double gfFreq;
+static uint32_t gu32SettleUs;
+static float gfLevel = SIGGEN_MAX_LEVEL;
+static uint8_t gu8Dither = 0;
+static uint32_t gu32DitherState = 1;
+
+/* Hop waiting for the buffer switch */
+static volatile uint8_t gu8HopPending = 0;
+static uint32_t gu32HopDivider;
 
 /* Private function prototypes -----------------------------------------------*/
 static void TIM6_Config(void);
 static void DAC_Ch1_SineWaveConfig(void);
+static void Synthesize (double fFreq, uint16_t *pu16Table);
+static double SynthesizeHop (double fFreq, uint16_t *pu16Table, uint32_t *pu32Div);
+static void Restart (void);
+static void QueueHop (uint16_t *pu16Next, uint32_t u32Div, double fActual);
+static void FillSine (uint16_t *pu16Table, uint16_t u16Cycles, uint16_t u16Len);
+static double Dither (void);
 
 /* Private functions ---------------------------------------------------------*/
 
@@ -67,6 +82,7 @@ void SigGen_Init (void)
 {
 	/* Preconfiguration before using DAC----------------------------------------*/
 	GPIO_InitTypeDef GPIO_InitStructure;
+	NVIC_InitTypeDef NVIC_InitStructure;
 
 	/* DMA1 clock and GPIOA clock enable (to be used with DAC) */
 	RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1 | RCC_AHB1Periph_GPIOA, ENABLE);
@@ -80,12 +96,556 @@ void SigGen_Init (void)
 	GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_NOPULL;
 	GPIO_Init(GPIOA, &GPIO_InitStructure);
 
+	/* Waveform table for the default frequency */
+	Synthesize(MEASUREMENT_FREQ, gArenaSram.tu16Dac[gu8Active]);
+
+	/* Buffer switch interrupt, only enabled while a hop is pending. It
+	 * has a whole table to repoint the idle memory registers */
+	NVIC_InitStructure.NVIC_IRQChannel = DMA1_Stream5_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+
 	/* TIM6 Configuration ------------------------------------------------------*/
 	TIM6_Config();
 
 	gu8Enabled = 0;
 }
 
+/**
+  * @brief  Sets the generator frequency.
+  * The output is stopped while the table is rebuilt.
+  * @param  fFreq: requested frequency (Hz)
+  * @retval Actual frequency (Hz)
+  */
+double SigGen_SetFreq (double fFreq)
+{
+	if (fFreq < SIGGEN_MIN_FREQ)
+		fFreq = SIGGEN_MIN_FREQ;
+	if (fFreq > SIGGEN_MAX_FREQ)
+		fFreq = SIGGEN_MAX_FREQ;
+
+	while (gu8HopPending)
+	{;}
+	gu8Active ^= 1;
+	Synthesize(fFreq, gArenaSram.tu16Dac[gu8Active]);
+	Restart();
+
+	return gfFreq;
+}
+
+/**
+  * @brief  Changes the generator frequency without stopping the output.
+  * The new table, same length as the playing one, is built in the idle
+  * buffer and the DMA switches to it at the end of the current table. As
+  * both tables hold whole cycles starting at zero phase, the waveform is
+  * continuous. The divider stream switches with it, so the new TIM6
+  * divider applies from the first sample of the new table. Falls back to SigGen_SetFreq when no table of that length
+  * gets within SIGGEN_HOP_TOL.
+  * @param  fFreq: requested frequency (Hz)
+  * @retval Actual frequency (Hz)
+  */
+double SigGen_Hop (double fFreq)
+{
+	uint16_t *pu16Next;
+	uint32_t u32Div;
+	double fActual;
+
+	if (fFreq < SIGGEN_MIN_FREQ)
+		fFreq = SIGGEN_MIN_FREQ;
+	if (fFreq > SIGGEN_MAX_FREQ)
+		fFreq = SIGGEN_MAX_FREQ;
+
+	if (!gu8Enabled)
+		return SigGen_SetFreq(fFreq);
+
+	/* Previous hop must be done before the idle table is reused */
+	while (gu8HopPending)
+	{;}
+
+	pu16Next = gArenaSram.tu16Dac[gu8Active^1];
+	fActual = SynthesizeHop(fFreq, pu16Next, &u32Div);
+	if (fabs(fActual-fFreq) > (fFreq*SIGGEN_HOP_TOL))
+		return SigGen_SetFreq(fFreq);
+
+	QueueHop(pu16Next, u32Div, fActual);
+
+	gu16Cycles = (uint16_t)((fActual*gu16TableLen*u32Div)/SIGGEN_TIM_CLOCK + 0.5);
+	gfFreq = fActual;
+
+	return gfFreq;
+}
+
+/**
+  * @brief  Plays an explicit table: u16Cycles sine cycles in u16Len
+  * samples at SIGGEN_TIM_CLOCK/u32Div (coherent plans). Hops when the
+  * length matches the playing table, restarts otherwise.
+  * @param  u32Div: TIM6 divider, SIGGEN_MIN_DIV to SIGGEN_MAX_DIV
+  * @param  u16Len: table length, up to SIGGEN_MAX_TABLE
+  * @param  u16Cycles: cycles in the table
+  * @retval Actual frequency (Hz)
+  */
+double SigGen_SetTable (uint32_t u32Div, uint16_t u16Len, uint16_t u16Cycles)
+{
+	uint16_t *pu16Next;
+	double fActual;
+
+	if ((u32Div < SIGGEN_MIN_DIV) || (u32Div > SIGGEN_MAX_DIV) || (u16Len > SIGGEN_MAX_TABLE)
+			|| (u16Len < SIGGEN_MIN_TABLE) || (u16Cycles == 0))
+		return gfFreq;
+	fActual = (SIGGEN_TIM_CLOCK*u16Cycles)/((double)u32Div*u16Len);
+
+	while (gu8HopPending)
+	{;}
+	pu16Next = gArenaSram.tu16Dac[gu8Active^1];
+	FillSine(pu16Next, u16Cycles, u16Len);
+
+	if (gu8Enabled && (u16Len == gu16TableLen))
+	{
+		QueueHop(pu16Next, u32Div, fActual);
+	}
+	else
+	{
+		gu8Active ^= 1;
+		gu32Divider = u32Div;
+		gu16TableLen = u16Len;
+		Restart();
+	}
+	gu16Cycles = u16Cycles;
+	gfFreq = fActual;
+
+	return gfFreq;
+}
+
+/**
+  * @brief  Sets the output level, relative to the full scale sine.
+  * The table is rebuilt at the same frequency through a hop, so the
+  * output is not stopped.
+  * @param  fLevel: SIGGEN_MIN_LEVEL to SIGGEN_MAX_LEVEL
+  * @retval Level set
+  */
+float SigGen_SetLevel (float fLevel)
+{
+	if (fLevel < SIGGEN_MIN_LEVEL)
+		fLevel = SIGGEN_MIN_LEVEL;
+	if (fLevel > SIGGEN_MAX_LEVEL)
+		fLevel = SIGGEN_MAX_LEVEL;
+	if (fLevel == gfLevel)
+		return gfLevel;
+
+	gfLevel = fLevel;
+	SigGen_Hop(gfFreq);
+
+	return gfLevel;
+}
+
+/**
+  * @brief  Returns the output level
+  * @param  None
+  * @retval Level, relative to the full scale sine
+  */
+float SigGen_GetLevel (void)
+{
+	return gfLevel;
+}
+
+/**
+  * @brief  Sets the dither added to the waveform tables: triangular
+  * distribution, u8Lsb DAC LSB peak. The table repeats, so the dither
+  * is part of the periodic excitation (both channels see it, no bias on
+  * vm/vr); it spreads the samples of a block over more ADC codes, which
+  * lets the oversampling gain resolution on small signals. Takes effect
+  * at the next table synthesis.
+  * @param  u8Lsb: 0 (off) to SIGGEN_MAX_DITHER
+  * @retval None
+  */
+void SigGen_SetDither (uint8_t u8Lsb)
+{
+	gu8Dither = (u8Lsb > SIGGEN_MAX_DITHER) ? SIGGEN_MAX_DITHER : u8Lsb;
+}
+
+/**
+  * @brief  Returns the table dither
+  * @param  None
+  * @retval DAC LSB peak, 0 if off
+  */
+uint8_t SigGen_GetDither (void)
+{
+	return gu8Dither;
+}
+
+/**
+  * @brief  Queues a hop to a table in the idle buffer: repoints the idle
+  * memory registers of the table and divider streams, not too close to
+  * the buffer switch, and enables the switch interrupt that completes
+  * the hop.
+  * @param  pu16Next: new table, same length as the playing one
+  * @param  u32Div: new divider
+  * @param  fActual: new frequency (Hz), for the settling allowance
+  * @retval None
+  */
+static void QueueHop (uint16_t *pu16Next, uint32_t u32Div, double fActual)
+{
+	uint16_t *pu16Arr = &gArenaSram.tu16DacArr[gu8Active^1];
+	uint32_t u32Left;
+
+	*pu16Arr = (uint16_t)(u32Div-1);
+
+	while (1)
+	{
+		__disable_irq();
+		u32Left = DMA_GetCurrDataCounter(DMA1_Stream5);
+		if (u32Left > SIGGEN_HOP_MARGIN)
+			break;
+		__enable_irq();
+	}
+	if (DMA_GetCurrentMemoryTarget(DMA1_Stream5) == 0)
+	{
+		DMA_MemoryTargetConfig(DMA1_Stream5, (uint32_t)pu16Next, DMA_Memory_1);
+		DMA_MemoryTargetConfig(DMA1_Stream1, (uint32_t)pu16Arr, DMA_Memory_1);
+	}
+	else
+	{
+		DMA_MemoryTargetConfig(DMA1_Stream5, (uint32_t)pu16Next, DMA_Memory_0);
+		DMA_MemoryTargetConfig(DMA1_Stream1, (uint32_t)pu16Arr, DMA_Memory_0);
+	}
+	gu32HopDivider = u32Div;
+	gu8HopPending = 1;
+	DMA_ClearFlag(DMA1_Stream5, DMA_FLAG_TCIF5);
+	DMA_ITConfig(DMA1_Stream5, DMA_IT_TC, ENABLE);
+	__enable_irq();
+
+	/* Settling allowance: rest of the playing table, then the DUT */
+	gu32SettleUs = (uint32_t)((u32Left*(double)gu32Divider*1e6)/SIGGEN_TIM_CLOCK
+			+ (SIGGEN_SETTLE_CYCLES*1e6)/fActual) + SIGGEN_SETTLE_MIN_US;
+
+	gu8Active ^= 1;
+}
+
+/**
+  * @brief  Fills a table with whole sine cycles at the output level
+  * @param  pu16Table: table to fill
+  * @param  u16Cycles: cycles in the table
+  * @param  u16Len: table length
+  * @retval None
+  */
+static void FillSine (uint16_t *pu16Table, uint16_t u16Cycles, uint16_t u16Len)
+{
+	int ii;
+
+	for (ii = 0; ii < u16Len; ii++)
+	{
+		pu16Table[ii] = (uint16_t)(SIGGEN_MID + gfLevel*SIGGEN_AMPLITUDE*sin((2.0*M_PI*u16Cycles*ii)/u16Len) + Dither() + 0.5);
+	}
+}
+
+/**
+  * @brief  Dither sample: sum of two uniform values (LCG), triangular
+  * in +/-gu8Dither LSB
+  * @param  None
+  * @retval Dither (DAC LSB)
+  */
+static double Dither (void)
+{
+	double fSum = 0;
+	int ii;
+
+	if (gu8Dither == 0)
+		return 0;
+	for (ii = 0; ii < 2; ii++)
+	{
+		gu32DitherState = gu32DitherState*DITHER_LCG_MUL + DITHER_LCG_INC;
+		fSum += (double)(gu32DitherState >> 8)/(double)(1 << 24) - 0.5;
+	}
+	return fSum*gu8Dither;
+}
+
+/**
+  * @brief  Settling allowance after the last frequency change. It is a
+  * fixed formula, not derived from the DUT response: after a hop, the
+  * rest of the table playing when it was queued, plus
+  * SIGGEN_SETTLE_CYCLES excitation cycles, plus SIGGEN_SETTLE_MIN_US;
+  * after a restart, SIGGEN_RESTART_US. High Q DUTs may need more.
+  * @param  None
+  * @retval Settling time (us)
+  */
+uint32_t SigGen_GetSettleUs (void)
+{
+	return gu32SettleUs;
+}
+
+/**
+  * @brief  DMA buffer switch interrupt: completes a pending hop.
+  * The divider stream already loaded the new divider; points both
+  * memory registers of each stream to the new table.
+  * @param  None
+  * @retval None
+  */
+void SigGen_DMA_Handler (void)
+{
+	if (DMA_GetITStatus(DMA1_Stream5, DMA_IT_TCIF5) == RESET)
+		return;
+	DMA_ClearITPendingBit(DMA1_Stream5, DMA_IT_TCIF5);
+
+	gu32Divider = gu32HopDivider;
+
+	if (DMA_GetCurrentMemoryTarget(DMA1_Stream5) == 0)
+	{
+		DMA1_Stream5->M1AR = DMA1_Stream5->M0AR;
+		DMA1_Stream1->M1AR = DMA1_Stream1->M0AR;
+	}
+	else
+	{
+		DMA1_Stream5->M0AR = DMA1_Stream5->M1AR;
+		DMA1_Stream1->M0AR = DMA1_Stream1->M1AR;
+	}
+
+	DMA_ITConfig(DMA1_Stream5, DMA_IT_TC, DISABLE);
+	gu8HopPending = 0;
+}
+
+/**
+  * @brief  Sets a multi-tone excitation coherent with the ADC block.
+  * The table lasts exactly one ADC block (both clocks derive from 84MHz:
+  * table length x divider = u16BlockSize x Sample_GetClockDiv()), so tone m
+  * has tu16Bins[m] cycles in the table and falls exactly on ADC bin
+  * tu16Bins[m]. Schroeder phases keep the crest factor low; the sum is
+  * scaled to the single tone peak, so each tone gets roughly
+  * 1/sqrt(u8Count) of the single tone amplitude (rms).
+  * @param  tu16Bins: ADC bins of the tones
+  * @param  u8Count: number of tones, up to SIGGEN_MAX_TONES
+  * @param  u16BlockSize: ADC block size
+  * @retval 0 if OK, -1 if no table fits
+  */
+int SigGen_SetMultiTone (const uint16_t tu16Bins[], uint8_t u8Count, uint16_t u16BlockSize)
+{
+	uint32_t u32Ticks = (uint32_t)u16BlockSize*Sample_GetClockDiv();
+	uint32_t u32Div;
+	uint16_t u16MaxBin = 0;
+	double tfPhase[SIGGEN_MAX_TONES];
+	uint16_t *pu16Table;
+	double fPeak = 0;
+	int ii, mm, iPass;
+
+	if ((u8Count == 0) || (u8Count > SIGGEN_MAX_TONES))
+		return -1;
+	for (mm = 0; mm < u8Count; mm++)
+		if (tu16Bins[mm] > u16MaxBin)
+			u16MaxBin = tu16Bins[mm];
+
+	/* Fastest divider giving an integer table length that fits */
+	for (u32Div = SIGGEN_MIN_DIV; u32Div <= SIGGEN_MAX_DIV; u32Div++)
+	{
+		if (((u32Ticks % u32Div) == 0) && ((u32Ticks/u32Div) <= SIGGEN_MAX_TABLE))
+			break;
+	}
+	if ((u32Div > SIGGEN_MAX_DIV) || ((u16MaxBin*2) >= (u32Ticks/u32Div)))
+		return -1;
+
+	while (gu8HopPending)
+	{;}
+	gu8Active ^= 1;
+	pu16Table = gArenaSram.tu16Dac[gu8Active];
+	gu32Divider = u32Div;
+	gu16TableLen = (uint16_t)(u32Ticks/u32Div);
+	gu16Cycles = tu16Bins[0];
+	gfFreq = (SIGGEN_TIM_CLOCK*tu16Bins[0])/(double)u32Ticks;
+
+	/* Schroeder phases */
+	for (mm = 0; mm < u8Count; mm++)
+		tfPhase[mm] = -M_PI*mm*(mm+1)/(double)u8Count;
+
+	/* First pass finds the peak, second one writes the scaled table */
+	for (iPass = 0; iPass < 2; iPass++)
+	{
+		for (ii = 0; ii < gu16TableLen; ii++)
+		{
+			double fSum = 0;
+
+			for (mm = 0; mm < u8Count; mm++)
+				fSum += cos((2.0*M_PI*tu16Bins[mm]*ii)/gu16TableLen + tfPhase[mm]);
+			if (iPass == 0)
+			{
+				if (fabs(fSum) > fPeak)
+					fPeak = fabs(fSum);
+			}
+			else
+			{
+				pu16Table[ii] = (uint16_t)(SIGGEN_MID + (gfLevel*SIGGEN_AMPLITUDE*fSum)/fPeak + Dither() + 0.5);
+			}
+		}
+	}
+
+	Restart();
+	return 0;
+}
+
+/**
+  * @brief  Applies the current divider and table.
+  * The output is stopped while DMA is reprogrammed; a pending hop is
+  * dropped.
+  * @param  None
+  * @retval None
+  */
+static void Restart (void)
+{
+	if (gu8Enabled)
+	{
+		DAC_DMACmd(DAC_Channel_1, DISABLE);
+		TIM_DMACmd(TIM6, TIM_DMA_Update, DISABLE);
+		DMA_Cmd(DMA1_Stream5, DISABLE);
+		DMA_Cmd(DMA1_Stream1, DISABLE);
+		while ((DMA_GetCmdStatus(DMA1_Stream5) != DISABLE) || (DMA_GetCmdStatus(DMA1_Stream1) != DISABLE))
+		{;}
+	}
+	DMA_ITConfig(DMA1_Stream5, DMA_IT_TC, DISABLE);
+	gu8HopPending = 0;
+	gu32SettleUs = SIGGEN_RESTART_US;
+
+	/* ARR is preloaded: force the update */
+	TIM_SetAutoreload(TIM6, gu32Divider-1);
+	TIM_GenerateEvent(TIM6, TIM_EventSource_Update);
+
+	if (gu8Enabled)
+		DAC_Ch1_SineWaveConfig();
+}
+
+/**
+  * @brief  Returns the actual generator frequency
+  * @param  None
+  * @retval Frequency (Hz)
+  */
+double SigGen_GetFreq (void)
+{
+	return gfFreq;
+}
+
+/**
+  * @brief  Returns the playing table timing
+  * @param  pu32Div: returns the TIM6 divider (SIGGEN_TIM_CLOCK ticks per DAC sample)
+  * @param  pu16Len: returns the table length
+  * @retval None
+  */
+void SigGen_GetTable (uint32_t *pu32Div, uint16_t *pu16Len)
+{
+	if (pu32Div)
+		*pu32Div = gu32Divider;
+	if (pu16Len)
+		*pu16Len = gu16TableLen;
+}
+
+/**
+  * @brief  Returns the table index the DMA loads next into the DAC. The
+  * output shows the previous one, so this is the phase within one DAC
+  * sample.
+  * @param  None
+  * @retval Table index, 0 to table length-1
+  */
+uint16_t SigGen_GetPhase (void)
+{
+	uint16_t u16Left = DMA_GetCurrDataCounter(DMA1_Stream5);
+
+	if ((u16Left == 0) || (u16Left > gu16TableLen))
+		return 0;
+	return gu16TableLen - u16Left;
+}
+
+/**
+  * @brief  Computes timer divider and table for a frequency.
+  * The divider gives about SIGGEN_SPC samples per cycle; then the table
+  * length and number of cycles in the table giving the closest frequency
+  * are searched. Longer tables win ties, as they leave more room for
+  * later hops.
+  * @param  fFreq: requested frequency (Hz)
+  * @param  pu16Table: table to fill
+  * @retval None
+  */
+static void Synthesize (double fFreq, uint16_t *pu16Table)
+{
+	uint32_t u32Div;
+	double fRate;
+	double fBestErr = 1e30;
+	uint16_t u16Len;
+	uint16_t u16BestLen = SIGGEN_SPC;
+	uint16_t u16BestCycles = 1;
+
+	u32Div = (uint32_t)(SIGGEN_TIM_CLOCK/(fFreq*SIGGEN_SPC) + 0.5);
+	if (u32Div < SIGGEN_MIN_DIV)
+		u32Div = SIGGEN_MIN_DIV;
+	if (u32Div > SIGGEN_MAX_DIV)
+		u32Div = SIGGEN_MAX_DIV;
+	fRate = SIGGEN_TIM_CLOCK/(double)u32Div;
+
+	for (u16Len = SIGGEN_MIN_TABLE; u16Len <= SIGGEN_MAX_TABLE; u16Len++)
+	{
+		uint16_t u16Cycles = (uint16_t)((fFreq*u16Len)/fRate + 0.5);
+		double fErr;
+
+		if ((u16Cycles == 0) || ((u16Cycles*SIGGEN_MIN_SPC) > u16Len))
+			continue;
+		fErr = fabs((fRate*u16Cycles)/u16Len - fFreq);
+		if (fErr <= fBestErr)
+		{
+			fBestErr = fErr;
+			u16BestLen = u16Len;
+			u16BestCycles = u16Cycles;
+		}
+	}
+
+	gu32Divider = u32Div;
+	gu16TableLen = u16BestLen;
+	gu16Cycles = u16BestCycles;
+	gfFreq = (fRate*u16BestCycles)/u16BestLen;
+
+	FillSine(pu16Table, gu16Cycles, gu16TableLen);
+}
+
+/**
+  * @brief  Computes divider and table for a hop: the table length is kept
+  * (DMA double buffer mode shares the transfer count), so the number of
+  * cycles in the table and the divider giving the closest frequency are
+  * searched.
+  * @param  fFreq: requested frequency (Hz)
+  * @param  pu16Table: table to fill
+  * @param  pu32Div: returns the divider
+  * @retval Actual frequency (Hz)
+  */
+static double SynthesizeHop (double fFreq, uint16_t *pu16Table, uint32_t *pu32Div)
+{
+	double fBestErr = 1e30;
+	double fBestFreq = 0;
+	uint32_t u32BestDiv = SIGGEN_MAX_DIV;
+	uint16_t u16BestCycles = 1;
+	uint16_t u16Cycles;
+
+	for (u16Cycles = 1; (u16Cycles*SIGGEN_MIN_SPC) <= gu16TableLen; u16Cycles++)
+	{
+		double fDiv = (SIGGEN_TIM_CLOCK*u16Cycles)/(fFreq*gu16TableLen);
+		uint32_t u32Div = (uint32_t)(fDiv + 0.5);
+		double fErr;
+
+		if (u32Div < SIGGEN_MIN_DIV)
+			break;
+		if (u32Div > SIGGEN_MAX_DIV)
+			continue;
+		fErr = fabs((SIGGEN_TIM_CLOCK*u16Cycles)/((double)u32Div*gu16TableLen) - fFreq);
+		if (fErr < fBestErr)
+		{
+			fBestErr = fErr;
+			fBestFreq = (SIGGEN_TIM_CLOCK*u16Cycles)/((double)u32Div*gu16TableLen);
+			u32BestDiv = u32Div;
+			u16BestCycles = u16Cycles;
+		}
+	}
+	if (fBestFreq == 0)
+		return 0;
+
+	FillSine(pu16Table, u16BestCycles, gu16TableLen);
+	*pu32Div = u32BestDiv;
+	return fBestFreq;
+}
+
 /**
   * @brief
   * @param  None
@@ -107,6 +667,8 @@ void SigGen_Enable (void)
 void SigGen_Disable (void)
 {
 	gu8Enabled = 0;
+	TIM_DMACmd(TIM6, TIM_DMA_Update, DISABLE);
+	DMA_Cmd(DMA1_Stream1, DISABLE);
 	DAC_DeInit();
 }
 
@@ -124,11 +686,7 @@ static void TIM6_Config(void)
 
 	/* Time base configuration */
 	TIM_TimeBaseStructInit(&TIM_TimeBaseStructure);
-#ifdef HIGH_RES_SIN
-	TIM_TimeBaseStructure.TIM_Period = 10;		// 59659 Hz N=128
-#else
-	TIM_TimeBaseStructure.TIM_Period = 43;		// 59659 Hz N=32
-#endif
+	TIM_TimeBaseStructure.TIM_Period = gu32Divider-1;	/* 10: 59659 Hz N=128 */
 	TIM_TimeBaseStructure.TIM_Prescaler = 0;
 	TIM_TimeBaseStructure.TIM_ClockDivision = 0;
 	TIM_TimeBaseStructure.TIM_CounterMode = TIM_CounterMode_Up;
@@ -137,6 +695,10 @@ static void TIM6_Config(void)
 	/* TIM6 TRGO selection */
 	TIM_SelectOutputTrigger(TIM6, TIM_TRGOSource_Update);
 
+	/* Divider changes take effect at the update event: the divider
+	 * stream writes ARR one sample ahead, like the DAC holding register */
+	TIM_ARRPreloadConfig(TIM6, ENABLE);
+
 	/* TIM6 enable counter */
 	TIM_Cmd(TIM6, ENABLE);
 }
@@ -150,6 +712,11 @@ static void DAC_Ch1_SineWaveConfig(void)
 {
 	DMA_InitTypeDef DMA_InitStructure;
 
+	/* Timer stopped: both streams must see the same first update event */
+	TIM_Cmd(TIM6, DISABLE);
+	TIM_DMACmd(TIM6, TIM_DMA_Update, DISABLE);
+	gArenaSram.tu16DacArr[gu8Active] = (uint16_t)(gu32Divider-1);
+
 	/* DAC channel1 Configuration */
 	DAC_InitStructure.DAC_Trigger = DAC_Trigger_T6_TRGO;
 	DAC_InitStructure.DAC_WaveGeneration = DAC_WaveGeneration_None;
@@ -160,9 +727,9 @@ static void DAC_Ch1_SineWaveConfig(void)
 	DMA_DeInit(DMA1_Stream5);
 	DMA_InitStructure.DMA_Channel = DMA_Channel_7;
 	DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)DAC_DHR12R1_ADDRESS;
-	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)&gtu16Sine12bit;
+	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)gArenaSram.tu16Dac[gu8Active];
 	DMA_InitStructure.DMA_DIR = DMA_DIR_MemoryToPeripheral;
-	DMA_InitStructure.DMA_BufferSize = sizeof(gtu16Sine12bit)/sizeof(uint16_t);
+	DMA_InitStructure.DMA_BufferSize = gu16TableLen;
 	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
 	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
 	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
@@ -175,14 +742,32 @@ static void DAC_Ch1_SineWaveConfig(void)
 	DMA_InitStructure.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
 	DMA_Init(DMA1_Stream5, &DMA_InitStructure);
 
-	/* Enable DMA1_Stream5 */
+	/* Double buffer mode, both memory registers on the playing table */
+	DMA_DoubleBufferModeConfig(DMA1_Stream5, (uint32_t)gArenaSram.tu16Dac[gu8Active], DMA_Memory_0);
+	DMA_DoubleBufferModeCmd(DMA1_Stream5, ENABLE);
+
+	/* DMA1_Stream1 channel7 configuration: TIM6 divider of each table ***/
+	DMA_DeInit(DMA1_Stream1);
+	DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)TIM6_ARR_ADDRESS;
+	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)&gArenaSram.tu16DacArr[gu8Active];
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Disable;
+	DMA_Init(DMA1_Stream1, &DMA_InitStructure);
+	DMA_DoubleBufferModeConfig(DMA1_Stream1, (uint32_t)&gArenaSram.tu16DacArr[gu8Active], DMA_Memory_0);
+	DMA_DoubleBufferModeCmd(DMA1_Stream1, ENABLE);
+
+	/* Enable DMA1_Stream5 and DMA1_Stream1 */
 	DMA_Cmd(DMA1_Stream5, ENABLE);
+	DMA_Cmd(DMA1_Stream1, ENABLE);
 
 	/* Enable DAC Channel1 */
 	DAC_Cmd(DAC_Channel_1, ENABLE);
 
 	/* Enable DMA for DAC Channel2 */
 	DAC_DMACmd(DAC_Channel_1, ENABLE);
+
+	/* Enable the divider stream requests and restart the timer */
+	TIM_DMACmd(TIM6, TIM_DMA_Update, ENABLE);
+	TIM_Cmd(TIM6, ENABLE);
 }
 
 /******************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
@@ -21,11 +21,36 @@
 
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
+#define SIGGEN_MAX_TABLE		1024		/* RAM waveform table size */
+#define SIGGEN_MIN_TABLE		16
+#define SIGGEN_MIN_SPC			8			/* Minimum samples per cycle */
+#define SIGGEN_MIN_DIV			11			/* Fastest DAC update: 7.636MHz */
+#define SIGGEN_MAX_DIV			65536
+#define SIGGEN_NUM_TABLES		2			/* DMA double buffer: playing and next */
+#define SIGGEN_MIN_FREQ			10.0
+#define SIGGEN_MAX_FREQ			500000.0
+#define SIGGEN_MAX_TONES		16			/* Multi-tone excitation */
+#define SIGGEN_MIN_LEVEL		0.01f		/* Output level, relative to full scale */
+#define SIGGEN_MAX_LEVEL		1.0f
+#define SIGGEN_MAX_DITHER		8			/* Table dither, DAC LSB peak */
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions ------------------------------------------------------- */
 
 extern void SigGen_Init (void);
 extern void SigGen_Enable (void);
 extern void SigGen_Disable (void);
+extern double SigGen_SetFreq (double fFreq);
+extern double SigGen_GetFreq (void);
+extern void SigGen_GetTable (uint32_t *pu32Div, uint16_t *pu16Len);
+extern uint16_t SigGen_GetPhase (void);
+extern double SigGen_Hop (double fFreq);
+extern double SigGen_SetTable (uint32_t u32Div, uint16_t u16Len, uint16_t u16Cycles);
+extern uint32_t SigGen_GetSettleUs (void);
+extern float SigGen_SetLevel (float fLevel);
+extern float SigGen_GetLevel (void);
+extern void SigGen_SetDither (uint8_t u8Lsb);
+extern uint8_t SigGen_GetDither (void);
+extern void SigGen_DMA_Handler (void);
+extern int SigGen_SetMultiTone (const uint16_t tu16Bins[], uint8_t u8Count, uint16_t u16BlockSize);
 
 #endif /* __SIGGEN_H */
@@ -228,6 +228,42 @@ void OTG_HS_EP1_OUT_IRQHandler(void)
 /*  file (startup_stm32f40xx.s/startup_stm32f427x.s).                         */
 /******************************************************************************/
 
+/**
+  * @brief  This function handles user button EXTI interrupt request.
+  * @param  None
+  * @retval None
+  */
+void EXTI0_IRQHandler(void)
+{
+	extern void Button_EXTI_Handler(void);
+
+	Button_EXTI_Handler();
+}
+
+/**
+  * @brief  This function handles TIM7 (button debounce) interrupt request.
+  * @param  None
+  * @retval None
+  */
+void TIM7_IRQHandler(void)
+{
+	extern void Button_Debounce_Handler(void);
+
+	Button_Debounce_Handler();
+}
+
+/**
+  * @brief  This function handles DMA1 Stream5 (DAC buffer switch) interrupt request.
+  * @param  None
+  * @retval None
+  */
+void DMA1_Stream5_IRQHandler(void)
+{
+	extern void SigGen_DMA_Handler(void);
+
+	SigGen_DMA_Handler();
+}
+
 /**
   * @brief  This function handles PPP interrupt request.
   * @param  None
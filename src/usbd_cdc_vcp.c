@@ -235,6 +235,10 @@ static uint16_t VCP_DataTx(void)
   */
 static uint16_t VCP_DataRx(uint8_t * Buf, uint32_t Len)
 {
+  extern void USB_Receive(uint8_t * Buf, uint32_t Len);
+
+  /* Host commands are handled by the application */
+  USB_Receive(Buf, Len);
 #if 0
   uint32_t i;
 
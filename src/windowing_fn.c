@@ -3,6 +3,13 @@
   * @file    windowing_fn.c
   * @author  Melchor Varela - EA4FRB
   * @brief   Windowing functions for sampled data
+  *
+  * Both channels go through the same window, so its gain cancels in the
+  * impedance ratio vm/(vr-vm) and in the per channel SNR taken from block
+  * to block spread: the measurement itself needs no correction. Absolute
+  * amplitudes do: the level loop (measure.c), the FFT analysis and the
+  * detector reports divide by the coherent gain, and noise per bin is
+  * referred to a rectangular window with the ENBW.
   ******************************************************************************
   * @copy
   *
@@ -18,30 +25,69 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include <math.h>
+#include <stddef.h>
 #include "stm32f4xx.h"
 #include "stm32f4_discovery.h"
 
 #include "sample.h"
+#include "arena.h"
 #include "windowing_fn.h"
 
 /* Private typedef -----------------------------------------------------------*/
+/* Generalized cosine window: w(i) = a0 - a1.cos(x) + a2.cos(2x) - a3.cos(3x) + a4.cos(4x) */
+typedef struct
+{
+	const char *pszName;
+	double tfA[5];
+} TWINDOW_DEF;
+
 /* Private define ------------------------------------------------------------*/
-/*#define WINDOW_HAMMING	1 */
-#define WINDOW_HANNING	1		/* Hanning window provides slightly better results */
+#define KAISER_I0_TERMS		25			/* Bessel I0 series terms */
 
 /* Private macro -------------------------------------------------------------*/
 
 /* Private variables ---------------------------------------------------------*/
-static float gWn[SAMPLE_BLOCK_SIZE];
+/* Window registry, indexed by WINDOW_xxx. Kaiser coefficients are computed */
+static const TWINDOW_DEF gtWindows[WINDOW_COUNT] =
+{
+	{ "RECT",		{ 1.0, 0, 0, 0, 0 } },
+	{ "HANN",		{ 0.5, 0.5, 0, 0, 0 } },
+	{ "HAMMING",	{ 0.54, 0.46, 0, 0, 0 } },
+	{ "BH4",		{ 0.35875, 0.48829, 0.14128, 0.01168, 0 } },
+	{ "FLATTOP",	{ 0.21557895, 0.41663158, 0.277263158, 0.083578947, 0.006947368 } },
+	{ "KAISER",		{ 0, 0, 0, 0, 0 } }
+};
+
+static float *gWn = gArenaCcm.tfWindow;
 static uint16_t gu16BlockSize;
 
+/* Active window and cached table parameters */
+static uint8_t gu8Type = WINDOW_HANN;
+static float gfBeta = WINDOW_KAISER_BETA;
+static uint16_t gu16CachedSize = 0;
+static uint8_t gu8CachedType = WINDOW_COUNT;
+static float gfCachedBeta = 0;
+
+/* Corrections for the cached table */
+static float gfCoherentGain = 1.0f;
+static float gfEnbw = 1.0f;
+static float gfScallopLoss = 0.0f;
+static float gfMainLobe = 2.0f;
+static float gfI0Beta = 1.0f;			/* Kaiser normalization, I0(beta) */
+
 /* Private function prototypes -----------------------------------------------*/
+static void BuildTable (void);
+static double BesselI0 (double fX);
+static float BesselI0f (float fX);
 
 /* Private functions ---------------------------------------------------------*/
 
 
 /**
-  * @brief Apply the windowing function to the samples array
+  * @brief Apply the windowing function to the samples array.
+  * The window is applied to the signal around ADC mid scale so that windows
+  * with negative coefficients (flat top) stay in the unsigned range. The
+  * constant mid scale term has no response on non DC bins.
   *
   * @param  gSampleData
   * @retval None
@@ -49,42 +95,277 @@ static uint16_t gu16BlockSize;
 void Windowing_Calc (uint16_t txSampleData[])
 {
   	int ii;
+  	float fMid = (float)(SAMPLE_MID_SCALE << Sample_GetOversampling());	/* Window applied around mid scale */
+
+  	if (gu8Type == WINDOW_RECT)
+  		return;
 
 	for (ii = 0; ii < gu16BlockSize; ii++)
   	{
-		txSampleData[ii] = (uint16_t) (gWn[ii] * txSampleData[ii]);
+		txSampleData[ii] = (uint16_t) (gWn[ii] * ((float)txSampleData[ii] - fMid) + fMid + 0.5f);
 	}
 }
 
 /**
-  * @brief Initializes the windowing function coefficients
+  * @brief Initializes the windowing function coefficients for the block size.
+  * The table is only recomputed if the block size or window changed.
   *
   * @param  None
   * @retval None
   */
 void Windowing_Init (uint16_t u16BlockSize)
 {
-  	int ii;
+  	if (u16BlockSize > SAMPLE_MAX_BLOCK_SIZE)
+  		u16BlockSize = SAMPLE_MAX_BLOCK_SIZE;
   	gu16BlockSize = u16BlockSize;
 
-  	#ifdef WINDOW_HAMMING
-	for (ii = 0; ii < u16BlockSize; ii++)
-  	{
-		gWn[ii] = 0.54 - 0.46*cos((2.0*M_PI*ii)/(float)u16BlockSize-1);
+  	BuildTable();
+}
+
+/**
+  * @brief Selects the active window
+  *
+  * @param  u8Type: WINDOW_xxx
+  * @param  fBeta: Kaiser beta, ignored for other windows
+  * @retval 0 if OK, -1 if unknown window
+  */
+int Windowing_Select (uint8_t u8Type, float fBeta)
+{
+	if (u8Type >= WINDOW_COUNT)
+		return -1;
+	gu8Type = u8Type;
+	if (u8Type == WINDOW_KAISER)
+		gfBeta = fBeta;
+	BuildTable();
+	return 0;
+}
+
+/**
+  * @brief Returns the active window
+  *
+  * @retval WINDOW_xxx
+  */
+uint8_t Windowing_GetType (void)
+{
+	return gu8Type;
+}
+
+/**
+  * @brief Returns the active Kaiser beta
+  *
+  * @retval beta
+  */
+float Windowing_GetBeta (void)
+{
+	return gfBeta;
+}
+
+/**
+  * @brief Returns the window name
+  *
+  * @param  u8Type: WINDOW_xxx
+  * @retval name
+  */
+const char *Windowing_GetName (uint8_t u8Type)
+{
+	if (u8Type >= WINDOW_COUNT)
+		return "?";
+	return gtWindows[u8Type].pszName;
+}
+
+/**
+  * @brief Coherent gain of the active window: sum(w)/N.
+  * Divide windowed amplitudes by it to get the actual amplitude.
+  *
+  * @retval coherent gain
+  */
+float Windowing_GetCoherentGain (void)
+{
+	return gfCoherentGain;
+}
+
+/**
+  * @brief Equivalent noise bandwidth of the active window in bins:
+  * N.sum(w^2)/sum(w)^2. Multiply per bin SNR by it to refer it to a
+  * rectangular window.
+  *
+  * @retval ENBW in bins
+  */
+float Windowing_GetEnbw (void)
+{
+	return gfEnbw;
+}
+
+/**
+  * @brief Scalloping loss of the active window: attenuation of a tone half
+  * a bin away from the bin center, in dB. Worst case leakage error for
+  * non coherent frequencies.
+  *
+  * @retval scalloping loss (dB)
+  */
+float Windowing_GetScallopLoss (void)
+{
+	return gfScallopLoss;
+}
+
+/**
+  * @brief Returns the coefficients of the active window, for kernels that
+  * window on the fly (Goertzel_CalcDual)
+  *
+  * @retval Table of the Windowing_Init block size, NULL for rectangular
+  */
+const float *Windowing_GetTable (void)
+{
+	if (gu8Type == WINDOW_RECT)
+		return NULL;
+	return gWn;
+}
+
+/**
+  * @brief Active window at sample i of a block of any size, for kernels
+  * that window their own length on the fly (Fft_Analyze) and leave the
+  * table of the measurement block alone. Cosine windows take cos(k.x),
+  * x = 2.pi.i/N, k = 1 to 4, from the caller (twiddle table); Kaiser runs
+  * the Bessel series in single precision.
+  *
+  * @param  u16Idx: sample i
+  * @param  u16Size: block size N
+  * @param  tfCos: cos(k.x) for k = 1 to 4, ignored for Kaiser
+  * @retval w(i)
+  */
+float Windowing_Eval (uint16_t u16Idx, uint16_t u16Size, const float tfCos[4])
+{
+	const double *pfA = gtWindows[gu8Type].tfA;
+	float fR;
+
+	if (gu8Type == WINDOW_KAISER)
+	{
+		fR = (2.0f*u16Idx)/(float)u16Size - 1.0f;
+		return BesselI0f(gfBeta*sqrtf(1.0f - fR*fR)) / gfI0Beta;
 	}
-#endif
-#ifdef WINDOW_HANNING
-	for (ii = 0; ii < u16BlockSize; ii++)
-  	{
-		gWn[ii] = (float)(0.5 - 0.5*cos((2.0*M_PI*ii)/(float)u16BlockSize-1));
+	return (float)pfA[0] - (float)pfA[1]*tfCos[0] + (float)pfA[2]*tfCos[1]
+			- (float)pfA[3]*tfCos[2] + (float)pfA[4]*tfCos[3];
+}
+
+/**
+  * @brief Main lobe half width of the active window, in bins: distance
+  * from the peak to the first null. A cosine window of K terms has its
+  * first null at K bins; Kaiser at sqrt(1+(beta/pi)^2). Tones closer than
+  * this leak into each other's detector.
+  *
+  * @retval half width in bins
+  */
+float Windowing_GetMainLobe (void)
+{
+	return gfMainLobe;
+}
+
+/**
+  * @brief Computes the periodic (DFT even) window table and its corrections
+  * if the cached one does not match the current selection.
+  *
+  * @param  None
+  * @retval None
+  */
+static void BuildTable (void)
+{
+	const double *pfA = gtWindows[gu8Type].tfA;
+	double fSum = 0, fSum2 = 0;
+	double fReHalf = 0, fImHalf = 0;
+	double fI0Beta = 1.0;
+	int ii;
+
+	if ((gu16CachedSize == gu16BlockSize) && (gu8CachedType == gu8Type)
+			&& ((gu8Type != WINDOW_KAISER) || (gfCachedBeta == gfBeta)))
+		return;
+
+	if (gu8Type == WINDOW_KAISER)
+	{
+		fI0Beta = BesselI0(gfBeta);
+		gfI0Beta = BesselI0f(gfBeta);
 	}
-#endif
-#ifdef WINDOW_BLACKMAN
-	for (ii = 0; ii < u16BlockSize; ii++)
+
+	for (ii = 0; ii < gu16BlockSize; ii++)
   	{
-		gWn[ii] = 0.426591 - 0.496561 * cos((2*M_PI*ii)/(float)u16BlockSize-1) + 0.076848 * cos((4*PI*ii)/(FLOATING)u16BlockSize-1);
+		double fX = (2.0*M_PI*ii)/(double)gu16BlockSize;
+		double fW;
+
+		if (gu8Type == WINDOW_KAISER)
+		{
+			double fR = (2.0*ii)/(double)gu16BlockSize - 1.0;
+			fW = BesselI0(gfBeta*sqrt(1.0 - fR*fR)) / fI0Beta;
+		}
+		else
+		{
+			fW = pfA[0] - pfA[1]*cos(fX) + pfA[2]*cos(2.0*fX) - pfA[3]*cos(3.0*fX) + pfA[4]*cos(4.0*fX);
+		}
+		gWn[ii] = (float)fW;
+
+		fSum += fW;
+		fSum2 += fW*fW;
+		fReHalf += fW*cos(fX/2.0);
+		fImHalf += fW*sin(fX/2.0);
+	}
+
+	gfCoherentGain = (float)(fSum/(double)gu16BlockSize);
+	gfEnbw = (float)((gu16BlockSize*fSum2)/(fSum*fSum));
+	gfScallopLoss = (float)(-20.0*log10(sqrt(fReHalf*fReHalf + fImHalf*fImHalf)/fSum));
+	if (gu8Type == WINDOW_KAISER)
+	{
+		gfMainLobe = (float)sqrt(1.0 + (gfBeta*gfBeta)/(M_PI*M_PI));
+	}
+	else
+	{
+		for (ii = 4; (ii > 0) && (pfA[ii] == 0); ii--)
+		{;}
+		gfMainLobe = (float)(ii + 1);
+	}
+
+	gu16CachedSize = gu16BlockSize;
+	gu8CachedType = gu8Type;
+	gfCachedBeta = gfBeta;
+}
+
+/**
+  * @brief Modified Bessel function of the first kind, order 0 (power series)
+  *
+  * @param  fX
+  * @retval I0(x)
+  */
+static double BesselI0 (double fX)
+{
+	double fSum = 1.0;
+	double fTerm = 1.0;
+	double fHalf = fX/2.0;
+	int ii;
+
+	for (ii = 1; ii < KAISER_I0_TERMS; ii++)
+	{
+		fTerm *= fHalf/(double)ii;
+		fSum += fTerm*fTerm;
+	}
+	return fSum;
+}
+
+/**
+  * @brief Single precision BesselI0, for windows evaluated per sample
+  *
+  * @param  fX
+  * @retval I0(x)
+  */
+static float BesselI0f (float fX)
+{
+	float fSum = 1.0f;
+	float fTerm = 1.0f;
+	float fHalf = fX/2.0f;
+	int ii;
+
+	for (ii = 1; ii < KAISER_I0_TERMS; ii++)
+	{
+		fTerm *= fHalf/(float)ii;
+		fSum += fTerm*fTerm;
 	}
-#endif
+	return fSum;
 }
 
 /************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
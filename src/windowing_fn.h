@@ -26,11 +26,31 @@
 
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
+/* Window functions */
+#define WINDOW_RECT				0	/* Rectangular, for coherent sampling */
+#define WINDOW_HANN				1
+#define WINDOW_HAMMING			2
+#define WINDOW_BLACKMAN_HARRIS	3	/* 4 term Blackman-Harris */
+#define WINDOW_FLATTOP			4
+#define WINDOW_KAISER			5
+#define WINDOW_COUNT			6
+
+#define WINDOW_KAISER_BETA		6.0f	/* Default Kaiser beta */
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions ------------------------------------------------------- */
 
 extern void Windowing_Calc (uint16_t gSampleData[]);
 extern void Windowing_Init (uint16_t u16BlockSize);
+extern int Windowing_Select (uint8_t u8Type, float fBeta);
+extern uint8_t Windowing_GetType (void);
+extern float Windowing_GetBeta (void);
+extern const char *Windowing_GetName (uint8_t u8Type);
+extern float Windowing_GetCoherentGain (void);
+extern float Windowing_GetEnbw (void);
+extern float Windowing_GetScallopLoss (void);
+extern float Windowing_GetMainLobe (void);
+extern const float *Windowing_GetTable (void);
+extern float Windowing_Eval (uint16_t u16Idx, uint16_t u16Size, const float tfCos[4]);
 
 #endif	/* __WINDOWING_FN_H__ */
 
@@ -0,0 +1,214 @@
+/**
+  ******************************************************************************
+  * @file    zparam.c
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Derived impedance parameters
+  *
+  * Series and parallel equivalents, Q, D, ESR and admittance derived from
+  * a measured impedance. No extra acquisitions are needed and only the
+  * requested fields are computed.
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <math.h>
+
+#include "stm32f4xx.h"
+#include "zparam.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+#define LIMIT_MAX_C			999999.99
+#define LIMIT_MAX_L			999999.99
+#define LIMIT_MAX_R			999999.99
+#define LIMIT_MAX_Q			9999.99
+#define LIMIT_MIN_R			0.1
+#define LIMIT_MIN_X			1.0
+#define LIMIT_MIN_Y			1e-12
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+/* Private function prototypes -----------------------------------------------*/
+static double CalcLs (double fFreq, complex double zs);
+static double CalcCs (double fFreq, complex double zs);
+static double Limit (double fVal, double fMax);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief Computes the derived parameters of an impedance
+  *
+  * @param z		Impedance
+  * @param fFreq	Frequency (Hz)
+  * @param u16Fields	ZPARAM_xxx fields to compute
+  * @param pParam	Returns the parameters. Fields not requested are not set
+  * @retval None
+  */
+void ZParam_Calc (complex double z, double fFreq, uint16_t u16Fields, TZPARAM *pParam)
+{
+	double fW = 2.0*M_PI*fFreq;
+	double fR = __real__ z;
+	double fX = __imag__ z;
+
+	if (!pParam)
+		return;
+
+	pParam->z = z;
+	pParam->u8Flags = 0;
+	pParam->fUncR = -1;
+	pParam->fUncX = -1;
+	pParam->fUncMag = -1;
+	pParam->fUncPhase = -1;
+	if (u16Fields & ZPARAM_POLAR)
+	{
+		pParam->fMag = CAbs(z);
+		pParam->fPhase = RAD2DEG(atan2(fX, fR));
+	}
+	if (u16Fields & ZPARAM_CS)
+		pParam->fCs = CalcCs(fFreq, z);
+	if (u16Fields & ZPARAM_LS)
+		pParam->fLs = CalcLs(fFreq, z);
+	if (u16Fields & ZPARAM_QD)
+	{
+		pParam->fQ = (fabs(fR) > LIMIT_MIN_R) ? Limit(fabs(fX)/fabs(fR), LIMIT_MAX_Q) : LIMIT_MAX_Q;
+		pParam->fD = (fabs(fX) > LIMIT_MIN_X) ? Limit(fabs(fR)/fabs(fX), LIMIT_MAX_Q) : LIMIT_MAX_Q;
+	}
+
+	/* Parallel model from admittance Y = 1/Z = G + jB */
+	if (u16Fields & (ZPARAM_RP|ZPARAM_CP|ZPARAM_LP|ZPARAM_Y))
+	{
+		double fMag2 = fR*fR + fX*fX;
+		double fG, fB;
+
+		if (fMag2 < LIMIT_MIN_Y)
+			fMag2 = LIMIT_MIN_Y;
+		fG = fR/fMag2;
+		fB = -fX/fMag2;
+		__real__ pParam->y = fG;
+		__imag__ pParam->y = fB;
+
+		if (u16Fields & ZPARAM_RP)
+		{
+			pParam->fRp = (fabs(fG) > LIMIT_MIN_Y) ? Limit(1.0/fG, LIMIT_MAX_R) : LIMIT_MAX_R;
+			pParam->fXp = (fabs(fB) > LIMIT_MIN_Y) ? Limit(-1.0/fB, LIMIT_MAX_R) : LIMIT_MAX_R;
+		}
+		/* Cp = B/w (pF), Lp = -1/(w.B) (uH) */
+		if (u16Fields & ZPARAM_CP)
+			pParam->fCp = Limit((fB/fW)*1e12, LIMIT_MAX_C);
+		if (u16Fields & ZPARAM_LP)
+			pParam->fLp = (fabs(fB) > LIMIT_MIN_Y) ? Limit((-1.0/(fW*fB))*1e6, LIMIT_MAX_L) : LIMIT_MAX_L;
+	}
+}
+
+/**
+  * @brief Formats the requested parameters as text
+  *
+  * @param pszText	Output buffer (400 chars for ZPARAM_ALL)
+  * @param pParam	Parameters
+  * @param u16Fields	ZPARAM_xxx fields to output
+  * @retval Number of chars written
+  */
+int ZParam_Format (char *pszText, const TZPARAM *pParam, uint16_t u16Fields)
+{
+	int iLen = 0;
+
+	if (u16Fields & ZPARAM_POLAR)
+		iLen += sprintf(&pszText[iLen], "%.2f<%.2f, ", pParam->fMag, pParam->fPhase);
+	if (u16Fields & ZPARAM_RX)
+		iLen += sprintf(&pszText[iLen], "R:%.2f, X:%.2f, ", __real__ pParam->z, __imag__ pParam->z);
+	if (u16Fields & ZPARAM_CS)
+		iLen += sprintf(&pszText[iLen], "Cs:%.2f, ", pParam->fCs);
+	if (u16Fields & ZPARAM_LS)
+		iLen += sprintf(&pszText[iLen], "Ls:%.2f, ", pParam->fLs);
+	if (u16Fields & ZPARAM_RP)
+		iLen += sprintf(&pszText[iLen], "Rp:%.2f, Xp:%.2f, ", pParam->fRp, pParam->fXp);
+	if (u16Fields & ZPARAM_CP)
+		iLen += sprintf(&pszText[iLen], "Cp:%.2f, ", pParam->fCp);
+	if (u16Fields & ZPARAM_LP)
+		iLen += sprintf(&pszText[iLen], "Lp:%.2f, ", pParam->fLp);
+	if (u16Fields & ZPARAM_QD)
+		iLen += sprintf(&pszText[iLen], "Q:%.3f, D:%.4f, ", pParam->fQ, pParam->fD);
+	if (u16Fields & ZPARAM_ESR)
+		iLen += sprintf(&pszText[iLen], "ESR:%.3f, ", __real__ pParam->z);
+	if (u16Fields & ZPARAM_Y)
+		iLen += sprintf(&pszText[iLen], "G:%.3e, B:%.3e, ", __real__ pParam->y, __imag__ pParam->y);
+	if ((u16Fields & ZPARAM_UNC) && (pParam->fUncR >= 0))
+		iLen += sprintf(&pszText[iLen], "uR:%.3f, uX:%.3f, ", pParam->fUncR, pParam->fUncX);
+	if ((u16Fields & ZPARAM_UNC) && (pParam->fUncMag >= 0))
+		iLen += sprintf(&pszText[iLen], "uZ:%.3f, uPh:%.3f, ", pParam->fUncMag, pParam->fUncPhase);
+	if ((u16Fields & ZPARAM_SNR) && (pParam->fUncMag >= 0))
+		iLen += sprintf(&pszText[iLen], "SNR1:%.1f, SNR2:%.1f, ", pParam->fSnr1, pParam->fSnr2);
+	if ((u16Fields & ZPARAM_FLAGS) && pParam->u8Flags)
+		iLen += sprintf(&pszText[iLen], "Fl:%02X, ", pParam->u8Flags);
+
+	/* Replace last separator */
+	if (iLen >= 2)
+		iLen -= 2;
+	iLen += sprintf(&pszText[iLen], "\n\r");
+	return iLen;
+}
+
+/**
+  * @brief Calculates series inductance
+  *
+  * @param fFreq	Frequency
+  * @param zs		Impedance
+  * @retval Inductance in uH
+  */
+static double CalcLs (double fFreq, complex double zs)
+{
+	double dfLs;
+
+	dfLs = (__imag__ zs)/(double)(2.0*M_PI*(fFreq/1000000.0));
+
+	if (fabs(dfLs) > LIMIT_MAX_L)
+		dfLs = LIMIT_MAX_L;
+
+	return dfLs;
+}
+
+/**
+  * @brief Calculates series capacitance
+  *
+  * @param fFreq	Frequency
+  * @param zs		Impedance
+  * @retval Capacitance in pF
+  */
+static double CalcCs (double fFreq, complex double zs)
+{
+	double dfCs;
+
+	if (fabs(__imag__ zs) > LIMIT_MIN_X)
+		dfCs = ((double)(-1000000.0)/(double)(__imag__ zs*2.0*M_PI*fFreq/1000000.0));
+	else
+		dfCs = -LIMIT_MAX_C;
+
+	if (fabs(dfCs) > LIMIT_MAX_C)
+		dfCs = -LIMIT_MAX_C;
+
+	return dfCs;
+}
+
+/**
+  * @brief Clamps a value to +/-fMax
+  *
+  * @param fVal
+  * @param fMax
+  * @retval clamped value
+  */
+static double Limit (double fVal, double fMax)
+{
+	if (fVal > fMax)
+		return fMax;
+	if (fVal < -fMax)
+		return -fMax;
+	return fVal;
+}
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/
@@ -0,0 +1,73 @@
+/**
+  ******************************************************************************
+  * @file    zparam.h
+  * @author  Melchor Varela - EA4FRB
+  * @brief   Derived impedance parameters
+  ******************************************************************************
+  * @copy
+  *
+  * <h2><center>&copy; COPYRIGHT 2020 Melchor Varela - EA4FRB </center></h2>
+  * Melchor Varela, Madrid, Spain.
+  * melchor.varela@gmail.com
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __ZPARAM_H__
+#define __ZPARAM_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include <math.h>
+
+#include "complex.h"
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+	complex double z;		/* Impedance (ohm) */
+	double fMag;			/* |Z| (ohm) */
+	double fPhase;			/* Phase (deg) */
+	double fCs;				/* Series capacitance (pF) */
+	double fLs;				/* Series inductance (uH) */
+	double fRp;				/* Parallel resistance (ohm) */
+	double fXp;				/* Parallel reactance (ohm) */
+	double fCp;				/* Parallel capacitance (pF) */
+	double fLp;				/* Parallel inductance (uH) */
+	double fQ;				/* Quality factor |X|/R */
+	double fD;				/* Dissipation factor R/|X| */
+	complex double y;		/* Admittance G+jB (S) */
+	uint8_t u8Flags;		/* Measurement flags (MEASURE_FLAG_xxx), set by the caller */
+	float fUncR;			/* Standard uncertainty of R, X, |Z| (ohm) and phase (deg), */
+	float fUncX;			/* set by the caller, negative if unknown */
+	float fUncMag;
+	float fUncPhase;
+	float fSnr1;			/* Channel SNR (dB), set by the caller with the uncertainty */
+	float fSnr2;
+} TZPARAM;
+
+/* Exported constants --------------------------------------------------------*/
+/* Output field selection */
+#define ZPARAM_POLAR		0x0001	/* |Z| and phase */
+#define ZPARAM_RX			0x0002	/* Series R and X */
+#define ZPARAM_CS			0x0004	/* Series C */
+#define ZPARAM_LS			0x0008	/* Series L */
+#define ZPARAM_RP			0x0010	/* Parallel R and X */
+#define ZPARAM_CP			0x0020	/* Parallel C */
+#define ZPARAM_LP			0x0040	/* Parallel L */
+#define ZPARAM_QD			0x0080	/* Q and D */
+#define ZPARAM_ESR			0x0100	/* Equivalent series resistance */
+#define ZPARAM_Y			0x0200	/* Admittance G and B */
+#define ZPARAM_FLAGS		0x0400	/* Measurement flags, only when set */
+#define ZPARAM_UNC			0x0800	/* Uncertainty of R, X, |Z| and phase, when known */
+#define ZPARAM_SNR			0x1000	/* SNR of both channels, when known */
+#define ZPARAM_ALL			0x1FFF
+
+#define ZPARAM_DEFAULT		(ZPARAM_POLAR|ZPARAM_RX|ZPARAM_CS|ZPARAM_LS|ZPARAM_FLAGS|ZPARAM_UNC|ZPARAM_SNR)
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+extern void ZParam_Calc (complex double z, double fFreq, uint16_t u16Fields, TZPARAM *pParam);
+extern int ZParam_Format (char *pszText, const TZPARAM *pParam, uint16_t u16Fields);
+
+#endif	 /* __ZPARAM_H__ */
+
+/************* (C) COPYRIGHT 2020 Melchor Varela - EA4FRB *****END OF FILE****/